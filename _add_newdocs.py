@@ -28,6 +28,7 @@ Initialize the module. Replaces all the ufunc inner loops with a new version
 using ``PyUFunc_ReplaceLoopBySignature``. If none of the other options are
 enabled, the original inner loop function will be called. Will also call
 ``numpy.setbufsize(8192 * 1024)`` to work around numpy issue 17649.
+With ``calibrate=True`` also runs ``thread_calibrate``.
 """)
 
 
@@ -47,6 +48,27 @@ add_newdoc('fast_numpy_loops', "atop_isenabled",
 "returns True if atop enabled, else False")
 
 
+add_newdoc('fast_numpy_loops', "atop_getsummode",
+"Get the name of the way float32 and float64 sums are reduced")
+
+
+add_newdoc('fast_numpy_loops', "atop_setsummode",
+"""
+Set how the atop loops reduce float32 and float64 sums (``np.add.reduce``,
+``np.sum``), return previous value.
+
+  - ``'pairwise'`` (default): numpy's pairwise summation, runs of 128
+    elements in 8 accumulators added in a tree of halves. The error grows
+    with log(n) and an unthreaded sum is the same as numpy's bit for bit
+  - ``'fast'``: 4 vector accumulators over the whole block then a serial
+    loop, the error grows with n
+
+When threaded each block is summed on its own and the block sums are then
+summed the same way, so the result can differ from numpy's in the last bits
+but stays within the same error bound.
+""")
+
+
 add_newdoc('fast_numpy_loops', "thread_enable",
 """
 Enable worker threads for inner loops when they are large enough to justify
@@ -70,6 +92,375 @@ add_newdoc('fast_numpy_loops', "thread_setworkers",
 "Set the number of worker threads, return previous value. Must be at least 1.")
 
 
+add_newdoc('fast_numpy_loops', "thread_getpoolsize",
+"Get the number of worker threads running in the pool")
+
+
+add_newdoc('fast_numpy_loops', "thread_setpoolsize",
+"""
+Start or stop worker threads so ``n`` are running, return previous value.
+Threads being stopped finish the job they are working on and are joined
+before this returns. With 0 every ufunc runs on the calling thread only.
+Unlike `thread_setworkers` this changes the threads that exist, not how many
+are woken up per call.
+
+A process forked from one with worker threads (gunicorn prefork,
+``multiprocessing`` with the fork start method) starts the same number of
+its own on its first threaded ufunc. Waiting in the child on a job from
+`thread_submit` that was still running at the fork runs it again on the
+calling thread, or raises RuntimeError if ``out`` is one of its inputs.
+""")
+
+
+add_newdoc('fast_numpy_loops', "thread_setspin",
+"""
+Set how many microseconds idle worker threads spin waiting for new work
+before they go to sleep, return previous value. Back to back ufunc calls then
+skip the cost of waking the threads. 0 (the default) sleeps right away. With
+``backoff`` (the default) the pause between checks doubles up to 64 pauses.
+""")
+
+
+add_newdoc('fast_numpy_loops', "thread_getspin",
+"Get a tuple of the spin time in microseconds and if backoff is used")
+
+
+add_newdoc('fast_numpy_loops', "thread_spinstats",
+"""
+Return a dict of counters: ``spin_wakes`` is how often a worker found new
+work while spinning, ``sleep_waits`` how often it went to sleep and
+``wakes_skipped`` how often a new work item did not need to wake anyone.
+""")
+
+
+add_newdoc('fast_numpy_loops', "thread_setwaitspin",
+"""
+Set how many microseconds the main thread spins waiting for the worker
+threads to finish a ufunc before it sleeps, return previous value. The worker
+that finishes the last block wakes it. Defaults to 50.
+""")
+
+
+add_newdoc('fast_numpy_loops', "thread_waitstats",
+"""
+Return a dict with how the threads calling ufuncs waited for the worker
+threads: ``spin_count`` and ``spin_ns`` for the waits and time spent spinning,
+``blocked_count`` and ``blocked_ns`` for the waits that had to sleep and the
+time spent asleep. ``slots_full`` counts the calls that ran without threads
+because 64 other threads already had a threaded ufunc in flight.
+""")
+
+
+add_newdoc('fast_numpy_loops', "thread_getbudget",
+"Get the number of cores in the process wide concurrency budget, 0 for no budget")
+
+
+add_newdoc('fast_numpy_loops', "thread_setbudget",
+"""
+Set the number of cores in the process wide concurrency budget, return
+previous value. 0 (the default) turns the budget off.
+
+Every worker thread woken for a ufunc takes a token from the budget and
+gives it back when the ufunc returns, the calling thread needs none. When
+the tokens run out ufuncs wake fewer worker threads, down to none. Other
+thread pools (BLAS, OpenMP) hold tokens through `thread_reserve` or
+`reserve_cores` from python, or the ``_budget_api`` capsule from C (see
+``src/atop/budget.h``). A budget of ``topology()['usable_cpus'] - 1`` keeps
+the process from running more threads than cores.
+""")
+
+
+add_newdoc('fast_numpy_loops', "thread_budgetstats",
+"""
+Return a dict with the tokens of the concurrency budget: ``total``,
+``in_use`` (held by running ufuncs and by other pools), ``reserved`` (the
+part held by other pools), ``available`` (-1 with no budget) and ``denied``
+(tokens asked for and not granted since the start).
+""")
+
+
+add_newdoc('fast_numpy_loops', "thread_reserve",
+"""
+thread_reserve(count)
+
+Take up to ``count`` cores of the concurrency budget for another thread pool
+and return how many were granted. Give them back with `thread_unreserve`.
+With no budget every core asked for is granted.
+""")
+
+
+add_newdoc('fast_numpy_loops', "thread_unreserve",
+"Give back cores taken by `thread_reserve`")
+
+
+add_newdoc('fast_numpy_loops', "thread_setblocksize",
+"""
+Set the number of elements in each block handed out to the worker threads,
+return previous value. 0 (the default) picks the block size for each call from
+the bytes per element, how expensive the op is and the L2 cache size.
+""")
+
+
+add_newdoc('fast_numpy_loops', "thread_getblocksize",
+"Get the number of elements in each block, 0 when picked for each call")
+
+
+add_newdoc('fast_numpy_loops', "thread_setlatencybytes",
+"""
+Set the most bytes (summed over the inputs and outputs) a ufunc call can
+touch and still go in the latency lane, return previous value. Worker threads
+busy with a larger (bulk) call leave it between blocks to work on calls in the
+latency lane, so a small call from another thread does not wait behind a
+large one. 0 puts every call in the bulk lane. The default is 1 MiB.
+""")
+
+
+add_newdoc('fast_numpy_loops', "thread_getlatencybytes",
+"Get the most bytes a ufunc call in the latency lane touches, 0 for no latency lane")
+
+
+add_newdoc('fast_numpy_loops', "thread_setmaxthreads",
+"""
+Cap the number of worker threads used by a ufunc (given by name, for example
+``"add"``) for all dtypes, return previous value. 0 (the default) picks the
+number for each call from the length of the arrays and how expensive the op
+is. Raises ValueError for a ufunc that is not replaced.
+""")
+
+
+add_newdoc('fast_numpy_loops', "thread_getmaxthreads",
+"Get the cap on worker threads for a ufunc given by name, 0 when picked for each call")
+
+
+add_newdoc('fast_numpy_loops', "thread_submit",
+"""
+thread_submit(ufunc, out, in1, in2=None)
+
+Start ``ufunc(in1, in2, out=out)`` on the worker threads and return a job
+handle right away, without waiting for the result. Returns None when the call
+cannot run in the background: the arrays must be C contiguous, aligned, in
+native byte order and the same length, ``out`` must not overlap an input
+unless it is the same array, the inputs must be the same dtype and ``out`` the
+dtype the ufunc loop returns, and the loop must be a fast (atop) loop. The
+arrays must not be changed until the job is waited on. A job nobody waits on
+still gives its worker thread slot back as soon as it is complete. Most users
+want ``submit``, which returns a ``ThreadFuture``.
+""")
+
+
+add_newdoc('fast_numpy_loops', "thread_wait",
+"Block until a job from ``thread_submit`` is complete, the calling thread helps with the work")
+
+
+add_newdoc('fast_numpy_loops', "thread_isdone",
+"Return True when a job from ``thread_submit`` is complete, does not block")
+
+
+add_newdoc('fast_numpy_loops', "thread_reducerows",
+"""
+thread_reducerows(ufunc, out, a, useout=False)
+
+Run ``ufunc.reduce(a, axis=-1, out=out)`` with the rows split over the worker
+threads. numpy calls the reduce loop once per row, which is too short to
+thread on its own. Rows use the atop reduce of ``ufunc``, or numpy's own loop
+when there is none (float ``minimum`` and ``maximum``) or atop is disabled;
+a ufunc name only uses the atop reduce. ``a`` and ``out`` must be C contiguous,
+aligned and in native byte order with the same dtype, ``out`` holding one
+element per row. Each row starts from its
+first element, or with ``useout`` from the value already in ``out`` (numpy
+starts from the identity of the ufunc or from ``initial=``). Returns ``out``,
+or None when the call is not supported; ``reduce`` then calls ``ufunc.reduce``.
+
+A float sum reduces each row in one pass, while numpy may split a long row
+into buffer chunks or threaded blocks, so sums of rows longer than a few
+thousand elements can differ from ``ufunc.reduce`` in the last bits.
+""")
+
+
+add_newdoc('fast_numpy_loops', "thread_reducecols",
+"""
+thread_reducecols(ufunc, out, a, useout=False)
+
+Run ``ufunc.reduce(a, axis=0, out=out)`` on the worker threads. numpy adds
+one row at a time into ``out``, which never threads and gets no reduce loop.
+Wide arrays are split into column tiles of 16KB that each walk every row, in
+numpy's order. When there are too few tiles for the threads the rows are
+split into panels, each reduced into its own partial row while it is in
+cache, and the partial rows are merged in order. With
+``thread_setdeterministic`` float panels have a fixed size. Takes the same
+arguments as ``thread_reducerows``, ``out`` holding ``a[0].size`` elements.
+""")
+
+
+add_newdoc('fast_numpy_loops', "thread_calibrate",
+"""
+Time each replaced ufunc loop with and without threads on growing lengths
+and only thread calls at least as long as the first length where threads win.
+Returns a list of ``(ufunc name, dtype, min_elements)``; ``min_elements`` is
+2**31-1 when threads never won. Takes a few seconds. Also run by
+``initialize(calibrate=True)``.
+""")
+
+
+add_newdoc('fast_numpy_loops', "thread_getschedule",
+"Get the name of the schedule used to hand out blocks to the worker threads")
+
+
+add_newdoc('fast_numpy_loops', "thread_setschedule",
+"""
+Set how blocks of a threaded loop are handed out, return previous value.
+
+  - ``'ring'``: every thread takes the next block from one shared counter
+  - ``'steal'``: every thread gets its own range of blocks up front, idle
+    threads steal half of the remaining range of another thread
+  - ``'static'``: every thread claims its own range of blocks up front and
+    walks it without touching shared counters, only the last eighth of the
+    blocks is handed out one at a time to even out threads that finish late
+""")
+
+
+add_newdoc('fast_numpy_loops', "thread_getdeterministic",
+"Returns True if float reductions are split the same way whatever the threads")
+
+
+add_newdoc('fast_numpy_loops', "thread_setdeterministic",
+"""
+With True, float32 and float64 reductions by the atop loops (``np.add.reduce``,
+``np.multiply.reduce``) give the same bits whatever the number of worker
+threads, `thread_setworkers`, `thread_setmaxthreads`, `thread_setblocksize`,
+the schedule, or whether threading is on at all. Returns previous value.
+
+An inner loop longer than 16384 elements is always cut into blocks of 16384
+elements. Each block is reduced on its own and the block results are then
+reduced in order (a pairwise tree with ``atop_setsummode('pairwise')``),
+whichever thread did the block. Shorter loops are reduced in one go as
+usual. The results can differ in the last bits from numpy's own loop, and
+from a run with this off, but not from machine to machine.
+
+What it costs: the block size no longer follows the cost model, and a loop
+too short to thread still pays for the reduce of the block results. Both are
+a few percent at most for sums of more than a few blocks (see
+``benchmarks/sum_accuracy.py --deterministic 0,1``). With the atop loops
+disabled numpy's loop is used and this has no effect.
+""")
+
+
+add_newdoc('fast_numpy_loops', "thread_getwakemode",
+"Get the name of the way sleeping worker threads are woken up")
+
+
+add_newdoc('fast_numpy_loops', "thread_setwakemode",
+"""
+Set how sleeping worker threads are woken up for a threaded loop, return
+previous value.
+
+  - ``'flat'``: the calling thread wakes every thread needed in one call
+  - ``'tree'``: the worker threads are in groups of threads sharing a last
+    level cache, the calling thread wakes one leader per group needed and
+    each leader wakes the rest of its group. Linux only, elsewhere the same
+    as ``'flat'``
+  - ``'targeted'``: every worker thread sleeps on its own futex word and the
+    calling thread wakes exactly the threads it needs, the lowest numbered
+    first so the same threads (with warm caches) take the small jobs and the
+    rest stay asleep. Linux only, elsewhere the same as ``'flat'``
+  - ``'auto'``: ``'tree'`` when more than 32 worker threads share a numa
+    node, else ``'flat'``
+
+In every mode at most `thread_setworkers` (or the ``MaxThreads`` of the
+loop) worker threads join a job, even when more are awake or spinning.
+`thread_info` shows the groups.
+""")
+
+
+add_newdoc('fast_numpy_loops', "thread_getnumapolicy",
+"Get the name of the policy used to pick the numa nodes that run a threaded loop")
+
+
+add_newdoc('fast_numpy_loops', "thread_setnumapolicy",
+"""
+Set which numa nodes run a threaded loop, return previous value.
+
+  - ``'local'``: the worker threads on the node holding the input memory. If
+    the input spans nodes, the worker threads on all nodes
+  - ``'interleave'``: the worker threads on all nodes
+""")
+
+
+add_newdoc('fast_numpy_loops', "thread_numainfo",
+"""
+Return a list with a dict for each numa node that has worker threads: the
+kernel ``node`` number, the number of ``cpus`` this process may use on it and
+the number of ``workers`` pinned to it.
+""")
+
+
+add_newdoc('fast_numpy_loops', "thread_info",
+"""
+Return a numpy record array with a row of counters for each worker thread,
+counted since the thread started:
+
+- ``core``: index of the worker thread
+- ``node``: kernel numa node number of its group
+- ``cpu``: the cpu it is pinned to by `thread_setaffinity`, -1 if not pinned
+- ``blocks``: blocks of work it completed
+- ``jobs``: ufunc calls it completed at least one block of
+- ``idle_ns``: nanoseconds spent spinning or sleeping waiting for work
+- ``wake_ns``: nanoseconds from waking up to starting on work, summed
+- ``wakes``: times it woke up and found work (``wake_ns / wakes`` is the mean)
+- ``spin_wakes``: times work showed up while it was spinning
+- ``sleep_waits``: times it went to sleep in the kernel
+- ``wake_group``: its group in `thread_setwakemode` ``'tree'``
+- ``leader``: 1 if it wakes the rest of its group
+
+A worker with few ``blocks`` next to the others is a straggler, many
+``sleep_waits`` with few ``jobs`` means more threads are woken than needed.
+""")
+
+
+add_newdoc('fast_numpy_loops', "thread_wakebench",
+"""
+thread_wakebench(jobs, wake=0, blocks=64, block_us=0, gap_us=100)
+
+Time ``jobs`` jobs of ``blocks`` blocks that do nothing but spin for
+``block_us`` microseconds each, to measure the wake path of the worker
+threads. ``wake`` is how many threads to wake, 0 for `thread_getworkers`.
+Before each job the calling thread waits ``gap_us`` so the workers go back to
+spinning or sleeping as they would between ufunc calls.
+
+Returns an int64 array with a row per job: nanoseconds to publish the job
+(including the futex wake), from submit to a worker thread starting the
+first block (-1 if none did), from submit to completion, and the number of
+worker threads that did a block. The row is all -1 (and 0) when threading is
+off. See ``benchmarks/wake_latency.py``.
+""")
+
+
+add_newdoc('fast_numpy_loops', "thread_setaffinity",
+"""
+Pin the calling (main) thread and the worker threads to cpus. Returns the
+previous policy name. The policy is one of
+
+- ``'none'``: threads are not pinned (workers stay on their numa node), the
+  calling thread gets back the cpus it had before it was pinned
+- ``'compact'``: fill every hyperthread of a core before the next core
+- ``'scatter'``: spread over packages and physical cores, hyperthreads last
+- ``'physical'``: one thread per physical core
+
+or a sequence of cpu numbers, the first for the calling thread and then one for
+each worker. If there are more threads than cpus the cpus are reused. Worker
+threads started later (`thread_setpoolsize` or after a fork) are pinned by the
+same policy, but only a direct call pins the calling thread. Only supported on
+Linux; raises ValueError when the policy cannot be applied.
+""")
+
+
+add_newdoc('fast_numpy_loops', "thread_getaffinity",
+"""
+Return a tuple of the affinity policy name and a list of the cpu each thread
+is pinned to, main thread first, -1 when not pinned.
+""")
+
+
 add_newdoc('fast_numpy_loops', "timer_gettsc",
 "Get the time stamp counter")
 
@@ -82,6 +473,30 @@ add_newdoc('fast_numpy_loops', "cpustring",
 "Cpu brand string plus features")
 
 
+add_newdoc('fast_numpy_loops', "topology",
+"""
+Return a dict describing the cpus the default worker pool size comes from:
+
+- ``cpus``: cpus in the affinity mask of the process
+- ``cgroup``: cgroup version (1 or 2) the limits were read from, 0 if none
+- ``quota_cpus``: cpu quota of the cgroup (``cpu.max`` or
+  ``cpu.cfs_quota_us``) in cpus, the tightest of the cgroup and its parents,
+  None if no quota
+- ``cpuset_cpus``: cpus in the cgroup cpuset, 0 if not known. The kernel
+  keeps the affinity mask, and so ``cpus``, inside it
+- ``usable_cpus``: ``cpus`` capped by the quota rounded up, the default for
+  `thread_setpoolsize`
+- ``numa_nodes``: numa nodes with cpus we may run on
+- ``l2_cache``: bytes of L2 cache per core
+- ``cpu_table``: record array with a row per cpu: ``cpu``, ``package``,
+  ``core``, ``smt`` (hyperthread index in its core), ``node`` and ``cache``
+  (lowest cpu sharing its L3, -1 if not known)
+
+In a container with a 4 cpu quota on a 64 cpu host, ``usable_cpus`` is 4 and
+only 4 worker threads are started.
+""")
+
+
 add_newdoc('fast_numpy_loops', "oldinit",
 "old, deprecated")        
 
@@ -0,0 +1,412 @@
+import numpy as np
+import fast_numpy_loops
+fast_numpy_loops.initialize()
+
+# Elements in each block handed out to the worker threads
+BLOCK_SIZE = 0x4000
+
+
+class Schedule():
+    """
+    Per block overhead of handing out blocks to the worker threads. The add on
+    int8 is so cheap that the time is dominated by the scheduling.
+    Note: thread_setworkers caps the number of threads woken up.
+    """
+    params = [['ring', 'steal', 'static'], [4, 16, 48]]
+    param_names = ['schedule', 'nthreads']
+    timeout = 10
+
+    def setup(self, schedule, nthreads):
+        fast_numpy_loops.thread_enable()
+        self.old_schedule = fast_numpy_loops.thread_setschedule(schedule)
+        self.old_workers = fast_numpy_loops.thread_setworkers(nthreads)
+        self.nblocks = 4096
+        self.a = np.ones(self.nblocks * BLOCK_SIZE, dtype=np.int8)
+        self.out = np.empty_like(self.a)
+        # fault memory
+        self.out.fill(0)
+
+    def teardown(self, schedule, nthreads):
+        fast_numpy_loops.thread_setschedule(self.old_schedule)
+        fast_numpy_loops.thread_setworkers(self.old_workers)
+
+    def time_add_int8(self, schedule, nthreads):
+        np.add(self.a, self.a, out=self.out)
+
+    def track_ns_per_block(self, schedule, nthreads):
+        loops = 20
+        start = fast_numpy_loops.timer_getutc()
+        for _ in range(loops):
+            np.add(self.a, self.a, out=self.out)
+        delta = fast_numpy_loops.timer_getutc() - start
+        return delta / (loops * self.nblocks)
+
+    track_ns_per_block.unit = 'ns'
+
+
+class Affinity():
+    """
+    Throughput of a memory bound (add) and a compute bound (sqrt) ufunc for
+    each way of pinning the threads to cpus. Raises NotImplementedError (which
+    skips the benchmark) where the policy is not supported.
+    """
+    params = [['none', 'compact', 'scatter', 'physical'], ['add', 'sqrt']]
+    param_names = ['affinity', 'ufunc']
+    timeout = 10
+
+    def setup(self, affinity, ufunc):
+        fast_numpy_loops.thread_enable()
+        try:
+            self.old_affinity = fast_numpy_loops.thread_setaffinity(affinity)
+        except ValueError:
+            raise NotImplementedError(affinity)
+        self.a = np.linspace(1.0, 2.0, 10_000_000)
+        self.out = np.empty_like(self.a)
+        self.out.fill(0)
+
+    def teardown(self, affinity, ufunc):
+        fast_numpy_loops.thread_setaffinity(self.old_affinity)
+
+    def time_ufunc(self, affinity, ufunc):
+        if ufunc == 'add':
+            np.add(self.a, self.a, out=self.out)
+        else:
+            np.sqrt(self.a, out=self.out)
+
+
+class Spin():
+    """
+    Per call threading overhead of back to back medium sized ufuncs, with the
+    workers sleeping right away or spinning before they sleep.
+    """
+    params = [[0, 20, 100]]
+    param_names = ['spin_us']
+    timeout = 10
+
+    def setup(self, spin_us):
+        fast_numpy_loops.thread_enable()
+        self.old_spin = fast_numpy_loops.thread_setspin(spin_us)
+        self.a = np.ones(100_000)
+        self.out = np.empty_like(self.a)
+
+    def teardown(self, spin_us):
+        fast_numpy_loops.thread_setspin(self.old_spin)
+
+    def time_add_100k(self, spin_us):
+        for _ in range(100):
+            np.add(self.a, self.a, out=self.out)
+
+
+class BlockSize():
+    """
+    Sweep the elements per block for each op category: memory bound (add),
+    light (sqrt) and heavy (sin). 0 is the block size picked by the cost model.
+    """
+    params = [['add', 'sqrt', 'sin'], [0, 0x400, 0x1000, 0x4000, 0x10000, 0x40000]]
+    param_names = ['ufunc', 'blocksize']
+    timeout = 20
+
+    def setup(self, ufunc, blocksize):
+        fast_numpy_loops.thread_enable()
+        self.old_blocksize = fast_numpy_loops.thread_setblocksize(blocksize)
+        self.a = np.linspace(1.0, 2.0, 4_000_000)
+        self.out = np.empty_like(self.a)
+        self.out.fill(0)
+
+    def teardown(self, ufunc, blocksize):
+        fast_numpy_loops.thread_setblocksize(self.old_blocksize)
+
+    def time_ufunc(self, ufunc, blocksize):
+        if ufunc == 'add':
+            np.add(self.a, self.a, out=self.out)
+        elif ufunc == 'sqrt':
+            np.sqrt(self.a, out=self.out)
+        else:
+            np.sin(self.a, out=self.out)
+
+
+class Concurrent():
+    """
+    Several python threads each running large ufuncs at the same time, as in
+    a service handling requests on a thread pool. The time is for every
+    thread to finish 10 adds and 10 exps on its own arrays.
+    """
+    params = [[1, 2, 4, 8]]
+    param_names = ['producers']
+    timeout = 30
+
+    def setup(self, producers):
+        fast_numpy_loops.thread_enable()
+        self.arrays = [np.linspace(1.0, 2.0, 2_000_000) for _ in range(producers)]
+        self.outs = [np.empty_like(a) for a in self.arrays]
+        for out in self.outs:
+            out.fill(0)
+
+    def _work(self, i):
+        for _ in range(10):
+            np.add(self.arrays[i], self.arrays[i], out=self.outs[i])
+            np.exp(self.arrays[i], out=self.outs[i])
+
+    def time_producers(self, producers):
+        import threading
+        threads = [threading.Thread(target=self._work, args=(i,)) for i in range(producers)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+
+
+class Submit():
+    """
+    A large multiply overlapped with python side work through submit, against
+    the same multiply called directly followed by the python work.
+    """
+    params = [['sync', 'submit']]
+    param_names = ['mode']
+    timeout = 20
+
+    def setup(self, mode):
+        fast_numpy_loops.thread_enable()
+        self.a = np.linspace(1.0, 2.0, 4_000_000)
+        self.b = np.linspace(2.0, 3.0, 4_000_000)
+        self.out = np.empty_like(self.a)
+        self.out.fill(0)
+
+    def _bookkeeping(self):
+        return sum(range(20_000))
+
+    def time_multiply(self, mode):
+        if mode == 'sync':
+            np.multiply(self.a, self.b, out=self.out)
+            self._bookkeeping()
+        else:
+            future = fast_numpy_loops.submit(np.multiply, self.a, self.b, out=self.out)
+            self._bookkeeping()
+            future.wait()
+
+
+class WakeLatency():
+    """
+    Submit to first worker block and submit to completion of a job of empty
+    blocks, for each number of threads woken, with a flat futex broadcast,
+    with group leaders waking their group and with a futex word per worker.
+    benchmarks/wake_latency.py gives the full distribution over pool sizes.
+    """
+    params = [['flat', 'tree', 'targeted'], [1, 4, 11, 31]]
+    param_names = ['wakemode', 'wake']
+    timeout = 20
+
+    def setup(self, wakemode, wake):
+        fast_numpy_loops.thread_enable()
+        self.old_mode = fast_numpy_loops.thread_setwakemode(wakemode)
+        self.old_workers = fast_numpy_loops.thread_setworkers(wake)
+
+    def teardown(self, wakemode, wake):
+        fast_numpy_loops.thread_setworkers(self.old_workers)
+        fast_numpy_loops.thread_setwakemode(self.old_mode)
+
+    def track_first_block_ns(self, wakemode, wake):
+        rows = fast_numpy_loops.thread_wakebench(500, wake)
+        first = rows[:, 1]
+        return float(np.median(first[first >= 0])) if (first >= 0).any() else 0.0
+
+    track_first_block_ns.unit = 'ns'
+
+    def track_done_ns(self, wakemode, wake):
+        rows = fast_numpy_loops.thread_wakebench(500, wake)
+        return float(np.median(rows[:, 2]))
+
+    track_done_ns.unit = 'ns'
+
+
+class LatencyLane():
+    """
+    Tail latency of small compares from one thread while another thread runs
+    large logs, with and without the latency lane (thread_setlatencybytes 0).
+    """
+    params = [[0, 1 << 20]]
+    param_names = ['latency_bytes']
+    timeout = 60
+
+    def setup(self, latency_bytes):
+        import threading
+        fast_numpy_loops.thread_enable()
+        self.old_bytes = fast_numpy_loops.thread_setlatencybytes(latency_bytes)
+        self.small = np.arange(50_000.0)
+        self.big = np.linspace(1.0, 2.0, 8_000_000)
+        self.stop = False
+
+        def bulk():
+            out = np.empty_like(self.big)
+            while not self.stop:
+                np.log(self.big, out=out)
+
+        self.thread = threading.Thread(target=bulk)
+        self.thread.start()
+
+    def teardown(self, latency_bytes):
+        self.stop = True
+        self.thread.join()
+        fast_numpy_loops.thread_setlatencybytes(self.old_bytes)
+
+    def _latencies(self):
+        times = []
+        for _ in range(500):
+            start = fast_numpy_loops.timer_getutc()
+            np.less(self.small, 25_000.0)
+            times.append(fast_numpy_loops.timer_getutc() - start)
+        return np.array(times) / 1000.0
+
+    def track_p50_us(self, latency_bytes):
+        return float(np.percentile(self._latencies(), 50))
+
+    track_p50_us.unit = 'us'
+
+    def track_p99_us(self, latency_bytes):
+        return float(np.percentile(self._latencies(), 99))
+
+    track_p99_us.unit = 'us'
+
+
+class BlasMix():
+    """
+    Matrix products on one thread while another runs large exps, with the
+    concurrency budget off and with the BLAS thread reserving half the cores
+    (benchmarks/blas_mix.py has the throughput version). The time is for
+    both threads to finish their work.
+    """
+    params = [['off', 'on']]
+    param_names = ['budget']
+    timeout = 60
+
+    def setup(self, budget):
+        fast_numpy_loops.thread_enable()
+        usable = fast_numpy_loops.topology()['usable_cpus']
+        self.blas_threads = max(usable // 2, 1)
+        self.old_budget = fast_numpy_loops.thread_setbudget(max(usable - 1, 1) if budget == 'on' else 0)
+        self.m = np.random.default_rng(0).random((600, 600))
+        self.x = np.linspace(1.0, 2.0, 4_000_000)
+        self.out = np.empty_like(self.x)
+        self.out.fill(0)
+
+    def teardown(self, budget):
+        fast_numpy_loops.thread_setbudget(self.old_budget)
+
+    def _blas(self):
+        for _ in range(10):
+            with fast_numpy_loops.reserve_cores(self.blas_threads):
+                np.dot(self.m, self.m)
+
+    def _ufunc(self):
+        for _ in range(20):
+            np.exp(self.x, out=self.out)
+
+    def time_mixed(self, budget):
+        import threading
+        threads = [threading.Thread(target=self._blas), threading.Thread(target=self._ufunc)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+
+
+class IntReduce():
+    """
+    Sum, product, min and max of a large integer column (timestamps and ids)
+    for each width and signedness.
+    """
+    params = [['add', 'multiply', 'minimum', 'maximum'], ['int8', 'uint16', 'int32', 'int64', 'uint64']]
+    param_names = ['ufunc', 'dtype']
+    timeout = 20
+
+    def setup(self, ufunc, dtype):
+        fast_numpy_loops.thread_enable()
+        self.ufunc = getattr(np, ufunc)
+        self.a = np.arange(10_000_000).astype(dtype)
+
+    def time_reduce(self, ufunc, dtype):
+        # dtype= so small ints are not upcast to int_
+        self.ufunc.reduce(self.a, dtype=self.a.dtype)
+
+
+class SumMode():
+    """
+    Float sums with numpy's loop and each atop_setsummode, and their error
+    relative to math.fsum in units of machine epsilon
+    (benchmarks/sum_accuracy.py sweeps lengths and data sets).
+    """
+    params = [['numpy', 'fast', 'pairwise'], ['float32', 'float64']]
+    param_names = ['mode', 'dtype']
+    timeout = 20
+
+    def setup(self, mode, dtype):
+        fast_numpy_loops.thread_enable()
+        self.old_mode = fast_numpy_loops.atop_getsummode()
+        if mode == 'numpy':
+            fast_numpy_loops.atop_disable()
+        else:
+            fast_numpy_loops.atop_setsummode(mode)
+        self.a = np.random.default_rng(0).random(10_000_000).astype(dtype)
+
+    def teardown(self, mode, dtype):
+        fast_numpy_loops.atop_enable()
+        fast_numpy_loops.atop_setsummode(self.old_mode)
+
+    def time_sum(self, mode, dtype):
+        np.add.reduce(self.a)
+
+    def track_error_ulps(self, mode, dtype):
+        import math
+        exact = math.fsum(self.a.astype(np.float64))
+        return abs(float(np.add.reduce(self.a)) - exact) / exact / float(np.finfo(self.a.dtype).eps)
+
+    track_error_ulps.unit = 'ulps'
+
+
+class ReduceRows():
+    """
+    Sum, min and max of each row of a tall matrix, with numpy calling the
+    reduce loop once per row and with fast_numpy_loops.reduce splitting the
+    rows over the worker threads.
+    """
+    params = [['numpy', 'reduce'], ['add', 'minimum', 'maximum'], ['float64', 'int32']]
+    param_names = ['mode', 'ufunc', 'dtype']
+    timeout = 20
+
+    def setup(self, mode, ufunc, dtype):
+        fast_numpy_loops.thread_enable()
+        self.ufunc = getattr(np, ufunc)
+        self.a = np.random.default_rng(0).random((1_000_000, 32)).astype(dtype)
+        self.out = np.empty(self.a.shape[0], dtype=dtype)
+        self.out.fill(0)
+
+    def time_rows(self, mode, ufunc, dtype):
+        if mode == 'numpy':
+            self.ufunc.reduce(self.a, axis=-1, dtype=self.a.dtype, out=self.out)
+        else:
+            fast_numpy_loops.reduce(self.ufunc, self.a, dtype=self.a.dtype, out=self.out)
+
+
+class ReduceCols():
+    """
+    Sum and min of each column of a C ordered matrix, with numpy adding one
+    row at a time into the output and with fast_numpy_loops.reduce splitting
+    the columns or row panels over the worker threads.
+    """
+    params = [['numpy', 'reduce'], ['add', 'minimum'], ['10000000x8', '100000x1000']]
+    param_names = ['mode', 'ufunc', 'shape']
+    timeout = 30
+
+    def setup(self, mode, ufunc, shape):
+        fast_numpy_loops.thread_enable()
+        self.ufunc = getattr(np, ufunc)
+        rows, cols = (int(x) for x in shape.split('x'))
+        self.a = np.random.default_rng(0).random((rows, cols))
+        self.out = np.empty(cols)
+        self.out.fill(0)
+
+    def time_cols(self, mode, ufunc, shape):
+        if mode == 'numpy':
+            self.ufunc.reduce(self.a, axis=0, out=self.out)
+        else:
+            fast_numpy_loops.reduce(self.ufunc, self.a, axis=0, out=self.out)
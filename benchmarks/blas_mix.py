@@ -0,0 +1,118 @@
+"""
+Throughput of BLAS (``np.dot``) and threaded ufuncs running at the same time
+in one process, with and without the concurrency budget. Without the budget
+both thread pools use every core and the process runs twice as many threads as
+cores; with it the ufuncs wake only the worker threads left over by the cores
+the BLAS thread reserved.
+
+One python thread runs matrix products inside ``reserve_cores``, another runs
+``np.exp`` on a large array, both for ``--seconds``. The BLAS pool is limited to
+the reserved cores when ``threadpoolctl`` is installed.
+
+Run it directly, not through asv::
+
+    python benchmarks/blas_mix.py --blas-threads 4 --budget 7 --format csv
+"""
+import argparse
+import csv
+import json
+import sys
+import threading
+import time
+
+import numpy as np
+import fast_numpy_loops
+
+try:
+    import threadpoolctl
+except ImportError:
+    threadpoolctl = None
+
+
+def _blas_limits(threads):
+    if threadpoolctl is None:
+        return None
+    return threadpoolctl.threadpool_limits(max(threads, 1), user_api='blas')
+
+
+def measure(budget, blas_threads, seconds, matrix, elements):
+    """Returns a dict with the matrix products and ufuncs per second"""
+    fast_numpy_loops.thread_setbudget(budget)
+    a = np.random.default_rng(0).random((matrix, matrix))
+    x = np.linspace(1.0, 2.0, elements)
+    out = np.empty_like(x)
+    out.fill(0)
+    counts = {'dot': 0, 'exp': 0}
+    stop = threading.Event()
+
+    def blas():
+        while not stop.is_set():
+            with fast_numpy_loops.reserve_cores(blas_threads) as granted:
+                limits = _blas_limits(granted if budget else blas_threads)
+                np.dot(a, a)
+                if limits is not None:
+                    limits.restore_original_limits()
+            counts['dot'] += 1
+
+    def ufunc():
+        while not stop.is_set():
+            np.exp(x, out=out)
+            counts['exp'] += 1
+
+    threads = [threading.Thread(target=blas), threading.Thread(target=ufunc)]
+    start = time.perf_counter()
+    for t in threads:
+        t.start()
+    time.sleep(seconds)
+    stop.set()
+    for t in threads:
+        t.join()
+    elapsed = time.perf_counter() - start
+
+    stats = fast_numpy_loops.thread_budgetstats()
+    return {'budget': budget, 'blas_threads': blas_threads, 'matrix': matrix, 'elements': elements,
+            'dot_per_s': counts['dot'] / elapsed, 'exp_per_s': counts['exp'] / elapsed,
+            'denied': stats['denied'], 'threadpoolctl': threadpoolctl is not None}
+
+
+def main(argv=None):
+    fast_numpy_loops.initialize()
+    fast_numpy_loops.thread_enable()
+    usable = fast_numpy_loops.topology()['usable_cpus']
+
+    parser = argparse.ArgumentParser(description=__doc__.split('\n\n')[0])
+    parser.add_argument('--blas-threads', type=int, default=max(usable // 2, 1),
+                        help='cores the BLAS thread reserves for each product')
+    parser.add_argument('--budget', type=int, default=max(usable - 1, 1),
+                        help='thread_setbudget for the run with the budget, the calling threads need none')
+    parser.add_argument('--seconds', type=float, default=5.0)
+    parser.add_argument('--matrix', type=int, default=1000, help='rows of the square matrices')
+    parser.add_argument('--elements', type=int, default=4_000_000, help='length of the ufunc array')
+    parser.add_argument('--format', choices=['csv', 'json'], default='csv')
+    parser.add_argument('--output', default='-', help='file name, - for stdout')
+    args = parser.parse_args(argv)
+
+    old_budget = fast_numpy_loops.thread_getbudget()
+    results = []
+    try:
+        for budget in (0, args.budget):
+            results.append(measure(budget, args.blas_threads, args.seconds, args.matrix, args.elements))
+    finally:
+        fast_numpy_loops.thread_setbudget(old_budget)
+
+    out = sys.stdout if args.output == '-' else open(args.output, 'w', newline='')
+    try:
+        if args.format == 'json':
+            json.dump(results, out, indent=1)
+            out.write('\n')
+        else:
+            writer = csv.DictWriter(out, fieldnames=list(results[0].keys()))
+            writer.writeheader()
+            writer.writerows(results)
+    finally:
+        if out is not sys.stdout:
+            out.close()
+
+
+if __name__ == '__main__':
+    main()
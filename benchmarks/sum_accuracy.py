@@ -0,0 +1,130 @@
+"""
+Accuracy against speed of float sums for each ``atop_setsummode`` and for
+numpy's own loop. For every dtype, length and data set it reports
+
+- ``gbs``: input GB/s of ``np.add.reduce`` (best of ``--repeat``)
+- ``rel_error``: ``|sum - exact| / sum(|x|)``, where exact is ``math.fsum``
+  of the values. Dividing by ``sum(|x|)`` instead of ``|exact|`` keeps data
+  that cancels out from looking worse than it is
+- ``ulps``: the same error in units of the dtype's machine epsilon
+
+Run it directly, not through asv::
+
+    python benchmarks/sum_accuracy.py --dtype float32 --length 1000,1000000,100000000 --format csv
+
+``--deterministic 0,1`` also runs every sum with ``thread_setdeterministic``
+on, to see what fixed blocks cost::
+
+    python benchmarks/sum_accuracy.py --mode pairwise --deterministic 0,1
+"""
+import argparse
+import csv
+import json
+import math
+import sys
+import time
+
+import numpy as np
+import fast_numpy_loops
+
+MODES = ['numpy', 'fast', 'pairwise']
+
+
+def _ints(text):
+    return [int(x) for x in text.split(',') if x]
+
+
+def _names(text):
+    return [x for x in text.split(',') if x]
+
+
+def make_data(kind, n, dtype, rng):
+    if kind == 'uniform':
+        return rng.random(n).astype(dtype)
+    if kind == 'normal':
+        return rng.standard_normal(n).astype(dtype)
+    # a few large values on top of many small ones
+    a = rng.random(n).astype(dtype)
+    a[::1000] *= 1e4
+    return a
+
+
+def measure(mode, a, repeat):
+    """Returns (seconds, sum) of the fastest of repeat sums"""
+    if mode == 'numpy':
+        fast_numpy_loops.atop_disable()
+    else:
+        fast_numpy_loops.atop_enable()
+        fast_numpy_loops.atop_setsummode(mode)
+    best = None
+    for _ in range(repeat):
+        start = time.perf_counter()
+        result = np.add.reduce(a)
+        delta = time.perf_counter() - start
+        best = delta if best is None else min(best, delta)
+    return best, result
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description=__doc__.split('\n\n')[0])
+    parser.add_argument('--dtype', type=_names, default=['float32', 'float64'])
+    parser.add_argument('--length', type=_ints, default=[1000, 100_000, 10_000_000])
+    parser.add_argument('--data', type=_names, default=['uniform', 'normal', 'spiky'],
+                        help='comma separated data sets: uniform, normal, spiky')
+    parser.add_argument('--mode', type=_names, default=MODES, help='comma separated ' + ', '.join(MODES))
+    parser.add_argument('--deterministic', type=_ints, default=[0],
+                        help='comma separated thread_setdeterministic values, 0 and/or 1')
+    parser.add_argument('--repeat', type=int, default=10)
+    parser.add_argument('--seed', type=int, default=0)
+    parser.add_argument('--format', choices=['csv', 'json'], default='csv')
+    parser.add_argument('--output', default='-', help='file name, - for stdout')
+    args = parser.parse_args(argv)
+
+    fast_numpy_loops.initialize()
+    fast_numpy_loops.thread_enable()
+    old_enabled = fast_numpy_loops.atop_isenabled()
+    old_mode = fast_numpy_loops.atop_getsummode()
+    old_deterministic = fast_numpy_loops.thread_getdeterministic()
+    rng = np.random.default_rng(args.seed)
+    results = []
+    try:
+        for dtype in args.dtype:
+            eps = float(np.finfo(dtype).eps)
+            for n in args.length:
+                for kind in args.data:
+                    a = make_data(kind, n, dtype, rng)
+                    exact = math.fsum(a.astype(np.float64))
+                    scale = math.fsum(np.abs(a.astype(np.float64))) or 1.0
+                    for mode in args.mode:
+                        for deterministic in args.deterministic:
+                            fast_numpy_loops.thread_setdeterministic(bool(deterministic))
+                            seconds, result = measure(mode, a, args.repeat)
+                            error = abs(float(result) - exact) / scale
+                            results.append({'dtype': dtype, 'length': n, 'data': kind, 'mode': mode,
+                                            'deterministic': deterministic,
+                                            'gbs': a.nbytes / seconds / 1e9, 'rel_error': error,
+                                            'ulps': error / eps})
+    finally:
+        fast_numpy_loops.thread_setdeterministic(old_deterministic)
+        fast_numpy_loops.atop_setsummode(old_mode)
+        if old_enabled:
+            fast_numpy_loops.atop_enable()
+        else:
+            fast_numpy_loops.atop_disable()
+
+    out = sys.stdout if args.output == '-' else open(args.output, 'w', newline='')
+    try:
+        if args.format == 'json':
+            json.dump(results, out, indent=1)
+            out.write('\n')
+        else:
+            writer = csv.DictWriter(out, fieldnames=list(results[0].keys()))
+            writer.writeheader()
+            writer.writerows(results)
+    finally:
+        if out is not sys.stdout:
+            out.close()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,115 @@
+"""
+Wake latency of the worker threads, to tune the futex wake counts per server
+class. For every wake mode, pool size and wake count it runs jobs of empty blocks with
+``thread_wakebench`` and reports the distribution of
+
+- ``publish``: time to publish the job and wake the workers (fan-out cost)
+- ``first``: submit to the first block started by a worker thread
+- ``done``: submit to completion
+
+Run it directly, not through asv::
+
+    python benchmarks/wake_latency.py --threads 4,8,16 --wake 1,4,11,31 --format csv
+
+Compare the flat futex broadcast against waking group leaders on a large
+machine with::
+
+    python benchmarks/wake_latency.py --threads 64,128 --wake 16,64,127 --wakemode flat,tree
+"""
+import argparse
+import csv
+import json
+import sys
+
+import numpy as np
+import fast_numpy_loops
+
+PERCENTILES = [50, 90, 99, 99.9]
+
+
+def _ints(text):
+    return [int(x) for x in text.split(',') if x]
+
+
+def _names(text):
+    return [x for x in text.split(',') if x]
+
+
+def measure(mode, threads, wake, jobs, blocks, block_us, gap_us):
+    """Returns a dict of latency percentiles in ns for one pool size and wake count"""
+    fast_numpy_loops.thread_setpoolsize(threads)
+    # warm up: threads started and pages touched
+    fast_numpy_loops.thread_wakebench(min(jobs, 100), wake, blocks, block_us, gap_us)
+    rows = fast_numpy_loops.thread_wakebench(jobs, wake, blocks, block_us, gap_us)
+    rows = rows[rows[:, 2] >= 0]
+
+    result = {'wakemode': mode, 'threads': threads, 'wake': wake, 'jobs': len(rows), 'blocks': blocks,
+              'block_us': block_us, 'gap_us': gap_us}
+    first = rows[:, 1]
+    columns = {'publish': rows[:, 0], 'first': first[first >= 0], 'done': rows[:, 2]}
+    for name, values in columns.items():
+        for p in PERCENTILES:
+            result['%s_p%g_ns' % (name, p)] = int(np.percentile(values, p)) if len(values) else -1
+    result['no_worker_jobs'] = int((first < 0).sum())
+    result['mean_workers'] = float(rows[:, 3].mean()) if len(rows) else 0.0
+    return result
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description=__doc__.split('\n\n')[0])
+    parser.add_argument('--threads', type=_ints, default=None,
+                        help='comma separated worker pool sizes, default the current pool size')
+    parser.add_argument('--wake', type=_ints, default=[1, 2, 4, 8, 11, 16, 31],
+                        help='comma separated wake counts')
+    parser.add_argument('--wakemode', type=_names, default=None,
+                        help='comma separated thread_setwakemode names, default the current mode')
+    parser.add_argument('--jobs', type=int, default=2000)
+    parser.add_argument('--blocks', type=int, default=64, help='blocks per job')
+    parser.add_argument('--block-us', type=float, default=0.0, help='time spent in each block')
+    parser.add_argument('--gap-us', type=float, default=100.0,
+                        help='time between jobs so workers go back to sleep')
+    parser.add_argument('--spin-us', type=float, default=None, help='thread_setspin while measuring')
+    parser.add_argument('--format', choices=['csv', 'json'], default='csv')
+    parser.add_argument('--output', default='-', help='file name, - for stdout')
+    args = parser.parse_args(argv)
+
+    fast_numpy_loops.initialize()
+    fast_numpy_loops.thread_enable()
+    old_pool = fast_numpy_loops.thread_getpoolsize()
+    old_workers = fast_numpy_loops.thread_getworkers()
+    old_spin = fast_numpy_loops.thread_getspin()
+    old_mode = fast_numpy_loops.thread_getwakemode()
+    results = []
+    try:
+        if args.spin_us is not None:
+            fast_numpy_loops.thread_setspin(args.spin_us)
+        for mode in args.wakemode or [old_mode]:
+            fast_numpy_loops.thread_setwakemode(mode)
+            for threads in args.threads or [old_pool]:
+                for wake in args.wake:
+                    # wake counts above thread_getworkers are capped
+                    fast_numpy_loops.thread_setworkers(max(wake, 1))
+                    results.append(measure(mode, threads, wake, args.jobs, args.blocks,
+                                           args.block_us, args.gap_us))
+    finally:
+        fast_numpy_loops.thread_setwakemode(old_mode)
+        fast_numpy_loops.thread_setpoolsize(old_pool)
+        fast_numpy_loops.thread_setworkers(old_workers)
+        fast_numpy_loops.thread_setspin(*old_spin)
+
+    out = sys.stdout if args.output == '-' else open(args.output, 'w', newline='')
+    try:
+        if args.format == 'json':
+            json.dump(results, out, indent=1)
+            out.write('\n')
+        else:
+            writer = csv.DictWriter(out, fieldnames=list(results[0].keys()))
+            writer.writeheader()
+            writer.writerows(results)
+    finally:
+        if out is not sys.stdout:
+            out.close()
+
+
+if __name__ == '__main__':
+    main()
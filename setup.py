@@ -109,6 +109,8 @@ setup(
                      'src/fast_numpy_loops/recycler.cpp',
                      'src/atop/atop.cpp',
                      'src/atop/threads.cpp',
+                     'src/atop/topology.cpp',
+                     'src/atop/budget.cpp',
                      'src/atop/ops_binary.cpp',
                      'src/atop/ops_compare.cpp',
                      'src/atop/ops_unary.cpp',
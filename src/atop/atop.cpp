@@ -96,7 +96,11 @@ BOOL atop_init() {
     g_cMathWorker = new CMathWorker();
 
     // start up the worker threads now in case we use them
-    THREADER->StartWorkerThreads(0);
+    // one group of worker threads per numa node
+    THREADER->StartWorkerThreads(-1);
+
+    // a child process after fork starts its own worker threads on first use
+    RegisterForkHandlers();
 
     LOGGING("ATOP loaded\n");
     return TRUE;
@@ -0,0 +1,62 @@
+#include "budget.h"
+
+stConcurrencyBudget g_Budget = { 0, 0, 0, 0 };
+
+stBudgetApi g_BudgetApi = { BUDGET_API_VERSION, BudgetReserve, BudgetUnreserve, BudgetAvailable };
+
+//-----------------------------------------------------------
+int32_t BudgetAcquire(int32_t count) {
+    if (count <= 0) return 0;
+
+    while (TRUE) {
+        int64_t total = g_Budget.Total;
+        int64_t inUse = g_Budget.InUse;
+        int64_t granted = count;
+
+        if (total > 0) {
+            int64_t available = total - inUse;
+            if (available < 0) available = 0;
+            if (granted > available) granted = available;
+        }
+
+        // InUse is still counted with no budget so a budget set later starts right
+        if (InterlockedCompareExchange64(&g_Budget.InUse, inUse + granted, inUse) == inUse) {
+            if (granted < count) InterlockedAdd64(&g_Budget.Denied, count - granted);
+            return (int32_t)granted;
+        }
+    }
+}
+
+//-----------------------------------------------------------
+void BudgetRelease(int32_t count) {
+    if (count > 0) InterlockedAdd64(&g_Budget.InUse, -(int64_t)count);
+}
+
+//-----------------------------------------------------------
+int32_t BudgetReserve(int32_t count) {
+    int32_t granted = BudgetAcquire(count);
+    if (granted > 0) InterlockedAdd64(&g_Budget.Reserved, granted);
+    return granted;
+}
+
+//-----------------------------------------------------------
+void BudgetUnreserve(int32_t count) {
+    if (count <= 0) return;
+    InterlockedAdd64(&g_Budget.Reserved, -(int64_t)count);
+    BudgetRelease(count);
+}
+
+//-----------------------------------------------------------
+int64_t BudgetAvailable() {
+    int64_t total = g_Budget.Total;
+    if (total <= 0) return INT32_MAX;
+    int64_t available = total - g_Budget.InUse;
+    return available > 0 ? available : 0;
+}
+
+//-----------------------------------------------------------
+int64_t BudgetSetTotal(int64_t total) {
+    int64_t previousVal = g_Budget.Total;
+    g_Budget.Total = total > 0 ? total : 0;
+    return previousVal;
+}
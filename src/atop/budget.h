@@ -0,0 +1,58 @@
+#pragma once
+
+#include "common_inc.h"
+
+//-----------------------------------------------------
+// Process wide budget of cores shared by every thread pool in the process
+// (our worker threads, OpenBLAS, OpenMP, ...)
+// A pool takes a token for each thread it runs besides the calling thread
+// and gives it back when the threads go idle
+// With a Total of 0 there is no budget and every request is granted
+struct stConcurrencyBudget {
+    volatile int64_t    Total;
+
+    // Tokens held by running jobs and by other pools
+    volatile int64_t    InUse;
+
+    // The part of InUse held by other pools through BudgetReserve
+    volatile int64_t    Reserved;
+
+    // Tokens asked for but not granted
+    volatile int64_t    Denied;
+};
+
+extern stConcurrencyBudget g_Budget;
+
+// Takes up to count tokens, returns how many were granted
+int32_t BudgetAcquire(int32_t count);
+
+// Gives back tokens from BudgetAcquire
+void BudgetRelease(int32_t count);
+
+// Same as BudgetAcquire and BudgetRelease for other pools, counted in Reserved
+int32_t BudgetReserve(int32_t count);
+void BudgetUnreserve(int32_t count);
+
+// Tokens free right now, INT32_MAX when there is no budget
+int64_t BudgetAvailable();
+
+// 0 for no budget, returns previous value
+int64_t BudgetSetTotal(int64_t total);
+
+//-----------------------------------------------------
+// For other extension modules, exported as the PyCapsule BUDGET_API_CAPSULE
+//   stBudgetApi* pApi = (stBudgetApi*)PyCapsule_Import(BUDGET_API_CAPSULE, 0);
+//   int32_t granted = pApi->Reserve(threads);
+//   ...
+//   pApi->Unreserve(granted);
+#define BUDGET_API_CAPSULE "fast_numpy_loops._fast_numpy_loops._budget_api"
+#define BUDGET_API_VERSION 1
+
+struct stBudgetApi {
+    int32_t     Version;
+    int32_t     (*Reserve)(int32_t count);
+    void        (*Unreserve)(int32_t count);
+    int64_t     (*Available)();
+};
+
+extern stBudgetApi g_BudgetApi;
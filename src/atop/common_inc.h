@@ -145,10 +145,12 @@ typedef unsigned char       BYTE;
 #endif
 #define InterlockedDecrement64 _InterlockedDecrement64
 #define InterlockedIncrement64 _InterlockedIncrement64
+#define InterlockedCompareExchange64 _InterlockedCompareExchange64
 
 #define InterlockedIncrement _InterlockedIncrement
 
 #define FMInterlockedOr(X,Y) _InterlockedOr64((int64_t*)X,Y)
+#define FMInterlockedAnd(X,Y) _InterlockedAnd64((int64_t*)X,Y)
 
 #include <intrin.h>
 #ifndef MEM_ALIGN
@@ -162,6 +164,7 @@ typedef unsigned char       BYTE;
 #define ALIGNED_FREE(block) _aligned_free(block)
 
 #define lzcnt_64 _lzcnt_u64
+#define tzcnt_64 _tzcnt_u64
 
 #endif
 #else
@@ -169,11 +172,15 @@ typedef unsigned char       BYTE;
 #define WINAPI
 #include <pthread.h>
 
-// consider sync_add_and_fetch
-#define InterlockedAdd64(val, len) (__sync_fetch_and_add(val, len) + len)
-#define InterlockedIncrement64(val) (__sync_fetch_and_add(val, 1) + 1)
-#define InterlockedIncrement(val) (__sync_fetch_and_add(val, 1) + 1)
+// return the new value like windows, a plain call so the result can be ignored without a warning
+#define InterlockedAdd64(val, len) (__sync_add_and_fetch(val, len))
+#define InterlockedIncrement64(val) (__sync_add_and_fetch(val, 1))
+#define InterlockedDecrement64(val) (__sync_sub_and_fetch(val, 1))
+#define InterlockedIncrement(val) (__sync_add_and_fetch(val, 1))
+// same argument order as windows: returns the initial value of *val
+#define InterlockedCompareExchange64(val, exchange, comparand) (__sync_val_compare_and_swap(val, comparand, exchange))
 #define FMInterlockedOr(val, bitpos) (__sync_fetch_and_or(val, bitpos))
+#define FMInterlockedAnd(val, bitpos) (__sync_fetch_and_and(val, bitpos))
 
 
 #ifndef __GNUC_PREREQ
@@ -211,6 +218,7 @@ FORCEINLINE void* aligned_alloc(size_t alignment, size_t size)
 #define ALIGNED_FREE(block) free(block)
 
 #define lzcnt_64 __builtin_clzll
+#define tzcnt_64 __builtin_ctzll
 
 #endif
 
@@ -109,6 +109,13 @@ static const inline __m256d MUL_OP_256f64(__m256d x, __m256d y) { return _mm256_
 static const inline __m256i MUL_OP_256i16(__m256i x, __m256i y) { return _mm256_mullo_epi16(x, y); }
 static const inline __m256i MUL_OP_256i32(__m256i x, __m256i y) { return _mm256_mullo_epi32(x, y); }
 
+// There is no 8bit multiply, multiply the even and odd bytes as 16bit and keep the low byte of each
+static const inline __m256i MUL_OP_256i8(__m256i x, __m256i y) {
+    __m256i even = _mm256_mullo_epi16(x, y);
+    __m256i odd = _mm256_mullo_epi16(_mm256_srli_epi16(x, 8), _mm256_srli_epi16(y, 8));
+    return _mm256_or_si256(_mm256_slli_epi16(odd, 8), _mm256_and_si256(even, _mm256_set1_epi16(0xFF)));
+}
+
 static const inline __m256  DIV_OP_256f32(__m256 x, __m256 y) { return _mm256_div_ps(x, y); }
 static const inline __m256d DIV_OP_256f64(__m256d x, __m256d y) { return _mm256_div_pd(x, y); }
 static const inline __m256d CONV_INT32_DOUBLE(__m128i* x) { return _mm256_cvtepi32_pd(*x); }
@@ -131,11 +138,19 @@ static const inline __m256i MAX_OP_256u32(__m256i x, __m256i y) { return _mm256_
 static const inline __m256  MAX_OP_256f32(__m256 x, __m256 y) { return _mm256_max_ps(x, y); }
 static const inline __m256d MAX_OP_256f64(__m256d x, __m256d y) { return _mm256_max_pd(x, y); }
 
+// There is no 64bit min/max, compare then blend (the unsigned compare flips the sign bit first)
+static const __m256i signbit64 = _mm256_set1_epi64x(INT64_MIN);
+static const inline __m256i CMPGT_256u64(__m256i x, __m256i y) { return _mm256_cmpgt_epi64(_mm256_xor_si256(x, signbit64), _mm256_xor_si256(y, signbit64)); }
+static const inline __m256i MIN_OP_256i64(__m256i x, __m256i y) { return _mm256_blendv_epi8(x, y, _mm256_cmpgt_epi64(x, y)); }
+static const inline __m256i MIN_OP_256u64(__m256i x, __m256i y) { return _mm256_blendv_epi8(x, y, CMPGT_256u64(x, y)); }
+static const inline __m256i MAX_OP_256i64(__m256i x, __m256i y) { return _mm256_blendv_epi8(y, x, _mm256_cmpgt_epi64(x, y)); }
+static const inline __m256i MAX_OP_256u64(__m256i x, __m256i y) { return _mm256_blendv_epi8(y, x, CMPGT_256u64(x, y)); }
+
 // mask off low 32bits
 static const __m256i masklo = _mm256_set1_epi64x(0xFFFFFFFFLL);
 static const __m128i shifthigh = _mm_set1_epi64x(32);
 
-// This routine only works for positive integers
+// The low 64 bits of the product are the same for signed and unsigned, so int64 uses it too
 static const inline __m256i MUL_OP_256u64(__m256i x, __m256i y) {
     // Algo is lo1*lo2 + (lo1*hi2) << 32 + (lo2*hi1) << 32
     // To get to 128 bit int would have to add (hi1*hi2) << 64
@@ -167,8 +182,8 @@ inline void ReduceMathOpFast(void* pDataIn1X, void* pDataOutX, void* pStartVal,
     if (strideIn != 0) {
         T* pEnd = (T*)((char*)pDataIn1X + (datalen * strideIn));
 
-        // TJD: testing indicates unrolling size of 2 is 3% faster
-        const int64_t NUM_LOOPS_UNROLLED = 2;
+        // 4 accumulators hide the latency of ops that take several instructions (64bit min/max and multiply)
+        const int64_t NUM_LOOPS_UNROLLED = 4;
         const int64_t chunkSize = NUM_LOOPS_UNROLLED * (sizeof(U256) / sizeof(T));
         int64_t perReg = sizeof(U256) / sizeof(T);
 
@@ -182,15 +197,27 @@ inline void ReduceMathOpFast(void* pDataIn1X, void* pDataOutX, void* pStartVal,
 
             U256 m0 = LOADU(pDataIn256);
             U256 m1 = LOADU(pDataIn256 + 1);
+            U256 m2 = LOADU(pDataIn256 + 2);
+            U256 m3 = LOADU(pDataIn256 + 3);
             pDataIn256 += NUM_LOOPS_UNROLLED;
 
             while (pDataIn256 < pEnd_256) {
+                // gcc and clang need LOADU, ops that read an operand twice get an aligned load otherwise
+#ifdef RT_COMPILER_MSVC
                 m0 = MATH_OP256(m0, pDataIn256[0]);
                 m1 = MATH_OP256(m1, pDataIn256[1]);
+                m2 = MATH_OP256(m2, pDataIn256[2]);
+                m3 = MATH_OP256(m3, pDataIn256[3]);
+#else
+                m0 = MATH_OP256(m0, LOADU(pDataIn256));
+                m1 = MATH_OP256(m1, LOADU(pDataIn256 + 1));
+                m2 = MATH_OP256(m2, LOADU(pDataIn256 + 2));
+                m3 = MATH_OP256(m3, LOADU(pDataIn256 + 3));
+#endif
                 pDataIn256 += NUM_LOOPS_UNROLLED;
             }
 
-            m0 = MATH_OP256(m0, m1);
+            m0 = MATH_OP256(MATH_OP256(m0, m1), MATH_OP256(m2, m3));
 
             // perform the operation horizontally in m0
             union {
@@ -229,6 +256,104 @@ inline void ReduceMathOpFast(void* pDataIn1X, void* pDataOutX, void* pStartVal,
     }
 }
 
+//=====================================================================================================
+// Pairwise summation in the same order numpy sums floats, so the results match numpy bit for bit.
+// Runs of up to PAIRWISE_BLOCK elements go into 8 accumulators (lane j of the registers is accumulator j)
+// and the runs are added in a tree of halves, so the rounding error grows with log(n) instead of n.
+static const int64_t PAIRWISE_BLOCK = 128;
+
+template<typename T>
+static T PairwiseSumStrided(char* pIn, int64_t n, int64_t stride) {
+    if (n < 8) {
+        // -0.0 so a sum of negative zeros stays -0.0
+        T res = -0.0;
+        for (int64_t i = 0; i < n; i++) {
+            res += *(T*)(pIn + i * stride);
+        }
+        return res;
+    }
+    if (n <= PAIRWISE_BLOCK) {
+        T r[8];
+        for (int j = 0; j < 8; j++) {
+            r[j] = *(T*)(pIn + j * stride);
+        }
+        int64_t i;
+        for (i = 8; i < n - (n % 8); i += 8) {
+            for (int j = 0; j < 8; j++) {
+                r[j] += *(T*)(pIn + (i + j) * stride);
+            }
+        }
+        T res = ((r[0] + r[1]) + (r[2] + r[3])) + ((r[4] + r[5]) + (r[6] + r[7]));
+        for (; i < n; i++) {
+            res += *(T*)(pIn + i * stride);
+        }
+        return res;
+    }
+    // split in two, keeping the first half a multiple of 8
+    int64_t n2 = n / 2;
+    n2 -= n2 % 8;
+    return PairwiseSumStrided<T>(pIn, n2, stride) + PairwiseSumStrided<T>(pIn + n2 * stride, n - n2, stride);
+}
+
+// Sum of 8 to PAIRWISE_BLOCK contiguous elements
+static FORCE_INLINE float PairwiseBlock(float* pIn, int64_t n) {
+    __m256 m0 = LOADU((__m256*)pIn);
+    int64_t i;
+    for (i = 8; i < n - (n % 8); i += 8) {
+        _mm_prefetch((const char*)(pIn + i) + 512, _MM_HINT_T0);
+        m0 = _mm256_add_ps(m0, LOADU((__m256*)(pIn + i)));
+    }
+    float r[8];
+    STOREU((__m256*)r, m0);
+    float res = ((r[0] + r[1]) + (r[2] + r[3])) + ((r[4] + r[5]) + (r[6] + r[7]));
+    for (; i < n; i++) {
+        res += pIn[i];
+    }
+    return res;
+}
+
+static FORCE_INLINE double PairwiseBlock(double* pIn, int64_t n) {
+    __m256d m0 = LOADU((__m256d*)pIn);
+    __m256d m1 = LOADU((__m256d*)(pIn + 4));
+    int64_t i;
+    for (i = 8; i < n - (n % 8); i += 8) {
+        _mm_prefetch((const char*)(pIn + i) + 512, _MM_HINT_T0);
+        m0 = _mm256_add_pd(m0, LOADU((__m256d*)(pIn + i)));
+        m1 = _mm256_add_pd(m1, LOADU((__m256d*)(pIn + i + 4)));
+    }
+    double r[8];
+    STOREU((__m256d*)r, m0);
+    STOREU((__m256d*)(r + 4), m1);
+    double res = ((r[0] + r[1]) + (r[2] + r[3])) + ((r[4] + r[5]) + (r[6] + r[7]));
+    for (; i < n; i++) {
+        res += pIn[i];
+    }
+    return res;
+}
+
+template<typename T>
+static T PairwiseSumContig(T* pIn, int64_t n) {
+    if (n < 8) {
+        return PairwiseSumStrided<T>((char*)pIn, n, sizeof(T));
+    }
+    if (n <= PAIRWISE_BLOCK) {
+        return PairwiseBlock(pIn, n);
+    }
+    int64_t n2 = n / 2;
+    n2 -= n2 % 8;
+    return PairwiseSumContig<T>(pIn, n2) + PairwiseSumContig<T>(pIn + n2, n - n2);
+}
+
+template<typename T>
+inline void ReduceAddPairwise(void* pDataIn1X, void* pDataOutX, void* pStartVal, int64_t datalen, int64_t strideIn) {
+    T sum = strideIn == sizeof(T) ?
+        PairwiseSumContig<T>((T*)pDataIn1X, datalen) :
+        PairwiseSumStrided<T>((char*)pDataIn1X, datalen, strideIn);
+
+    // NOTE: numpy adds the sum to the output val
+    *(T*)pDataOutX = *(T*)pStartVal + sum;
+}
+
 
 
 
@@ -734,22 +859,28 @@ ANY_TWO_FUNC GetSimpleMathOpFast(int func, int atopInType1, int atopInType2, int
     case BINARY_OPERATION::MIN:
         *wantedOutType = atopInType1;
         switch (atopInType1) {
-        case ATOP_INT8:  return SimpleMathOpFast<int8_t, __m256i, MinOp<int8_t>, MIN_OP_256i8>;
+        case ATOP_INT8:   return SimpleMathOpFast<int8_t, __m256i, MinOp<int8_t>, MIN_OP_256i8>;
         case ATOP_INT16:  return SimpleMathOpFast<int16_t, __m256i, MinOp<int16_t>, MIN_OP_256i16>;
         case ATOP_INT32:  return SimpleMathOpFast<int32_t, __m256i, MinOp<int32_t>, MIN_OP_256i32>;
-        case ATOP_FLOAT:  return SimpleMathOpFast<float, __m256, MinOp<float>, MIN_OP_256f32>;
-        case ATOP_DOUBLE: return SimpleMathOpFast<double, __m256d, MinOp<double>, MIN_OP_256f64>;
+        case ATOP_INT64:  return SimpleMathOpFast<int64_t, __m256i, MinOp<int64_t>, MIN_OP_256i64>;
+        case ATOP_UINT8:  return SimpleMathOpFast<uint8_t, __m256i, MinOp<uint8_t>, MIN_OP_256u8>;
+        case ATOP_UINT16: return SimpleMathOpFast<uint16_t, __m256i, MinOp<uint16_t>, MIN_OP_256u16>;
+        case ATOP_UINT32: return SimpleMathOpFast<uint32_t, __m256i, MinOp<uint32_t>, MIN_OP_256u32>;
+        case ATOP_UINT64: return SimpleMathOpFast<uint64_t, __m256i, MinOp<uint64_t>, MIN_OP_256u64>;
         }
         return NULL;
 
     case BINARY_OPERATION::MAX:
         *wantedOutType = atopInType1;
         switch (atopInType1) {
-        case ATOP_INT8:  return SimpleMathOpFast<int8_t, __m256i, MaxOp<int8_t>, MAX_OP_256i8>;
+        case ATOP_INT8:   return SimpleMathOpFast<int8_t, __m256i, MaxOp<int8_t>, MAX_OP_256i8>;
         case ATOP_INT16:  return SimpleMathOpFast<int16_t, __m256i, MaxOp<int16_t>, MAX_OP_256i16>;
         case ATOP_INT32:  return SimpleMathOpFast<int32_t, __m256i, MaxOp<int32_t>, MAX_OP_256i32>;
-        case ATOP_FLOAT:  return SimpleMathOpFast<float, __m256, MaxOp<float>, MAX_OP_256f32>;
-        case ATOP_DOUBLE: return SimpleMathOpFast<double, __m256d, MaxOp<double>, MAX_OP_256f64>;
+        case ATOP_INT64:  return SimpleMathOpFast<int64_t, __m256i, MaxOp<int64_t>, MAX_OP_256i64>;
+        case ATOP_UINT8:  return SimpleMathOpFast<uint8_t, __m256i, MaxOp<uint8_t>, MAX_OP_256u8>;
+        case ATOP_UINT16: return SimpleMathOpFast<uint16_t, __m256i, MaxOp<uint16_t>, MAX_OP_256u16>;
+        case ATOP_UINT32: return SimpleMathOpFast<uint32_t, __m256i, MaxOp<uint32_t>, MAX_OP_256u32>;
+        case ATOP_UINT64: return SimpleMathOpFast<uint64_t, __m256i, MaxOp<uint64_t>, MAX_OP_256u64>;
         }
         return NULL;
 
@@ -839,6 +970,8 @@ ANY_TWO_FUNC GetSimpleMathOpFast(int func, int atopInType1, int atopInType2, int
     return NULL;
 }
 
+// NOTE: MIN and MAX have no float loops, here or in GetSimpleMathOpFast
+// numpy propagates nans but the float min/max instructions do not, so floats use the numpy loop
 extern "C"
 REDUCE_FUNC GetReduceMathOpFast(int func, int atopInType1) {
 
@@ -853,6 +986,11 @@ REDUCE_FUNC GetReduceMathOpFast(int func, int atopInType1) {
         case ATOP_INT64:  return ReduceMathOpFast<int64_t, __m256i, AddOp<int64_t>, ADD_OP_256i64>;
         case ATOP_INT16:  return ReduceMathOpFast<int16_t, __m256i, AddOp<int16_t>, ADD_OP_256i16>;
         case ATOP_INT8:   return ReduceMathOpFast<int8_t, __m256i, AddOp<int8_t>, ADD_OP_256i8>;
+            // unsigned wraps around the same as signed
+        case ATOP_UINT8:  return ReduceMathOpFast<uint8_t, __m256i, AddOp<uint8_t>, ADD_OP_256i8>;
+        case ATOP_UINT16: return ReduceMathOpFast<uint16_t, __m256i, AddOp<uint16_t>, ADD_OP_256i16>;
+        case ATOP_UINT32: return ReduceMathOpFast<uint32_t, __m256i, AddOp<uint32_t>, ADD_OP_256i32>;
+        case ATOP_UINT64: return ReduceMathOpFast<uint64_t, __m256i, AddOp<uint64_t>, ADD_OP_256i64>;
         }
         return NULL;
 
@@ -864,6 +1002,11 @@ REDUCE_FUNC GetReduceMathOpFast(int func, int atopInType1) {
         case ATOP_DOUBLE: return ReduceMathOpFast<double, __m256d, MulOp<double>, MUL_OP_256f64>;
         case ATOP_INT32:  return ReduceMathOpFast<int32_t, __m256i, MulOp<int32_t>, MUL_OP_256i32>;
         case ATOP_INT16:  return ReduceMathOpFast<int16_t, __m256i, MulOp<int16_t>, MUL_OP_256i16>;
+        case ATOP_INT8:   return ReduceMathOpFast<int8_t, __m256i, MulOp<int8_t>, MUL_OP_256i8>;
+        case ATOP_INT64:  return ReduceMathOpFast<int64_t, __m256i, MulOp<int64_t>, MUL_OP_256u64>;
+        case ATOP_UINT8:  return ReduceMathOpFast<uint8_t, __m256i, MulOp<uint8_t>, MUL_OP_256i8>;
+        case ATOP_UINT16: return ReduceMathOpFast<uint16_t, __m256i, MulOp<uint16_t>, MUL_OP_256i16>;
+        case ATOP_UINT32: return ReduceMathOpFast<uint32_t, __m256i, MulOp<uint32_t>, MUL_OP_256i32>;
         case ATOP_UINT64: return ReduceMathOpFast<uint64_t, __m256i, MulOp<uint64_t>, MUL_OP_256u64>;
         }
         return NULL;
@@ -871,30 +1014,28 @@ REDUCE_FUNC GetReduceMathOpFast(int func, int atopInType1) {
     case BINARY_OPERATION::MIN:
         switch (atopInType1) {
         case ATOP_BOOL:   return ReduceMathOpFast<int8_t, __m256i, MinOp<int8_t>, MIN_OP_256i8>;
-        case ATOP_FLOAT:  return ReduceMathOpFast<float, __m256, MinOp<float>, MIN_OP_256f32>;
-        case ATOP_DOUBLE: return ReduceMathOpFast<double, __m256d, MinOp<double>, MIN_OP_256f64>;
-        case ATOP_INT8:  return ReduceMathOpFast<int8_t, __m256i, MinOp<int8_t>, MIN_OP_256i8>;
+        case ATOP_INT8:   return ReduceMathOpFast<int8_t, __m256i, MinOp<int8_t>, MIN_OP_256i8>;
         case ATOP_INT16:  return ReduceMathOpFast<int16_t, __m256i, MinOp<int16_t>, MIN_OP_256i16>;
         case ATOP_INT32:  return ReduceMathOpFast<int32_t, __m256i, MinOp<int32_t>, MIN_OP_256i32>;
+        case ATOP_INT64:  return ReduceMathOpFast<int64_t, __m256i, MinOp<int64_t>, MIN_OP_256i64>;
         case ATOP_UINT8:  return ReduceMathOpFast<uint8_t, __m256i, MinOp<uint8_t>, MIN_OP_256u8>;
-        case ATOP_UINT16:  return ReduceMathOpFast<uint16_t, __m256i, MinOp<uint16_t>, MIN_OP_256u16>;
-        case ATOP_UINT32:  return ReduceMathOpFast<uint32_t, __m256i, MinOp<uint32_t>, MIN_OP_256u32>;
-            // NOTE for i64 have to use cmp_gt then use boolmask
+        case ATOP_UINT16: return ReduceMathOpFast<uint16_t, __m256i, MinOp<uint16_t>, MIN_OP_256u16>;
+        case ATOP_UINT32: return ReduceMathOpFast<uint32_t, __m256i, MinOp<uint32_t>, MIN_OP_256u32>;
+        case ATOP_UINT64: return ReduceMathOpFast<uint64_t, __m256i, MinOp<uint64_t>, MIN_OP_256u64>;
         }
         return NULL;
 
     case BINARY_OPERATION::MAX:
         switch (atopInType1) {
         case ATOP_BOOL:   return ReduceMathOpFast<int8_t, __m256i, MaxOp<int8_t>, MAX_OP_256i8>;
-        case ATOP_FLOAT:  return ReduceMathOpFast<float, __m256, MaxOp<float>, MAX_OP_256f32>;
-        case ATOP_DOUBLE: return ReduceMathOpFast<double, __m256d, MaxOp<double>, MAX_OP_256f64>;
-        case ATOP_INT8:  return ReduceMathOpFast<int8_t, __m256i, MaxOp<int8_t>, MAX_OP_256i8>;
+        case ATOP_INT8:   return ReduceMathOpFast<int8_t, __m256i, MaxOp<int8_t>, MAX_OP_256i8>;
         case ATOP_INT16:  return ReduceMathOpFast<int16_t, __m256i, MaxOp<int16_t>, MAX_OP_256i16>;
         case ATOP_INT32:  return ReduceMathOpFast<int32_t, __m256i, MaxOp<int32_t>, MAX_OP_256i32>;
+        case ATOP_INT64:  return ReduceMathOpFast<int64_t, __m256i, MaxOp<int64_t>, MAX_OP_256i64>;
         case ATOP_UINT8:  return ReduceMathOpFast<uint8_t, __m256i, MaxOp<uint8_t>, MAX_OP_256u8>;
-        case ATOP_UINT16:  return ReduceMathOpFast<uint16_t, __m256i, MaxOp<uint16_t>, MAX_OP_256u16>;
-        case ATOP_UINT32:  return ReduceMathOpFast<uint32_t, __m256i, MaxOp<uint32_t>, MAX_OP_256u32>;
-            // NOTE for i64 have to use cmp_gt then use boolmask
+        case ATOP_UINT16: return ReduceMathOpFast<uint16_t, __m256i, MaxOp<uint16_t>, MAX_OP_256u16>;
+        case ATOP_UINT32: return ReduceMathOpFast<uint32_t, __m256i, MaxOp<uint32_t>, MAX_OP_256u32>;
+        case ATOP_UINT64: return ReduceMathOpFast<uint64_t, __m256i, MaxOp<uint64_t>, MAX_OP_256u64>;
         }
         return NULL;
 
@@ -903,6 +1044,18 @@ REDUCE_FUNC GetReduceMathOpFast(int func, int atopInType1) {
 }
 
 
+// Float sums in numpy's pairwise order, NULL when the op and type have no pairwise reduce
+extern "C"
+REDUCE_FUNC GetReducePairwise(int func, int atopInType1) {
+    if (func == BINARY_OPERATION::ADD) {
+        switch (atopInType1) {
+        case ATOP_FLOAT:  return ReduceAddPairwise<float>;
+        case ATOP_DOUBLE: return ReduceAddPairwise<double>;
+        }
+    }
+    return NULL;
+}
+
 #if defined(__clang__)
 #pragma clang attribute pop
 #endif
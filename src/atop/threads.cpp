@@ -57,6 +57,126 @@ WakeAllAddress g_WakeAllAddress = NULL;
 WaitAddress g_WaitAddress = NULL;
 #endif
 
+volatile int64_t g_LatencyJobs = 0;
+
+// Set in each worker thread, NULL in the threads submitting jobs
+static thread_local stWorkerThread* t_pWorkerThread = NULL;
+
+
+//-----------------------------------------------------------
+// Called by the thread that completed the last block
+void stMATH_WORKER_ITEM::WakeMain() {
+    InterlockedIncrement64(&CompletionDone);
+    if (MainWaiting == 0) return;
+
+#if defined(RT_OS_WINDOWS)
+    if (g_WakeSingleAddress != NULL) g_WakeSingleAddress((PVOID)&CompletionDone);
+#elif defined(RT_OS_LINUX)
+    futex((int*)&CompletionDone, FUTEX_WAKE, 1, NULL, NULL, 0);
+#endif
+}
+
+//-----------------------------------------------------------
+// SCHEDULE_STEAL: take the next block from the front of our own range
+// When our range is empty, publish the blocks we completed and steal the
+// upper half of another thread's range
+// Returns BlockLast when there is nothing left to do
+int64_t stMATH_WORKER_ITEM::StealWorkBlock(int core) {
+    const int64_t tag = JobTag & stStealRange::TAG_MASK;
+    const int32_t rangeCount = StealRangeCount;
+    int32_t slot = core + 1;
+    stStealRange* pOwn = &pStealRanges[slot];
+
+    while (true) {
+        int64_t range = pOwn->Range;
+        int64_t start = stStealRange::Start(range);
+        int64_t end = stStealRange::End(range);
+        if (stStealRange::Tag(range) != tag || start >= end) break;
+
+        if (InterlockedCompareExchange64(&pOwn->Range, stStealRange::Pack(tag, start + 1, end), range) == range) {
+            return start;
+        }
+        // a thief took part of our range, try again
+    }
+
+    if (pOwn->PendingCompleted) {
+        AddBlocksCompleted(pOwn->PendingCompleted);
+        pOwn->PendingCompleted = 0;
+    }
+
+    for (int32_t i = 1; i < rangeCount; i++) {
+        stStealRange* pVictim = &pStealRanges[(slot + i) % rangeCount];
+
+        while (true) {
+            int64_t range = pVictim->Range;
+            int64_t start = stStealRange::Start(range);
+            int64_t end = stStealRange::End(range);
+            if (stStealRange::Tag(range) != tag || start >= end) break;
+
+            // victim keeps [start, mid), we take [mid, end)
+            int64_t mid = start + ((end - start) / 2);
+            if (InterlockedCompareExchange64(&pVictim->Range, stStealRange::Pack(tag, start, mid), range) == range) {
+                // Work on the first stolen block, the rest can be stolen from us
+                // Our range is empty so nobody else writes to it
+                pOwn->Range = stStealRange::Pack(tag, mid + 1, end);
+                return mid;
+            }
+        }
+    }
+
+    return BlockLast;
+}
+
+//-----------------------------------------------------------
+// SCHEDULE_STATIC: walk the range we claimed with a private cursor
+// When it is done, publish the blocks we completed and claim a range nobody has
+// (our own first, others belong to threads that have not woken up yet)
+// With every range claimed, take tail blocks from the shared counter
+// Returns BlockLast when there is nothing left to do
+int64_t stMATH_WORKER_ITEM::StaticWorkBlock(int core) {
+    const int64_t tag = JobTag & stStealRange::TAG_MASK;
+    const int32_t rangeCount = StealRangeCount;
+    int32_t slot = core + 1;
+    stStealRange* pOwn = &pStealRanges[slot];
+
+    if (pOwn->CursorTag != JobTag) {
+        // first block of this job for us
+        pOwn->CursorTag = JobTag;
+        pOwn->Cursor = 0;
+        pOwn->CursorEnd = 0;
+        pOwn->Claimed = 0;
+    }
+
+    if (pOwn->Cursor < pOwn->CursorEnd) {
+        return pOwn->Cursor++;
+    }
+
+    if (pOwn->PendingCompleted) {
+        AddBlocksCompleted(pOwn->PendingCompleted);
+        pOwn->PendingCompleted = 0;
+    }
+
+    if (!pOwn->Claimed) {
+        for (int32_t i = 0; i < rangeCount; i++) {
+            stStealRange* pRange = &pStealRanges[(slot + i) % rangeCount];
+            int64_t range = pRange->Range;
+            int64_t start = stStealRange::Start(range);
+            int64_t end = stStealRange::End(range);
+            if (stStealRange::Tag(range) != tag || start >= end) continue;
+
+            if (InterlockedCompareExchange64(&pRange->Range, stStealRange::Pack(tag, end, end), range) == range) {
+                pOwn->Cursor = start + 1;
+                pOwn->CursorEnd = end;
+                return start;
+            }
+        }
+        pOwn->Claimed = 1;
+    }
+
+    // The tail, each block is published as soon as the next one is asked for
+    int64_t wBlock = GetWorkBlock();
+    return wBlock < BlockLast ? wBlock : BlockLast;
+}
 
 //-----------------------------------------------------------
 // Main thread loop
@@ -69,6 +189,119 @@ WaitAddress g_WaitAddress = NULL;
 //   * libdispatch (GCD), using dispatch_semaphore_t (via dispatch_semaphore_create()) to control concurrency; include <dispatch/semaphore.h>
 //   * BSD syscalls like __psynch_cvwait (and other __psynch functions). These are not externally documented -- need to look in github.com/apple/darwin-libpthread to see how things work.
 //
+//-----------------------------------------------------------
+// Spins until new work shows up or SpinNanos has passed
+// Returns TRUE if there is new work
+static BOOL SpinForWork(stWorkerRing* pWorkerRing, stWorkerThread* pWorkerThread, int64_t workIndexCompleted) {
+    const int32_t MAX_SPIN_PAUSES = 64;
+    int64_t deadline = GetMonotonicNanos() + pWorkerRing->SpinNanos;
+    int32_t pauses = 1;
+
+    while (pWorkerRing->Cancelled == 0 && pWorkerThread->ExitRequested == 0) {
+        for (int32_t i = 0; i < pauses; i++) {
+            YieldProcessor();
+        }
+        if (pWorkerRing->WorkIndex != workIndexCompleted) return TRUE;
+
+        if (pWorkerRing->SpinBackoff && pauses < MAX_SPIN_PAUSES) pauses <<= 1;
+        if (GetMonotonicNanos() >= deadline) break;
+    }
+    return FALSE;
+}
+
+//-----------------------------------------------------------
+// Works on the item in a producer slot until it has no blocks left
+// The producer clears the slot bit then waits for Users to drop to 0 before
+// reusing the slot, so we only touch the item while the bit is still set
+static int64_t ServiceWorkItem(stWorkerRing* pWorkerRing, int32_t slot, int core, int64_t workIndex) {
+    stMATH_WORKER_ITEM* pWorkItem = pWorkerRing->GetWorkItem(slot);
+    int64_t didSomeWork = 0;
+
+    InterlockedIncrement64(&pWorkItem->Users);
+    stMATH_WORKER_ITEM* pJob = pWorkItem->pForward ? pWorkItem->pForward : pWorkItem;
+
+    // A worker started after the blocks were split into ranges has no range of its own
+    if ((pWorkerRing->ActiveMask & ((int64_t)1 << slot)) &&
+        (pJob->Schedule == SCHEDULE_RING || core + 1 < pJob->StealRangeCount)) {
+        // Only as many workers as the job asked for join it (MaxThreads), even
+        // when more are awake or spinning
+        int64_t wakeup = InterlockedDecrement64(&pWorkItem->ThreadWakeup);
+        if (wakeup >= 0) {
+            didSomeWork = pWorkItem->DoWork(core, workIndex);
+        }
+    }
+    InterlockedDecrement64(&pWorkItem->Users);
+
+    // An autoRelease job is given back by the first thread to leave it once it is complete
+    if (pJob->ClaimRelease()) {
+        THREADER->FinishWorkItem(pJob, TRUE);
+    }
+    return didSomeWork;
+}
+
+//-----------------------------------------------------------
+// Works on the items of every producer slot in mask
+// Start at a different producer slot on each core so the workers spread over the jobs in flight
+// Returns the number of blocks completed
+static int64_t ServiceSlots(stWorkerThread* pWorkerThread, uint64_t mask, int core, int64_t workIndex) {
+    stWorkerRing* pWorkerRing = pWorkerThread->pWorkerRing;
+    stWorkerStats* pStats = pWorkerThread->pStats;
+    int64_t didSomeWork = 0;
+
+    int32_t first = (int32_t)(core % stWorkerRing::MAX_PRODUCERS);
+    uint64_t rotated = first ? (mask >> first) | (mask << (64 - first)) : mask;
+
+    while (rotated) {
+        int32_t slot = (first + (int32_t)tzcnt_64(rotated)) % stWorkerRing::MAX_PRODUCERS;
+        rotated &= rotated - 1;
+        int64_t blocks = ServiceWorkItem(pWorkerRing, slot, core, workIndex);
+        if (blocks) {
+            pStats->BlocksCompleted += blocks;
+            pStats->JobsJoined++;
+            didSomeWork += blocks;
+        }
+    }
+    return didSomeWork;
+}
+
+//-----------------------------------------------------------
+volatile int64_t g_ForkGeneration = 0;
+
+#if !defined(RT_OS_WINDOWS)
+// Runs in the child right after fork with only the forking thread alive
+// Only safe calls here, the pool is rebuilt by CMathWorker::CheckFork on first use
+static void ForkChildHandler() {
+    g_ForkGeneration++;
+#if defined(RT_OS_DARWIN)
+    // The parent's workers may have held these at the time of the fork
+    pthread_mutex_init(&g_WakeupMutex, NULL);
+    pthread_cond_init(&g_WakeupCond, NULL);
+#endif
+}
+#endif
+
+//-----------------------------------------------------------
+void RegisterForkHandlers() {
+#if !defined(RT_OS_WINDOWS)
+    static BOOL registered = FALSE;
+    if (!registered && pthread_atfork(NULL, NULL, ForkChildHandler) == 0) {
+        registered = TRUE;
+    }
+#endif
+}
+
+//-----------------------------------------------------------
+void ServiceLatencyWork(int core) {
+    stWorkerThread* pWorkerThread = t_pWorkerThread;
+    if (!pWorkerThread) return;
+
+    stWorkerRing* pWorkerRing = pWorkerThread->pWorkerRing;
+    uint64_t latency = (uint64_t)(pWorkerRing->ActiveMask & pWorkerRing->LatencyMask);
+    if (latency) {
+        ServiceSlots(pWorkerThread, latency, core, pWorkerRing->WorkIndex);
+    }
+}
+
 #if defined(RT_OS_WINDOWS)
 DWORD WINAPI WorkerThreadFunction(LPVOID lpParam)
 #else
@@ -76,65 +309,100 @@ void*
 WorkerThreadFunction(void* lpParam)
 #endif
 {
-    stWorkerRing* pWorkerRing = (stWorkerRing*)lpParam;
+    stWorkerThread* pWorkerThread = (stWorkerThread*)lpParam;
+    stWorkerRing* pWorkerRing = pWorkerThread->pWorkerRing;
 
-    DWORD core = (DWORD)(InterlockedIncrement64(&pWorkerRing->WorkThread));
-    core = core - 1;
+    InterlockedIncrement64(&pWorkerRing->WorkThread);
+    DWORD core = (DWORD)pWorkerThread->Core;
+    t_pWorkerThread = pWorkerThread;
 
     //if (core > 3) core += 16;
     //core += 16;
 
     LOGGING("Thread created with parameter: %d   %p\n", core, g_WaitAddress);
 
+    // Keep the thread on the cpus of its numa node
+    if (pWorkerThread->NumaNode >= 0) {
+        PinThreadToNode(pWorkerThread->pTopology, pWorkerThread->NumaNode);
+    }
     // On windows we set the thread affinity mask
-    if (g_WaitAddress != NULL) {
+    else if (g_WaitAddress != NULL && core < 64) {
         uint64_t mask = (uint64_t)(1) << core;//core number starts from 0
         uint64_t ret = SetThreadAffinityMask(GetCurrentThread(), mask);
         //uint64_t ret = SetThreadAffinityMask(GetCurrentThread(), 0xFFFFFFFF);
     }
 
     int64_t lastWorkItemCompleted = -1;
+    int64_t lastWorkIndex = -1;
+    stWorkerStats* pStats = pWorkerThread->pStats;
+
+    // When we last woke up, 0 once we found work
+    int64_t wakeNanos = 0;
 
     //
     // Setting Cancelled will stop all worker threads
+    // Setting ExitRequested stops just this one (the pool is shrinking)
     //
-    while (pWorkerRing->Cancelled == 0) {
+    while (pWorkerRing->Cancelled == 0 && pWorkerThread->ExitRequested == 0) {
         int64_t workIndexCompleted;
         int64_t workIndex;
 
+        // Read before the active items so a job published after we look
+        // changes WorkIndex and stops us from sleeping
         workIndex = pWorkerRing->WorkIndex;
-        workIndexCompleted = pWorkerRing->WorkIndexCompleted;
+
+        // WAKE_TREE: a follower sleeps on its group word
+        // WAKE_TARGETED: every worker sleeps on its own word
+        // Read it before looking for work too
+        int32_t wakeMode = pWorkerRing->WakeMode;
+        stWorkerRing::stWakeWord* pWakeWord = NULL;
+        if (wakeMode == WAKE_TARGETED) pWakeWord = &pWorkerRing->WakeWords[core];
+        else if (wakeMode == WAKE_TREE && !pWorkerThread->WakeLeader) pWakeWord = &pWorkerRing->WakeGroups[pWorkerThread->WakeGroup];
+        int64_t wakeWord = pWakeWord ? pWakeWord->Word : 0;
+
+        // A leader passes each new work item on to the rest of its group
+        if (workIndex != lastWorkIndex) {
+            if (wakeMode == WAKE_TREE && pWorkerThread->WakeLeader) {
+                pWorkerRing->WakeFollowers(pWorkerThread->WakeGroup);
+            }
+            lastWorkIndex = workIndex;
+        }
 
         int64_t didSomeWork = 0;
 
-        // See if work to do
-        if (workIndex > workIndexCompleted) {
-            stMATH_WORKER_ITEM* pWorkItem = pWorkerRing->GetExistingWorkItem();
+        // See if work to do, latency jobs first
+        uint64_t active = (uint64_t)pWorkerRing->ActiveMask;
+        if (active) {
+            uint64_t latency = active & (uint64_t)pWorkerRing->LatencyMask;
+            int64_t startNanos = wakeNanos ? GetMonotonicNanos() : 0;
 
-#if defined(RT_OS_WINDOWS)
-            // Windows we check if the work was for our thread
-            int64_t wakeup = InterlockedDecrement64(&pWorkItem->ThreadWakeup);
-            if (wakeup >= 0) {
-                didSomeWork = pWorkItem->DoWork(core, workIndex);
-            }
-            else {
-                //printf("[%d] not doing work %lld.  %lld  %lld\n", core, wakeup, workIndex, workIndexCompleted);
-                //workIndex++;
+            if (latency) didSomeWork += ServiceSlots(pWorkerThread, latency, core, workIndex);
+            didSomeWork += ServiceSlots(pWorkerThread, active & ~latency, core, workIndex);
+
+            if (didSomeWork && wakeNanos) {
+                pStats->WakeNanos += startNanos - wakeNanos;
+                pStats->WakeCount++;
+                wakeNanos = 0;
             }
-#else
-            didSomeWork = pWorkItem->DoWork(core, workIndex);
-#endif
         }
 
-        // didSomeWork contains how many work items the thread completed
-        // TODO: Use core as an index to keep stats track of how many
-        // work items each thread is completing for future thread tuning
+        // didSomeWork contains how many blocks the thread completed
         //
         // NOTE: if we did some work, we loop back to top while to check for more work
         // before waiting again on the worker Q
         //
         if (!didSomeWork) {
             workIndexCompleted = workIndex;
+            int64_t idleNanos = GetMonotonicNanos();
+
+            // Back to back jobs are common, a short spin avoids the sleep and wake
+            if (pWorkerRing->SpinNanos > 0 && SpinForWork(pWorkerRing, pWorkerThread, workIndexCompleted)) {
+                pStats->SpinWakes++;
+                wakeNanos = GetMonotonicNanos();
+                pStats->IdleNanos += wakeNanos - idleNanos;
+                continue;
+            }
+            pStats->SleepWaits++;
 
 #if defined(RT_OS_WINDOWS)
             //printf("Sleeping %d", core);
@@ -164,7 +432,16 @@ WorkerThreadFunction(void* lpParam)
             //int futex(int *uaddr, int futex_op, int val,
             //   const struct timespec *timeout,   /* or: uint32_t val2 */
             //   int *uaddr2, int val3);
-            futex((int*)&pWorkerRing->WorkIndex, FUTEX_WAIT, (int)workIndexCompleted, NULL, NULL, 0);
+            if (pWakeWord) {
+                InterlockedIncrement64(&pWakeWord->Sleepers);
+                futex((int*)&pWakeWord->Word, FUTEX_WAIT, (int)wakeWord, NULL, NULL, 0);
+                InterlockedDecrement64(&pWakeWord->Sleepers);
+            }
+            else {
+                InterlockedIncrement64(&pWorkerRing->Sleepers);
+                futex((int*)&pWorkerRing->WorkIndex, FUTEX_WAIT, (int)workIndexCompleted, NULL, NULL, 0);
+                InterlockedDecrement64(&pWorkerRing->Sleepers);
+            }
 
 #elif defined(RT_OS_DARWIN)
             LOGGING("[%lu] WaitAddress %llu  %llu  %d\n", core, workIndexCompleted, pWorkerRing->WorkIndex, (int)didSomeWork);
@@ -179,13 +456,19 @@ WorkerThreadFunction(void* lpParam)
 #endif
 
             //printf("Waking %d", core);
+            wakeNanos = GetMonotonicNanos();
+            pStats->IdleNanos += wakeNanos - idleNanos;
 
             //YieldProcessor();
         }
         //YieldProcessor();
     }
 
-    LOGERROR("Thread %d exiting!!!\n", (int)core);
+    LOGGING("Thread %d exiting\n", (int)core);
+    InterlockedDecrement64(&pWorkerRing->WorkThread);
+
+    // Acknowledge so whoever stopped us knows we are off the ring
+    pWorkerThread->Exited = 1;
 #if defined(RT_OS_WINDOWS)
     return 0;
 #else
@@ -198,7 +481,7 @@ WorkerThreadFunction(void* lpParam)
 
 //-----------------------------------------------------------
 //
-THANDLE StartThread(stWorkerRing* pWorkerRing)
+THANDLE StartThread(stWorkerThread* pWorkerThread)
 {
     DWORD dwThreadId;
     THANDLE hThread;
@@ -207,7 +490,7 @@ THANDLE StartThread(stWorkerRing* pWorkerRing)
         NULL, // default security attributes
         0, // use default stack size
         WorkerThreadFunction, // thread function
-        pWorkerRing, // argument to thread function
+        pWorkerThread, // argument to thread function
         0, // use default creation flags
         &dwThreadId); // returns the thread identifier
 
@@ -223,23 +506,153 @@ THANDLE StartThread(stWorkerRing* pWorkerRing)
 
 }
 
+//-----------------------------------------------------------
+// Waits for a worker thread to return and releases it
+BOOL JoinThread(THANDLE hThread)
+{
+    if (hThread == NULL) return FALSE;
+    BOOL result = WaitForSingleObject(hThread, INFINITE) == WAIT_OBJECT_0;
+    CloseHandle(hThread);
+    return result;
+}
+
+//-----------------------------------------------------------
+//
+int64_t GetMonotonicNanos()
+{
+    static LARGE_INTEGER frequency = { 0 };
+    LARGE_INTEGER counter;
+    if (frequency.QuadPart == 0) QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (int64_t)((double)counter.QuadPart * 1000000000.0 / (double)frequency.QuadPart);
+}
+
+//-----------------------------------------------------------
+//
+THANDLE GetCurrentThreadHandle()
+{
+    // A pseudo handle, only valid when used by the calling thread
+    return GetCurrentThread();
+}
+
+//-----------------------------------------------------------
+//
+BOOL PinThreadToCpus(THANDLE hThread, const int16_t* pCpus, int32_t count)
+{
+    DWORD_PTR mask = 0;
+    for (int32_t i = 0; i < count; i++) {
+        if (pCpus[i] >= 0 && pCpus[i] < 64) mask |= (DWORD_PTR)1 << pCpus[i];
+    }
+    if (mask == 0) {
+        DWORD_PTR systemMask;
+        if (!GetProcessAffinityMask(GetCurrentProcess(), &mask, &systemMask)) return FALSE;
+    }
+    return SetThreadAffinityMask(hThread, mask) != 0;
+}
+
+//-----------------------------------------------------------
+//
+int32_t GetThreadCpus(THANDLE hThread, int16_t* pCpus, int32_t maxCpus)
+{
+    DWORD_PTR mask, systemMask;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &mask, &systemMask)) return 0;
+
+    // There is no GetThreadAffinityMask, setting a mask returns the old one
+    DWORD_PTR previous = SetThreadAffinityMask(hThread, mask);
+    if (previous == 0) return 0;
+    SetThreadAffinityMask(hThread, previous);
+
+    int32_t count = 0;
+    for (int32_t c = 0; c < 64 && count < maxCpus; c++) {
+        if (previous & ((DWORD_PTR)1 << c)) pCpus[count++] = (int16_t)c;
+    }
+    return count;
+}
+
 #else
 
 //-----------------------------------------------------------
 //
-THANDLE StartThread(stWorkerRing* pWorkerRing)
+THANDLE StartThread(stWorkerThread* pWorkerThread)
 {
     int err;
     THANDLE hThread;
 
-    err = pthread_create(&hThread, NULL, &WorkerThreadFunction, pWorkerRing);
+    err = pthread_create(&hThread, NULL, &WorkerThreadFunction, pWorkerThread);
 
     if (err != 0) {
         LOGERROR("*** Cannot create thread :[%s]\n", strerror(err));
+        return 0;
     }
 
     return hThread;
 }
+
+//-----------------------------------------------------------
+// Waits for a worker thread to return and releases it
+BOOL JoinThread(THANDLE hThread)
+{
+    if (hThread == 0) return FALSE;
+    return pthread_join(hThread, NULL) == 0;
+}
+
+//-----------------------------------------------------------
+//
+int64_t GetMonotonicNanos()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+//-----------------------------------------------------------
+//
+THANDLE GetCurrentThreadHandle()
+{
+    return pthread_self();
+}
+
+//-----------------------------------------------------------
+//
+BOOL PinThreadToCpus(THANDLE hThread, const int16_t* pCpus, int32_t count)
+{
+#if defined(RT_OS_LINUX)
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (int32_t i = 0; i < count; i++) {
+        if (pCpus[i] >= 0 && pCpus[i] < CPU_SETSIZE) CPU_SET(pCpus[i], &cpuset);
+    }
+    if (CPU_COUNT(&cpuset) == 0) return FALSE;
+
+    int err = pthread_setaffinity_np(hThread, sizeof(cpuset), &cpuset);
+    if (err != 0) {
+        LOGERROR("*** Cannot set thread affinity :[%s]\n", strerror(err));
+        return FALSE;
+    }
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+//-----------------------------------------------------------
+//
+int32_t GetThreadCpus(THANDLE hThread, int16_t* pCpus, int32_t maxCpus)
+{
+#if defined(RT_OS_LINUX)
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    if (pthread_getaffinity_np(hThread, sizeof(cpuset), &cpuset) != 0) return 0;
+
+    int32_t count = 0;
+    for (int32_t c = 0; c < CPU_SETSIZE && count < maxCpus; c++) {
+        if (CPU_ISSET(c, &cpuset)) pCpus[count++] = (int16_t)c;
+    }
+    return count;
+#else
+    return 0;
+#endif
+}
 #endif
 
 //============================================================================================
@@ -671,12 +1084,21 @@ int GetProcCount() {
     int count;
 
     count = 0;
+#if defined(RT_OS_LINUX)
+    // The 64 bit affinity mask does not see past cpu 63
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    if (sched_getaffinity(0, sizeof(cpuset), &cpuset) == 0) {
+        count = CPU_COUNT(&cpuset);
+    }
+#else
     GetProcessAffinityMask(proc, &mask1, &mask2);
 
     while (mask1 != 0) {
         if (mask1 & 1) count++;
         mask1 = mask1 >> 1;
     }
+#endif
 
     //printf("**Process count: %d   riptide_cpp build date and time: %s %s\n", count, __DATE__, __TIME__);
 
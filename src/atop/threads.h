@@ -1,6 +1,8 @@
 #pragma once
 
 #include "common_inc.h"
+#include "topology.h"
+#include "budget.h"
 
 #if defined(__GNUC__)
 #if __GNUC_PREREQ(4, 4) || (__clang__ > 0 && __clang_major__ >= 3) || !defined(__GNUC__)
@@ -52,11 +54,11 @@ extern pthread_cond_t  g_WakeupCond;
 // Determines the CAP on threads
 #define MAX_THREADS_WHEN_CANNOT_DETECT 5
 
-// set this value lower to help windows wake up threads
-#define MAX_THREADS_ALLOWED 31
+// Most worker threads, past 32 the wakeup goes through group leaders (see WAKE_MODE)
+#define MAX_THREADS_ALLOWED 255
 
 #define FUTEX_WAKE_DEFAULT  11
-#define FUTEX_WAKE_MAX      31
+#define FUTEX_WAKE_MAX      MAX_THREADS_ALLOWED
 
 
 //--------------------------------------------------------------------
@@ -181,6 +183,137 @@ struct OLD_CALLBACK {
 
 };
 
+//-----------------------------------------------------------
+// How the blocks of a work item are handed out to threads
+enum WORK_SCHEDULE : int32_t {
+    // All threads take the next block from the shared BlockNext counter
+    SCHEDULE_RING = 0,
+
+    // Each thread owns a range of blocks, idle threads steal half of a victim's range
+    SCHEDULE_STEAL = 1,
+
+    // Each thread claims a range of blocks up front and walks it with a private cursor
+    // Only the last blocks (the tail) are handed out from the shared counter
+    SCHEDULE_STATIC = 2,
+
+    SCHEDULE_LAST = 3
+};
+
+//-----------------------------------------------------------
+// How sleeping worker threads are woken up for a new work item (Linux)
+enum WAKE_MODE : int32_t {
+    // WAKE_TREE when a ring has more than WAKE_TREE_THRESHOLD workers, else WAKE_FLAT
+    WAKE_AUTO = 0,
+
+    // Every worker sleeps on WorkIndex, the producer wakes all it needs in one futex call
+    WAKE_FLAT = 1,
+
+    // Workers are in groups that share a last level cache (a CCX), the producer
+    // wakes a few group leaders and each leader wakes the rest of its group
+    WAKE_TREE = 2,
+
+    // Every worker sleeps on its own word, the producer wakes exactly the workers it picks:
+    // the lowest in the ring first so the same (warm) workers take the small jobs
+    WAKE_TARGETED = 3,
+
+    WAKE_LAST = 4
+};
+
+// Rings with more worker threads than this use WAKE_TREE in WAKE_AUTO
+#define WAKE_TREE_THRESHOLD 32
+
+//-----------------------------------------------------------
+// Which lane a work item is in
+enum WORK_PRIORITY : int32_t {
+    // Large jobs, workers leave them between blocks to help latency jobs
+    PRIORITY_BULK = 0,
+
+    // Small jobs someone is waiting on, workers look at these first
+    PRIORITY_LATENCY = 1,
+
+    PRIORITY_LAST = 2
+};
+
+// Latency jobs published and not yet complete, workers in bulk jobs only look for them when not 0
+extern volatile int64_t g_LatencyJobs;
+
+// Bumped in the child process after a fork, see CMathWorker::CheckFork
+extern volatile int64_t g_ForkGeneration;
+
+// pthread_atfork handlers so a forked child rebuilds the worker pool
+void RegisterForkHandlers();
+
+// Defined in threads.cpp
+// Called by a worker thread between blocks of a bulk job to work on the latency jobs of its ring
+void ServiceLatencyWork(int core);
+
+//-----------------------------------------------------------
+// Which numa node worker groups run a work item
+enum NUMA_POLICY : int32_t {
+    // The node holding the input pages, all nodes if the input spans nodes
+    NUMA_LOCAL = 0,
+
+    // Always all nodes
+    NUMA_INTERLEAVE = 1,
+
+    NUMA_LAST = 2
+};
+
+//-----------------------------------------------------------
+// How expensive an op is per element, picks the block size
+enum WORK_COST : int32_t {
+    // Bound by memory bandwidth (add, compare, abs)
+    COST_MEMORY = 0,
+
+    // A few cycles per element (divide, mod, sqrt)
+    COST_LIGHT = 1,
+
+    // Tens of cycles per element (sin, log, exp, power)
+    COST_HEAVY = 2,
+
+    COST_LAST = 3
+};
+
+//-----------------------------------------------------------
+// A range of blocks owned by one thread when work stealing
+// The job tag, first block and end block are packed into one 64 bit word
+// so the owner and the thieves can both update it with a compare exchange
+// allocated on 64 byte alignment so owners do not share a cache line
+struct stStealRange {
+    static const int     TAG_BITS = 8;
+    static const int     BLOCK_BITS = 28;
+    static const int64_t TAG_MASK = ((int64_t)1 << TAG_BITS) - 1;
+    static const int64_t BLOCK_MASK = ((int64_t)1 << BLOCK_BITS) - 1;
+
+    // Jobs with more blocks than this fall back to SCHEDULE_RING
+    static const int64_t MAX_BLOCKS = BLOCK_MASK;
+
+    volatile int64_t    Range;
+
+    // Blocks completed by the owner not yet added to BlocksCompleted
+    // Only the owner touches this
+    int64_t             PendingCompleted;
+
+    // SCHEDULE_STATIC: the range the owner claimed, only the owner touches these
+    // CursorTag is the JobTag they belong to, older jobs left stale values
+    int64_t             CursorTag;
+    int64_t             Cursor;
+    int64_t             CursorEnd;
+
+    // Set once the owner found no unclaimed range, from then on it takes tail blocks
+    int64_t             Claimed;
+
+    char                Padding[64 - 6 * sizeof(int64_t)];
+
+    static FORCE_INLINE int64_t Pack(int64_t tag, int64_t start, int64_t end) {
+        return ((tag & TAG_MASK) << (2 * BLOCK_BITS)) | ((start & BLOCK_MASK) << BLOCK_BITS) | (end & BLOCK_MASK);
+    }
+
+    static FORCE_INLINE int64_t Tag(int64_t range) { return (range >> (2 * BLOCK_BITS)) & TAG_MASK; }
+    static FORCE_INLINE int64_t Start(int64_t range) { return (range >> BLOCK_BITS) & BLOCK_MASK; }
+    static FORCE_INLINE int64_t End(int64_t range) { return range & BLOCK_MASK; }
+};
+
 //-----------------------------------------------------------
 //
 struct stMATH_WORKER_ITEM {
@@ -226,6 +359,9 @@ struct stMATH_WORKER_ITEM {
     // How many threads to wake up (atomic decrement)
     int64_t             ThreadWakeup;
 
+    // Tokens taken from the concurrency budget (g_Budget), given back by WorkWait
+    int64_t             BudgetTokens;
+
     // Used when calling MultiThreadedWork
     union {
         MTWORK_CALLBACK   MTWorkCallback;
@@ -256,6 +392,60 @@ struct stMATH_WORKER_ITEM {
 
     OLD_CALLBACK        OldCallback;
 
+    //-----------------------------------------------
+    // How blocks are handed out, see WORK_SCHEDULE
+    int32_t             Schedule;
+
+    // Lane of the job, see WORK_PRIORITY
+    int32_t             Priority;
+
+    // Number of entries in pStealRanges (one per thread, main thread is 0)
+    int32_t             StealRangeCount;
+
+    // Low bits of WorkIndex when published, stale ranges have a different tag
+    int64_t             JobTag;
+
+    stStealRange*       pStealRanges;
+
+    //-----------------------------------------------
+    // Set when this entry only forwards a work item published in the ring of another numa node
+    stMATH_WORKER_ITEM* pForward;
+
+    // Index of the numa node group whose ring holds the work item
+    int32_t             NumaNode;
+
+    // Producer slot of the work item, the same in every ring
+    int32_t             Slot;
+
+    // Bit per numa node group that will work on this item
+    uint64_t            NumaNodeMask;
+
+    // Bit per other numa node group with a forwarding entry for this item
+    uint64_t            ForwardedMask;
+
+    //-----------------------------------------------
+    // BlocksCompleted when the job is done (BlockLast or the length in custom mode)
+    int64_t             BlocksToComplete;
+
+    // Set by the main thread before it sleeps waiting for the job to complete
+    volatile int64_t    MainWaiting;
+
+    // Set to 1 by the thread that completes the last block (low 32 bits are a futex)
+    volatile int64_t    CompletionDone;
+
+    // Worker threads that may be looking at this work item
+    volatile int64_t    Users;
+
+    //-----------------------------------------------
+    // Counts the jobs started in this slot, see WorkStart
+    int64_t             Serial;
+
+    // Serial of the last job whose work item was given back (low 32 bits are a futex)
+    volatile int64_t    ReleasedSerial;
+
+    // Set for a job started with autoRelease: whichever thread sees the last block
+    // completed gives back the work item, see ClaimRelease
+    volatile int64_t    AutoRelease;
 
 
     //==============================================================
@@ -265,11 +455,44 @@ struct stMATH_WORKER_ITEM {
     }
 
     //==============================================================
-    FORCE_INLINE void CompleteWorkBlock() {
+    // core is -1 for the main thread
+    FORCE_INLINE void CompleteWorkBlock(int core) {
+        if (Schedule != SCHEDULE_RING) {
+            // Published in one add when the owner runs out of its range
+            pStealRanges[core + 1].PendingCompleted++;
+            return;
+        }
         // Indicate we completed a block
-        InterlockedIncrement64(&BlocksCompleted);
+        AddBlocksCompleted(1);
     }
 
+    //==============================================================
+    // The thread that completes the last block wakes the main thread if it is asleep
+    FORCE_INLINE void AddBlocksCompleted(int64_t count) {
+        if (InterlockedAdd64(&BlocksCompleted, count) == BlocksToComplete) {
+            WakeMain();
+        }
+    }
+
+    // Defined in threads.cpp
+    void WakeMain();
+
+    //==============================================================
+    // TRUE for the one thread that should give back an autoRelease work item
+    // Call after leaving DoWork, any thread may try once the job is complete
+    FORCE_INLINE BOOL ClaimRelease() {
+        return AutoRelease && BlocksCompleted >= BlocksToComplete &&
+            InterlockedCompareExchange64(&AutoRelease, 0, 1) == 1;
+    }
+
+    // Defined in threads.cpp
+    // Returns BlockLast when there is nothing left to steal
+    int64_t StealWorkBlock(int core);
+
+    // Defined in threads.cpp
+    // Returns BlockLast when every range is claimed and the tail is handed out
+    int64_t StaticWorkBlock(int core);
+
     //=============================================================
     // Called by routines that work by index 
     // returns 0 on failure
@@ -291,9 +514,16 @@ struct stMATH_WORKER_ITEM {
     // Called by routines that work on chunks/blocks of memory
     // returns 0 on failure
     // else returns length of workblock
-    FORCE_INLINE int64_t GetNextWorkBlock(int64_t* workBlock) {
+    FORCE_INLINE int64_t GetNextWorkBlock(int64_t* workBlock, int core) {
 
-        int64_t wBlock = *workBlock = GetWorkBlock();
+        // Latency jobs preempt bulk jobs at block granularity
+        if (g_LatencyJobs != 0 && core >= 0 && Priority == PRIORITY_BULK) {
+            ServiceLatencyWork(core);
+        }
+
+        int64_t wBlock = *workBlock =
+            Schedule == SCHEDULE_RING ? GetWorkBlock() :
+            Schedule == SCHEDULE_STEAL ? StealWorkBlock(core) : StaticWorkBlock(core);
 
         //THREADLOGGING("working on block %llu\n", wBlock);
 
@@ -305,13 +535,10 @@ struct stMATH_WORKER_ITEM {
             // Check if this is the last workblock
             if ((wBlock + 1) == BlockLast) {
 
-                // check if ends on perfect boundary
-                if ((TotalElements & WORK_ITEM_MASK) != 0) {
-
-                    // This is the last block and may have an odd number of data to process
-                    lenWorkBlock = TotalElements & WORK_ITEM_MASK;
-                    //THREADLOGGING("last workblock %llu  %llu  MASK  %llu\n", lenWorkBlock, TotalElements, WORK_ITEM_MASK);
-                }
+                // This is the last block and may have an odd number of data to process
+                // BlockSize is not always a power of 2 so do not mask
+                lenWorkBlock = TotalElements - (wBlock * BlockSize);
+                //THREADLOGGING("last workblock %llu  %llu  size  %llu\n", lenWorkBlock, TotalElements, BlockSize);
             }
             return lenWorkBlock;
         }
@@ -325,8 +552,9 @@ struct stMATH_WORKER_ITEM {
     // Returns FALSE if it did no work 
     // If core is -1, it is the main thread
     FORCE_INLINE int64_t DoWork(int core, int64_t workIndex) {
+        stMATH_WORKER_ITEM* pWorkItem = pForward ? pForward : this;
 
-        return DoWorkCallback(this, core, workIndex);
+        return pWorkItem->DoWorkCallback(pWorkItem, core, workIndex);
     }
 
 };
@@ -334,13 +562,29 @@ struct stMATH_WORKER_ITEM {
 
 //-----------------------------------------------------------
 // allocated on 64 byte alignment
+// Every thread that submits jobs (a producer) owns a work item slot while its job runs,
+// so several python threads can run threaded ufuncs at the same time
+// Workers service every slot that has a published work item
 struct stWorkerRing {
-    static const int64_t   RING_BUFFER_SIZE = 1024;
-    static const int64_t   RING_BUFFER_MASK = 1023;
+    // Most jobs in flight at the same time, one bit each in ActiveMask
+    static const int32_t   MAX_PRODUCERS = 64;
+
+    // For SCHEDULE_STEAL and SCHEDULE_STATIC each producer slot has a range per thread
+    // (main thread is 0), allocated by GetStealRanges the first time the slot needs them
+    static const int32_t   MAX_STEAL_RANGES = MAX_THREADS_ALLOWED + 1;
+    stStealRange*          pStealRanges[MAX_PRODUCERS];
+    int32_t                StealRangeCapacity[MAX_PRODUCERS];
 
+    // Incremented each time a work item is published, workers sleep on it
     volatile int64_t       WorkIndex;
     volatile int64_t       WorkIndexCompleted;
 
+    // Bit per producer slot with a published work item that is not complete
+    volatile int64_t       ActiveMask;
+
+    // The bits of ActiveMask for PRIORITY_LATENCY work items
+    volatile int64_t       LatencyMask;
+
     // incremented when worker thread start
     volatile int64_t       WorkThread;
     int32_t                Reserved32;
@@ -352,45 +596,211 @@ struct stWorkerRing {
     // Change this value to wake up less workers
     int32_t                FutexWakeCount;
 
-    stMATH_WORKER_ITEM   WorkerQueue[RING_BUFFER_SIZE];
+    // Set to 1 to double the pauses between checks while spinning
+    int32_t                SpinBackoff;
+
+    // How long idle workers spin on WorkIndex before they sleep, 0 to not spin
+    int64_t                SpinNanos;
+
+    // Worker threads sleeping in the kernel, no need to wake anyone when 0
+    volatile int64_t       Sleepers;
+
+    // How many times SetWorkItem did not call the kernel since nobody was asleep
+    volatile int64_t       WakesSkipped;
+
+    //-----------------------------------------------
+    // WAKE_TREE: leaders sleep on WorkIndex, the others on the Word of their group
+    // WAKE_TARGETED: every worker sleeps on its own Word
+    // set by CMathWorker::AssignWakeGroups
+    static const int32_t   MAX_WAKE_GROUPS = 64;
+
+    struct stWakeWord {
+        // Bumped by whoever wakes the threads sleeping on it
+        volatile int64_t   Word;
+
+        // Threads sleeping on Word in the kernel
+        volatile int64_t   Sleepers;
+
+        char               Padding[64 - 2 * sizeof(int64_t)];
+    };
+    stWakeWord             WakeGroups[MAX_WAKE_GROUPS];
+
+    // Indexed by the core of the worker
+    stWakeWord             WakeWords[MAX_THREADS_ALLOWED];
+
+    // WAKE_TARGETED: cores of the workers in the ring, in the order they are woken
+    int32_t                WakeOrder[MAX_THREADS_ALLOWED];
+    int32_t                WakeOrderCount;
+
+    // WAKE_FLAT, WAKE_TREE or WAKE_TARGETED
+    int32_t                WakeMode;
+
+    // Number of groups and most threads in a group
+    int32_t                WakeGroupCount;
+    int32_t                WakeGroupSize;
+
+    // How many followers each woken leader wakes, set for each work item
+    volatile int32_t       FollowerWake;
+
+    stMATH_WORKER_ITEM   WorkerQueue[MAX_PRODUCERS];
 
     void Init() {
         WorkIndex = 0;
         WorkIndexCompleted = 0;
+        ActiveMask = 0;
+        LatencyMask = 0;
         WorkThread = 0;
         NumaNode = 0;
         Cancelled = 0;
         SleepTime = 1;
         // how many threads to wake up on Linux
         FutexWakeCount = FUTEX_WAKE_DEFAULT;
+        SpinBackoff = 1;
+        SpinNanos = 0;
+        Sleepers = 0;
+        WakesSkipped = 0;
+        WakeMode = WAKE_FLAT;
+        WakeOrderCount = 0;
+        WakeGroupCount = 1;
+        WakeGroupSize = 1;
+        FollowerWake = 0;
+
+        for (int i = 0; i < MAX_WAKE_GROUPS; i++) {
+            WakeGroups[i].Word = 0;
+            WakeGroups[i].Sleepers = 0;
+        }
+        for (int i = 0; i < MAX_THREADS_ALLOWED; i++) {
+            WakeWords[i].Word = 0;
+            WakeWords[i].Sleepers = 0;
+        }
 
-        for (int i = 0; i < RING_BUFFER_SIZE; i++) {
+        for (int i = 0; i < MAX_PRODUCERS; i++) {
             WorkerQueue[i].BlockSize = 0;
             WorkerQueue[i].BlockLast = 0;
             WorkerQueue[i].TotalElements = 0;
             WorkerQueue[i].BlockNext = 0;
             WorkerQueue[i].BlocksCompleted = 0;
+            WorkerQueue[i].Schedule = SCHEDULE_RING;
+            WorkerQueue[i].Priority = PRIORITY_BULK;
+            WorkerQueue[i].StealRangeCount = 0;
+            WorkerQueue[i].JobTag = 0;
+            WorkerQueue[i].pStealRanges = NULL;
+            WorkerQueue[i].pForward = NULL;
+            WorkerQueue[i].NumaNode = 0;
+            WorkerQueue[i].Slot = i;
+            WorkerQueue[i].NumaNodeMask = 1;
+            WorkerQueue[i].ForwardedMask = 0;
+            WorkerQueue[i].BlocksToComplete = 0;
+            WorkerQueue[i].MainWaiting = 0;
+            WorkerQueue[i].CompletionDone = 0;
+            WorkerQueue[i].Users = 0;
+            WorkerQueue[i].Serial = 0;
+            WorkerQueue[i].ReleasedSerial = 0;
+            WorkerQueue[i].AutoRelease = 0;
+
+            pStealRanges[i] = NULL;
+            StealRangeCapacity[i] = 0;
+        }
+    }
+
+    //------------------------------------------------------------------------------
+    // Called by the producer that owns the slot, between its jobs no worker looks at the ranges
+    // Allocated again when the pool grew past the count it was allocated for
+    // Returns NULL if out of memory
+    stStealRange* GetStealRanges(int32_t slot, int32_t count) {
+        if (StealRangeCapacity[slot] < count) {
+            if (pStealRanges[slot]) ALIGNED_FREE(pStealRanges[slot]);
+            StealRangeCapacity[slot] = 0;
+
+            pStealRanges[slot] = (stStealRange*)ALIGNED_ALLOC(sizeof(stStealRange) * count, 64);
+            if (!pStealRanges[slot]) return NULL;
+            memset(pStealRanges[slot], 0, sizeof(stStealRange) * count);
+            StealRangeCapacity[slot] = count;
         }
+        return pStealRanges[slot];
+    }
 
+    void FreeStealRanges() {
+        for (int i = 0; i < MAX_PRODUCERS; i++) {
+            if (pStealRanges[i]) ALIGNED_FREE(pStealRanges[i]);
+            pStealRanges[i] = NULL;
+            StealRangeCapacity[i] = 0;
+        }
+    }
+
+    //------------------------------------------------------------------------------
+    // In a child process after fork: drops the jobs that were in flight in the parent
+    // The threads that ran them do not exist in the child
+    void ResetAfterFork() {
+        ActiveMask = 0;
+        LatencyMask = 0;
+        WorkThread = 0;
+        Sleepers = 0;
+        Cancelled = 0;
+
+        for (int i = 0; i < MAX_WAKE_GROUPS; i++) {
+            WakeGroups[i].Sleepers = 0;
+        }
+        for (int i = 0; i < MAX_THREADS_ALLOWED; i++) {
+            WakeWords[i].Sleepers = 0;
+        }
+        for (int i = 0; i < MAX_PRODUCERS; i++) {
+            WorkerQueue[i].Users = 0;
+            WorkerQueue[i].MainWaiting = 0;
+            WorkerQueue[i].Priority = PRIORITY_BULK;
+            WorkerQueue[i].BudgetTokens = 0;
+
+            // Nobody is left to complete them, waiters return
+            WorkerQueue[i].AutoRelease = 0;
+            WorkerQueue[i].ReleasedSerial = WorkerQueue[i].Serial;
+        }
     }
 
     FORCE_INLINE void Cancel() {
         Cancelled = 1;
+        WakeAll();
     }
 
-    FORCE_INLINE stMATH_WORKER_ITEM* GetWorkItem() {
-        return  &WorkerQueue[WorkIndex & RING_BUFFER_MASK];
+    //------------------------------------------------------------------------------
+    // Wakes every worker thread of the ring without publishing work
+    // Used so sleeping workers notice Cancelled or that they were asked to exit
+    void WakeAll() {
+        // A worker about to sleep sees a new WorkIndex and does not sleep
+        InterlockedIncrement64(&WorkIndex);
+
+#if defined(_WIN32)
+        if (g_WakeAllAddress != NULL) g_WakeAllAddress((PVOID)&WorkIndex);
+#elif defined(__linux__)
+        futex((int*)&WorkIndex, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+        for (int i = 0; i < MAX_WAKE_GROUPS; i++) {
+            InterlockedIncrement64(&WakeGroups[i].Word);
+            futex((int*)&WakeGroups[i].Word, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+        }
+        for (int i = 0; i < MAX_THREADS_ALLOWED; i++) {
+            InterlockedIncrement64(&WakeWords[i].Word);
+            futex((int*)&WakeWords[i].Word, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+        }
+#elif defined(__APPLE__)
+        pthread_cond_broadcast(&g_WakeupCond);
+#endif
     }
 
-    FORCE_INLINE stMATH_WORKER_ITEM* GetExistingWorkItem() {
-        return  &WorkerQueue[(WorkIndex - 1) & RING_BUFFER_MASK];
+    FORCE_INLINE stMATH_WORKER_ITEM* GetWorkItem(int32_t slot) {
+        return  &WorkerQueue[slot];
     }
 
-    FORCE_INLINE void SetWorkItem(int32_t maxThreadsToWake) {
+    FORCE_INLINE void SetWorkItem(int32_t slot, int32_t maxThreadsToWake, int32_t priority = PRIORITY_BULK) {
+        // The work item must be filled in before its bit is set
+        if (priority == PRIORITY_LATENCY) FMInterlockedOr(&LatencyMask, (int64_t)1 << slot);
+        FMInterlockedOr(&ActiveMask, (int64_t)1 << slot);
+
         // This routine will wakup threads on Windows and Linux
         // Once we increment other threads will notice
         InterlockedIncrement64(&WorkIndex);
 
+        // No budget left for workers, the producer does the job alone
+        if (maxThreadsToWake <= 0) return;
+
 #if defined(_WIN32)
         // Are we allowed to wake threads?
         if (g_WakeAllAddress != NULL) {
@@ -408,6 +818,28 @@ struct stWorkerRing {
         }
 
 #elif defined(__linux__)
+        if (WakeMode == WAKE_TARGETED) {
+            WakeTargeted(maxThreadsToWake);
+            return;
+        }
+
+        if (WakeMode == WAKE_TREE) {
+            // Wake enough leaders that they and their followers add up to maxThreadsToWake
+            int32_t leaders = (maxThreadsToWake + WakeGroupSize - 1) / WakeGroupSize;
+            if (leaders > WakeGroupCount) leaders = WakeGroupCount;
+            if (leaders < 1) leaders = 1;
+            FollowerWake = (maxThreadsToWake + leaders - 1) / leaders - 1;
+            maxThreadsToWake = leaders;
+        }
+
+        // Workers still spinning see the new WorkIndex without a syscall
+        // Both WorkIndex and Sleepers are changed with locked instructions so either
+        // we see the sleeper or its FUTEX_WAIT sees the new WorkIndex
+        if (Sleepers == 0) {
+            InterlockedIncrement64(&WakesSkipped);
+            return;
+        }
+
         // Linux thread wakeup
         int s = futex((int*)&WorkIndex, FUTEX_WAKE, maxThreadsToWake, NULL, NULL, 0);
         if (s == -1)
@@ -424,12 +856,119 @@ struct stWorkerRing {
 
     }
 
-    FORCE_INLINE void CompleteWorkItem() {
+    //------------------------------------------------------------------------------
+    // WAKE_TARGETED: wakes the first count workers of WakeOrder
+    // Awake workers see the new WorkIndex on their own and still count, the
+    // ThreadWakeup of the work item keeps any others from joining
+    void WakeTargeted(int32_t count) {
+        if (count > WakeOrderCount) count = WakeOrderCount;
+        for (int32_t i = 0; i < count; i++) {
+            stWakeWord* pWord = &WakeWords[WakeOrder[i]];
+            InterlockedIncrement64(&pWord->Word);
+#if defined(__linux__)
+            // Same handshake with the sleeper as the Sleepers count of the ring
+            if (pWord->Sleepers == 0) {
+                InterlockedIncrement64(&WakesSkipped);
+                continue;
+            }
+            futex((int*)&pWord->Word, FUTEX_WAKE, 1, NULL, NULL, 0);
+#endif
+        }
+    }
+
+    //------------------------------------------------------------------------------
+    // WAKE_TREE: called by a group leader that saw a new work item
+    FORCE_INLINE void WakeFollowers(int32_t group) {
+        int32_t count = FollowerWake;
+        if (count <= 0) return;
+
+        stWakeWord* pGroup = &WakeGroups[group];
+        InterlockedIncrement64(&pGroup->Word);
+#if defined(__linux__)
+        // Same handshake with the sleepers as SetWorkItem
+        if (pGroup->Sleepers == 0) return;
+        futex((int*)&pGroup->Word, FUTEX_WAKE, count, NULL, NULL, 0);
+#endif
+    }
+
+    //------------------------------------------------------------------------------
+    // Called by the producer once all blocks are complete
+    // Workers that saw the bit before it was cleared may still be inside DoWork,
+    // wait for them to leave so the slot can be filled in for the next job
+    FORCE_INLINE void CompleteWorkItem(int32_t slot) {
+        FMInterlockedAnd(&ActiveMask, ~((int64_t)1 << slot));
+        if (LatencyMask & ((int64_t)1 << slot)) FMInterlockedAnd(&LatencyMask, ~((int64_t)1 << slot));
         InterlockedIncrement64(&WorkIndexCompleted);
+
+        while (WorkerQueue[slot].Users != 0) {
+            YieldProcessor();
+        }
     }
 };
 
+//-----------------------------------------------------------
+// Counters kept by one worker thread, only that thread writes them
+// allocated on 64 byte alignment so workers do not share a cache line
+struct stWorkerStats {
+    // Blocks of work items completed
+    int64_t         BlocksCompleted;
+
+    // Work items the thread completed at least one block of
+    int64_t         JobsJoined;
+
+    // Time spent spinning or sleeping waiting for work
+    int64_t         IdleNanos;
+
+    // Time from waking up to starting on a work item, summed over WakeCount
+    int64_t         WakeNanos;
+
+    // Times the thread woke up and found work
+    int64_t         WakeCount;
+
+    // Times new work showed up while spinning, so no sleep was needed
+    int64_t         SpinWakes;
+
+    // Times the thread went to sleep waiting for work
+    int64_t         SleepWaits;
+
+    char            Padding[64 - 7 * sizeof(int64_t)];
+};
+
+//-----------------------------------------------------------
+// Passed to each worker thread when it starts
+struct stWorkerThread {
+    // The ring of the numa node group the thread belongs to
+    stWorkerRing*   pWorkerRing;
+
+    const stNumaTopology* pTopology;
+
+    // Unique across all groups, starts at 0
+    int32_t         Core;
+
+    // Index of the node in stNumaTopology, -1 to not pin
+    int32_t         NumaNode;
+
+    // Index of the numa node group (and ring) in CMathWorker
+    int32_t         Group;
+
+    // WAKE_TREE: group in the ring and whether we wake the others of the group
+    volatile int32_t WakeGroup;
+    volatile int32_t WakeLeader;
+
+    // Reset when the thread starts
+    stWorkerStats*  pStats;
+
+    // Set by the pool to ask the thread to return once it is between jobs
+    volatile int32_t ExitRequested;
+
+    // Set by the thread just before it returns
+    volatile int32_t Exited;
+};
+
 WakeSingleAddress InitWakeCalls();
+
+// Monotonic clock in nanoseconds, used to time spin loops
+int64_t GetMonotonicNanos();
 //DWORD WINAPI WorkerThreadFunction(LPVOID lpParam);
 
 //============================================================================================
@@ -487,7 +1026,19 @@ extern "C" {
 #endif
 };
 
-THANDLE StartThread(stWorkerRing* pWorkerRing);
+THANDLE StartThread(stWorkerThread* pWorkerThread);
+
+// Waits for a thread to return and frees its handle
+BOOL JoinThread(THANDLE hThread);
+
+// Handle to the calling thread that other threads can use
+THANDLE GetCurrentThreadHandle();
+
+// Restrict a thread to a list of cpus, returns FALSE if not changed
+BOOL PinThreadToCpus(THANDLE hThread, const int16_t* pCpus, int32_t count);
+
+// Fill in the cpus a thread may run on, returns how many, 0 if not known
+int32_t GetThreadCpus(THANDLE hThread, int16_t* pCpus, int32_t maxCpus);
 
 // Move to reduce
 #define MINF(x,y) x < y ? x : y
@@ -500,7 +1051,29 @@ public:
     static const int64_t WORK_ITEM_CHUNK = stMATH_WORKER_ITEM::WORK_ITEM_CHUNK;
     static const int64_t WORK_ITEM_BIG = stMATH_WORKER_ITEM::WORK_ITEM_BIG;
     static const int64_t WORK_ITEM_MASK = stMATH_WORKER_ITEM::WORK_ITEM_MASK;
-    static const int MAX_WORKER_HANDLES = 64;
+    static const int MAX_WORKER_HANDLES = MAX_THREADS_ALLOWED + 1;
+
+    // Threads in a wake group when the cpus sharing an L3 are not known
+    static const int32_t WAKE_GROUP_SIZE_DEFAULT = 8;
+
+    // Range of block sizes picked by GetBlockSize
+    static const int64_t MIN_BLOCK_SIZE = 0x400;
+    static const int64_t MAX_BLOCK_SIZE = 0x40000;
+
+    // Used when the L2 size cannot be read, gives 0x4000 elements for a float64 add
+    static const int64_t DEFAULT_L2_CACHE_SIZE = 512 * 1024;
+
+    // Bytes a worker thread should get from a memory bound op, see GetThreadCount
+    static const int64_t MEMORY_BYTES_PER_THREAD = 1024 * 1024;
+
+    // Memory bound ops do not get faster past this many threads on a numa node
+    static const int64_t MEMORY_THREADS_PER_NODE = 8;
+
+    // SCHEDULE_STATIC hands out this fraction of the blocks one at a time, see PreSplitWork
+    static const int64_t STATIC_TAIL_DIVISOR = 8;
+
+    // Jobs touching at most this many bytes go in the latency lane, see GetPriority
+    static const int64_t LATENCY_BYTES_DEFAULT = 1024 * 1024;
 
     int   WorkerThreadCount;
 
@@ -510,11 +1083,89 @@ public:
     // Set to true to stop allocating from a cache
     BOOL  NoCaching;
 
+    // How blocks are handed out to threads, see WORK_SCHEDULE
+    int32_t Schedule;
+
+    // Which numa node groups run a work item, see NUMA_POLICY
+    int32_t NumaPolicy;
+
+    // Number of numa node groups with worker threads (one ring each)
+    int32_t NumaNodeCount;
+
+    // How threads are pinned to cpus, see AFFINITY_POLICY
+    int32_t AffinityPolicy;
+
+    // How sleeping workers are woken, see WAKE_MODE
+    int32_t WakeMode;
+
+    // Size of the L2 cache per core used to pick the block size
+    int64_t L2CacheSize;
+
+    // Elements per block for every job, 0 to use GetBlockSize
+    int64_t BlockSizeOverride;
+
+    // Jobs touching at most this many bytes are PRIORITY_LATENCY, 0 to put every job in the bulk lane
+    int64_t LatencyBytes;
+
+    // How long the main thread spins waiting for a job before it sleeps
+    int64_t WaitSpinNanos;
+
+    // Main thread waits that finished while spinning and the time spent
+    // (summed over every thread submitting jobs)
+    volatile int64_t WaitSpinCount;
+    volatile int64_t WaitSpinNanosTotal;
+
+    // Main thread waits that had to sleep and the time spent asleep
+    volatile int64_t WaitBlockedCount;
+    volatile int64_t WaitBlockedNanosTotal;
+
+    // Bit per producer slot (see stWorkerRing) owned by a thread with a job in flight
+    volatile int64_t ProducerMask;
+
+    // Jobs run without threads since every producer slot was taken
+    volatile int64_t ProducerSlotsFull;
+
     //------------------------------------------------------------------------------
     // Data Members 
+    // Ring of the first numa node group, same as pWorkerRings[0]
     stWorkerRing*   pWorkerRing;
+    stWorkerRing*   pWorkerRings[MAX_NUMA_NODES];
+
+    // Kernel numa node for each group
+    int32_t         NumaNodeIds[MAX_NUMA_NODES];
+
+    // How many worker threads in each group
+    int32_t         NumaThreadCount[MAX_NUMA_NODES];
+
+    // Index in Topology of the node the workers of each group are pinned to, -1 to not pin
+    int32_t         NumaGroupPin[MAX_NUMA_NODES];
+
+    stNumaTopology  Topology;
+    stCpuTopology   CpuTopology;
+
+    // Quota and cpuset of the container we run in
+    stCgroupLimits  CgroupLimits;
+
+    // g_ForkGeneration the worker threads were started in
+    volatile int64_t ForkGeneration;
+    volatile int64_t ForkRebuilding;
+
+    // cpus given for AFFINITY_LIST
+    int32_t         AffinityListCount;
+    int16_t         AffinityList[MAX_WORKER_HANDLES + 1];
+
+    // cpu each thread was pinned to, main thread first, -1 when not pinned
+    int16_t         AffinityPinned[MAX_WORKER_HANDLES + 1];
+
+    // cpus the calling thread had before SetAffinity pinned it, given back by AFFINITY_NONE
+    int32_t         CallerCpuCount;
+    int16_t         CallerCpus[MAX_TOPOLOGY_CPUS];
 
     THANDLE         WorkerThreadHandles[MAX_WORKER_HANDLES];
+    stWorkerThread  WorkerThreads[MAX_WORKER_HANDLES];
+
+    // One per worker thread, see thread_info
+    stWorkerStats*  pWorkerStats;
     char            CPUString[512];
     //------------------------------------------------------------------------------
     // Data Members 
@@ -525,26 +1176,87 @@ public:
         WorkerThreadCount = GetProcCount();
         NoThreading = FALSE;
         NoCaching = FALSE;
+        Schedule = SCHEDULE_RING;
+        NumaPolicy = NUMA_LOCAL;
+        NumaNodeCount = 1;
+        AffinityPolicy = AFFINITY_NONE;
+        WakeMode = WAKE_AUTO;
+        L2CacheSize = ReadL2CacheSize();
+        if (L2CacheSize <= 0) L2CacheSize = DEFAULT_L2_CACHE_SIZE;
+        BlockSizeOverride = 0;
+        LatencyBytes = LATENCY_BYTES_DEFAULT;
+        WaitSpinNanos = 50000;
+        WaitSpinCount = 0;
+        WaitSpinNanosTotal = 0;
+        WaitBlockedCount = 0;
+        WaitBlockedNanosTotal = 0;
+        ProducerMask = 0;
+        ProducerSlotsFull = 0;
+        AffinityListCount = 0;
+        CallerCpuCount = 0;
+        ForkGeneration = g_ForkGeneration;
+        ForkRebuilding = 0;
+
+        ReadNumaTopology(&Topology);
+        ReadCpuTopology(&CpuTopology, &Topology);
+
+        // In a container the cpu quota, not the cpus we can see, says how many threads can run
+        ReadCgroupLimits(&CgroupLimits);
+        WorkerThreadCount = GetUsableCpuCount(&CgroupLimits, WorkerThreadCount);
+
+        for (int i = 0; i <= MAX_WORKER_HANDLES; i++) {
+            AffinityPinned[i] = -1;
+        }
 
         pWorkerRing = (stWorkerRing*)ALIGNED_ALLOC(sizeof(stWorkerRing), 64);
         if (pWorkerRing) {
             pWorkerRing->WorkIndex = 0;
             pWorkerRing->Init();
+
+            // No point waking more threads than can run at once
+            if (WorkerThreadCount < pWorkerRing->FutexWakeCount) pWorkerRing->FutexWakeCount = WorkerThreadCount;
         }
 
-        for (int i = 0; i < WorkerThreadCount; i++) {
+        for (int i = 0; i < MAX_NUMA_NODES; i++) {
+            pWorkerRings[i] = NULL;
+            NumaNodeIds[i] = 0;
+            NumaThreadCount[i] = 0;
+            NumaGroupPin[i] = -1;
+        }
+        pWorkerRings[0] = pWorkerRing;
+        NumaThreadCount[0] = WorkerThreadCount;
+
+        pWorkerStats = (stWorkerStats*)ALIGNED_ALLOC(sizeof(stWorkerStats) * MAX_WORKER_HANDLES, 64);
+        if (pWorkerStats) memset(pWorkerStats, 0, sizeof(stWorkerStats) * MAX_WORKER_HANDLES);
+
+        for (int i = 0; i < MAX_WORKER_HANDLES; i++) {
 
             WorkerThreadHandles[i] = 0;
+            WorkerThreads[i].pStats = &pWorkerStats[i];
+            WorkerThreads[i].ExitRequested = 0;
+            WorkerThreads[i].Exited = 0;
         }
 
     };
 
     ~CMathWorker() {
-        if (pWorkerRing) pWorkerRing->Cancel();
-        Sleep(100);
+        for (int i = 0; i < NumaNodeCount; i++) {
+            if (pWorkerRings[i]) pWorkerRings[i]->Cancel();
+        }
         KillWorkerThreads();
-        // DO NOT DEALLOCATE DO TO threads not exiting 
-        //ALIGNED_FREE(pWorkerRing);
+
+        // Every worker has returned so nothing looks at the rings any more
+        for (int i = 0; i < MAX_NUMA_NODES; i++) {
+            if (pWorkerRings[i]) {
+                pWorkerRings[i]->FreeStealRanges();
+                ALIGNED_FREE(pWorkerRings[i]);
+            }
+            pWorkerRings[i] = NULL;
+        }
+        pWorkerRing = NULL;
+
+        if (pWorkerStats) ALIGNED_FREE(pWorkerStats);
+        pWorkerStats = NULL;
     };
 
     //------------------------------------------------------------------------------
@@ -569,7 +1281,9 @@ public:
 
         int previousVal = pWorkerRing->FutexWakeCount;
 
-        pWorkerRing->FutexWakeCount = howManyToWake;
+        for (int i = 0; i < NumaNodeCount; i++) {
+            pWorkerRings[i]->FutexWakeCount = howManyToWake;
+        }
         return previousVal;
     }
 
@@ -577,30 +1291,466 @@ public:
         return pWorkerRing->FutexWakeCount;
     }
 
+    //---------------------------------
+    // Changes how long idle workers spin before they sleep, returns previous value
+    int64_t SetSpin(int64_t spinNanos, int32_t backoff) {
+        int64_t previousVal = pWorkerRing->SpinNanos;
+        if (spinNanos < 0) spinNanos = 0;
+
+        for (int i = 0; i < NumaNodeCount; i++) {
+            pWorkerRings[i]->SpinNanos = spinNanos;
+            pWorkerRings[i]->SpinBackoff = backoff;
+        }
+        return previousVal;
+    }
+
+    //---------------------------------
+    // Changes how blocks are handed out, returns previous value
+    int32_t SetSchedule(int32_t schedule) {
+        int32_t previousVal = Schedule;
+        if (schedule >= 0 && schedule < SCHEDULE_LAST) {
+            Schedule = schedule;
+        }
+        return previousVal;
+    }
+
+    //---------------------------------
+    // Changes which numa node groups run a work item, returns previous value
+    int32_t SetNumaPolicy(int32_t policy) {
+        int32_t previousVal = NumaPolicy;
+        if (policy >= 0 && policy < NUMA_LAST) {
+            NumaPolicy = policy;
+        }
+        return previousVal;
+    }
+
     //------------------------------------------------------------------------------
-    // 
+    // numaNode -1 makes one group of worker threads per numa node
+    // otherwise all worker threads run on the given node
     void StartWorkerThreads(int numaNode) {
+        int32_t nodes[MAX_NUMA_NODES];
+        int32_t nodeCount = 0;
+
+        if (numaNode >= 0 && numaNode < Topology.NodeCount) {
+            nodes[nodeCount++] = numaNode;
+        }
+        else {
+            for (int32_t i = 0; i < Topology.NodeCount; i++) {
+                nodes[nodeCount++] = i;
+            }
+        }
+
+        // Every group needs at least one worker thread
+        if (nodeCount > WorkerThreadCount && WorkerThreadCount > 0) nodeCount = WorkerThreadCount;
+
+        // And a ring of its own, group 0 has the one made in the constructor
+        // Without memory for a ring the groups from there on are dropped, their threads go to the others
+        for (int32_t g = 1; g < nodeCount; g++) {
+            if (!pWorkerRings[g]) {
+                stWorkerRing* pRing = (stWorkerRing*)ALIGNED_ALLOC(sizeof(stWorkerRing), 64);
+                if (!pRing) {
+                    nodeCount = g;
+                    break;
+                }
+                pRing->Init();
+                pRing->FutexWakeCount = pWorkerRing->FutexWakeCount;
+                pRing->SpinNanos = pWorkerRing->SpinNanos;
+                pRing->SpinBackoff = pWorkerRing->SpinBackoff;
+                pWorkerRings[g] = pRing;
+            }
+        }
+
+        // Split the worker threads by how many cpus each node has
+        int32_t totalCpus = 0;
+        for (int32_t g = 0; g < nodeCount; g++) {
+            totalCpus += Topology.CpuCount[nodes[g]];
+        }
+
+        int32_t assigned = 0;
+        for (int32_t g = 0; g < nodeCount; g++) {
+            int32_t count = WorkerThreadCount - assigned;
+            if (g < nodeCount - 1) {
+                count = totalCpus ? (WorkerThreadCount * Topology.CpuCount[nodes[g]]) / totalCpus : WorkerThreadCount / nodeCount;
+                if (count < 1) count = 1;
+                if (count > WorkerThreadCount - assigned) count = WorkerThreadCount - assigned;
+            }
+            NumaThreadCount[g] = count;
+            NumaNodeIds[g] = Topology.NodeId[nodes[g]];
+            assigned += count;
+
+            // Only pin to a node when there is more than one or we were asked to
+            NumaGroupPin[g] = (Topology.NodeCount > 1 || numaNode >= 0) ? nodes[g] : -1;
+
+            pWorkerRings[g]->NumaNode = NumaNodeIds[g];
+        }
+        NumaNodeCount = nodeCount;
 
         MATHLOGGING("Start worker threads\n");
+        int32_t group = 0;
+        int32_t groupEnd = NumaThreadCount[0];
         for (int i = 0; i < WorkerThreadCount; i++) {
+            while (i >= groupEnd && group < NumaNodeCount - 1) {
+                group++;
+                groupEnd += NumaThreadCount[group];
+            }
+
+            StartWorkerThread(i, group);
+        }
+
+        // Only the workers, the calling thread was pinned (if at all) by thread_setaffinity
+        if (AffinityPolicy != AFFINITY_NONE) {
+            SetAffinity(AffinityPolicy, AffinityList, AffinityListCount, FALSE);
+        }
+        else {
+            AssignWakeGroups();
+        }
+    }
+
+    //------------------------------------------------------------------------------
+    // Pins all worker threads to cpus, and the calling (main) thread when pinCaller is set
+    // For AFFINITY_LIST pCpus has the cpu for the main thread first, then one per worker
+    // The main thread cpu is kept free of workers even when the caller is not pinned
+    // If there are fewer cpus than threads the list wraps around
+    // With more than one numa node group workers only get cpus from their own node
+    // Returns FALSE if the policy cannot be used on this machine
+    BOOL SetAffinity(int32_t policy, const int16_t* pCpus, int32_t count, BOOL pinCaller) {
+        int16_t order[MAX_TOPOLOGY_CPUS];
+        int32_t orderCount = 0;
+
+        CheckFork();
+
+        if (policy < 0 || policy >= AFFINITY_LAST) return FALSE;
+
+        if (policy == AFFINITY_LIST) {
+            if (count <= 0) return FALSE;
+            if (count > MAX_WORKER_HANDLES + 1) count = MAX_WORKER_HANDLES + 1;
+            for (int32_t i = 0; i < count; i++) {
+                if (pCpus[i] < 0 || pCpus[i] >= MAX_TOPOLOGY_CPUS) return FALSE;
+                order[i] = pCpus[i];
+                AffinityList[i] = pCpus[i];
+            }
+            AffinityListCount = count;
+            orderCount = count;
+        }
+        else if (policy != AFFINITY_NONE) {
+            orderCount = OrderCpus(&CpuTopology, policy, order, MAX_TOPOLOGY_CPUS);
+            if (orderCount == 0) return FALSE;
+        }
+
+        AffinityPolicy = policy;
+
+        if (policy == AFFINITY_NONE) {
+            // Let every thread float again, workers stay on their numa node
+            for (int32_t i = 0; i < CpuTopology.CpuCount; i++) {
+                order[i] = CpuTopology.Cpu[i];
+            }
+            if (pinCaller && AffinityPinned[0] >= 0) {
+                if (CallerCpuCount > 0) {
+                    PinThreadToCpus(GetCurrentThreadHandle(), CallerCpus, CallerCpuCount);
+                }
+                else {
+                    PinThreadToCpus(GetCurrentThreadHandle(), order, CpuTopology.CpuCount);
+                }
+                AffinityPinned[0] = -1;
+                CallerCpuCount = 0;
+            }
+
+            for (int32_t i = 0; i < WorkerThreadCount; i++) {
+                int32_t node = WorkerThreads[i].NumaNode;
+                if (node >= 0) {
+                    PinThreadToCpus(WorkerThreadHandles[i], Topology.Cpus[node], Topology.CpuCount[node]);
+                }
+                else {
+                    PinThreadToCpus(WorkerThreadHandles[i], order, CpuTopology.CpuCount);
+                }
+                AffinityPinned[i + 1] = -1;
+            }
+            AssignWakeGroups();
+            return TRUE;
+        }
 
-            WorkerThreadHandles[i] = StartThread(pWorkerRing);
+        // The main thread takes the first cpu
+        if (pinCaller) {
+            if (AffinityPinned[0] < 0) {
+                CallerCpuCount = GetThreadCpus(GetCurrentThreadHandle(), CallerCpus, MAX_TOPOLOGY_CPUS);
+            }
+            PinThreadToCpus(GetCurrentThreadHandle(), order, 1);
+            AffinityPinned[0] = order[0];
         }
 
-        // Pin the main thread to a numa node?
-        // TODO: work
-        //uint64_t mask = ((uint64_t)1 << WorkerThreadCount);//core number starts from 0
-        // uint64_t ret = SetThreadAffinityMask(GetCurrentThread(), (uint64_t)0xFFFF);
-        // SetThreadAffinityMask(GetCurrentThread(), (uint64_t)0xFFFFFFFF);
+        for (int32_t g = 0; g < NumaNodeCount; g++) {
+            int16_t groupOrder[MAX_TOPOLOGY_CPUS];
+            int32_t groupCount = 0;
+            int32_t nodeIndex = -1;
+
+            // Find the cpus in the order that are on the node of this group
+            for (int32_t n = 0; n < Topology.NodeCount; n++) {
+                if (Topology.NodeId[n] == NumaNodeIds[g]) nodeIndex = n;
+            }
+
+            if (NumaNodeCount > 1 && nodeIndex >= 0) {
+                for (int32_t i = 0; i < orderCount; i++) {
+                    for (int32_t j = 0; j < Topology.CpuCount[nodeIndex]; j++) {
+                        if (Topology.Cpus[nodeIndex][j] == order[i]) {
+                            groupOrder[groupCount++] = order[i];
+                            break;
+                        }
+                    }
+                }
+            }
+
+            // No cpus of the order on this node (or one group), use them all
+            if (groupCount == 0) {
+                for (int32_t i = 0; i < orderCount; i++) {
+                    groupOrder[groupCount++] = order[i];
+                }
+            }
 
+            // Leave the cpu of the main thread alone unless it is the only one
+            int32_t kept = 0;
+            for (int32_t i = 0; i < groupCount; i++) {
+                if (groupOrder[i] != order[0]) groupOrder[kept++] = groupOrder[i];
+            }
+            if (kept > 0) {
+                groupCount = kept;
+            }
+            else {
+                groupOrder[0] = order[0];
+                groupCount = 1;
+            }
+
+            int32_t next = 0;
+            for (int32_t i = 0; i < WorkerThreadCount; i++) {
+                if (WorkerThreads[i].Group != g) continue;
+
+                int16_t cpu = groupOrder[next++ % groupCount];
+                PinThreadToCpus(WorkerThreadHandles[i], &cpu, 1);
+                AffinityPinned[i + 1] = cpu;
+            }
+        }
+        AssignWakeGroups();
+        return TRUE;
     }
 
     //------------------------------------------------------------------------------
-    // 
-    void KillWorkerThreads() {
-        for (int i = 0; i < WorkerThreadCount; i++) {
-            CloseHandle(WorkerThreadHandles[i]);
+    // Lowest cpu sharing an L3 with the cpu worker thread i is pinned to, -1 if not known
+    int32_t GetWorkerCache(int32_t i) {
+        int32_t cpu = AffinityPinned[i + 1];
+        if (cpu < 0) return -1;
+        for (int32_t c = 0; c < CpuTopology.CpuCount; c++) {
+            if (CpuTopology.Cpu[c] == cpu) return CpuTopology.Cache[c];
+        }
+        return -1;
+    }
+
+    //------------------------------------------------------------------------------
+    // Threads in a wake group: the cpus sharing an L3 with the first cpu
+    int32_t GetWakeGroupSize() {
+        int32_t size = 0;
+        if (CpuTopology.CpuCount > 0 && CpuTopology.Cache[0] >= 0) {
+            for (int32_t c = 0; c < CpuTopology.CpuCount; c++) {
+                if (CpuTopology.Cache[c] == CpuTopology.Cache[0]) size++;
+            }
         }
+        return size > 1 ? size : WAKE_GROUP_SIZE_DEFAULT;
+    }
+
+    //------------------------------------------------------------------------------
+    // Splits the workers of each ring into wake groups and picks the leaders
+    // Pinned workers are grouped by the L3 of their cpu, the others by GetWakeGroupSize
+    // Called whenever the threads or their pinning change
+    void AssignWakeGroups() {
+        int32_t size = GetWakeGroupSize();
+
+        for (int32_t g = 0; g < NumaNodeCount; g++) {
+            stWorkerRing* pRing = pWorkerRings[g];
+            int32_t groups = 0;
+            int32_t inGroup = 0;
+            int32_t largest = 1;
+            int32_t lastCache = -1;
+            int32_t ringThreads = 0;
+
+            for (int32_t i = 0; i < WorkerThreadCount; i++) {
+                stWorkerThread* pWorkerThread = &WorkerThreads[i];
+                if (pWorkerThread->Group != g) continue;
+                pRing->WakeOrder[ringThreads++] = i;
+
+                int32_t cache = GetWorkerCache(i);
+                BOOL newGroup = groups == 0 || inGroup >= size || (cache >= 0 && cache != lastCache);
+                if (newGroup && groups < stWorkerRing::MAX_WAKE_GROUPS) {
+                    groups++;
+                    inGroup = 0;
+                }
+                inGroup++;
+                if (inGroup > largest) largest = inGroup;
+                lastCache = cache;
+
+                pWorkerThread->WakeGroup = groups - 1;
+                pWorkerThread->WakeLeader = inGroup == 1;
+            }
+
+            pRing->WakeOrderCount = ringThreads;
+            pRing->WakeGroupCount = groups > 0 ? groups : 1;
+            pRing->WakeGroupSize = largest;
+#if defined(__linux__)
+            int32_t mode = WakeMode;
+            if (mode == WAKE_AUTO) mode = ringThreads > WAKE_TREE_THRESHOLD ? WAKE_TREE : WAKE_FLAT;
+            pRing->WakeMode = mode;
+#else
+            pRing->WakeMode = WAKE_FLAT;
+#endif
+            // Workers asleep on the word of their old group look again
+            pRing->WakeAll();
+        }
+    }
+
+    //------------------------------------------------------------------------------
+    // Returns previous mode
+    int32_t SetWakeMode(int32_t mode) {
+        int32_t previousVal = WakeMode;
+        if (mode >= 0 && mode < WAKE_LAST) {
+            WakeMode = mode;
+            AssignWakeGroups();
+        }
+        return previousVal;
+    }
+
+    //------------------------------------------------------------------------------
+    // Starts worker thread i in a numa node group
+    void StartWorkerThread(int32_t i, int32_t group) {
+        stWorkerThread* pWorkerThread = &WorkerThreads[i];
+        pWorkerThread->pWorkerRing = pWorkerRings[group];
+        pWorkerThread->pTopology = &Topology;
+        pWorkerThread->Core = i;
+        pWorkerThread->NumaNode = NumaGroupPin[group];
+        pWorkerThread->Group = group;
+        // Until AssignWakeGroups runs, sleep on WorkIndex as with WAKE_FLAT
+        pWorkerThread->WakeGroup = 0;
+        pWorkerThread->WakeLeader = TRUE;
+        memset(pWorkerThread->pStats, 0, sizeof(stWorkerStats));
+        pWorkerThread->ExitRequested = 0;
+        pWorkerThread->Exited = 0;
+
+        WorkerThreadHandles[i] = StartThread(pWorkerThread);
+    }
+
+    //------------------------------------------------------------------------------
+    // Called before anything that needs the worker threads to exist
+    FORCE_INLINE void CheckFork() {
+        if (ForkGeneration != g_ForkGeneration) RebuildAfterFork();
+    }
+
+    //------------------------------------------------------------------------------
+    // In a child process after fork only the thread that called fork is left, the rings
+    // still hold the jobs the parent had in flight and the thread handles are stale
+    // Drops the jobs and starts the same worker threads again
+    void RebuildAfterFork() {
+        int64_t generation = g_ForkGeneration;
+        if (InterlockedCompareExchange64(&ForkRebuilding, 1, 0) != 0) {
+            // Another thread of the child got here first
+            while (ForkGeneration < generation) YieldProcessor();
+            return;
+        }
+
+        if (ForkGeneration < generation) {
+            ProducerMask = 0;
+            g_LatencyJobs = 0;
+            // Tokens of the jobs are gone, reservations of the forking thread are still held
+            g_Budget.InUse = g_Budget.Reserved;
+
+            for (int32_t g = 0; g < NumaNodeCount; g++) {
+                pWorkerRings[g]->ResetAfterFork();
+            }
+            for (int32_t i = 0; i < WorkerThreadCount; i++) {
+                StartWorkerThread(i, WorkerThreads[i].Group);
+            }
+
+            // Before SetAffinity which checks again
+            ForkGeneration = generation;
+            if (AffinityPolicy != AFFINITY_NONE) {
+                SetAffinity(AffinityPolicy, AffinityList, AffinityListCount, FALSE);
+            }
+            else {
+                AssignWakeGroups();
+            }
+        }
+        ForkRebuilding = 0;
+    }
+
+    //------------------------------------------------------------------------------
+    // Stops the worker threads from the last one down until count are left
+    // Each thread finishes the job it is on, then returns. Returns once all have.
+    void StopWorkerThreads(int32_t count) {
+        CheckFork();
+        int32_t oldCount = WorkerThreadCount;
+        if (count < 0) count = 0;
+        if (count >= oldCount) return;
+
+        // New jobs stop counting on the threads going away
+        WorkerThreadCount = count;
+
+        for (int32_t i = count; i < oldCount; i++) {
+            WorkerThreads[i].ExitRequested = 1;
+        }
+        for (int32_t g = 0; g < NumaNodeCount; g++) {
+            pWorkerRings[g]->WakeAll();
+        }
+
+        for (int32_t i = count; i < oldCount; i++) {
+            JoinThread(WorkerThreadHandles[i]);
+            WorkerThreadHandles[i] = 0;
+            NumaThreadCount[WorkerThreads[i].Group]--;
+            AffinityPinned[i + 1] = -1;
+        }
+    }
+
+    //------------------------------------------------------------------------------
+    // Grows or shrinks the pool of worker threads, returns previous count
+    // New threads go to the numa node group with the fewest threads for its cpus
+    // Shrinking stops the threads started last
+    int32_t SetWorkerThreadCount(int32_t count) {
+        CheckFork();
+        int32_t previousVal = WorkerThreadCount;
+        if (count < 0) count = 0;
+        if (count > MAX_THREADS_ALLOWED) count = MAX_THREADS_ALLOWED;
+
+        if (count < previousVal) {
+            StopWorkerThreads(count);
+            AssignWakeGroups();
+            return previousVal;
+        }
+
+        for (int32_t i = previousVal; i < count; i++) {
+            int32_t group = 0;
+            int64_t best = -1;
+            for (int32_t g = 0; g < NumaNodeCount; g++) {
+                int32_t node = NumaGroupPin[g];
+                int64_t cpus = node >= 0 && Topology.CpuCount[node] > 0 ? Topology.CpuCount[node] : 1;
+
+                // lowest threads per cpu, compared without dividing
+                if (best < 0 || (int64_t)NumaThreadCount[g] * best < (int64_t)NumaThreadCount[group] * cpus) {
+                    group = g;
+                    best = cpus;
+                }
+            }
+            NumaThreadCount[group]++;
+            StartWorkerThread(i, group);
+            WorkerThreadCount = i + 1;
+        }
+
+        if (count > previousVal && AffinityPolicy != AFFINITY_NONE) {
+            SetAffinity(AffinityPolicy, AffinityList, AffinityListCount, FALSE);
+        }
+        else {
+            AssignWakeGroups();
+        }
+        return previousVal;
+    }
+
+    //------------------------------------------------------------------------------
+    // Stops and joins every worker thread
+    void KillWorkerThreads() {
+        StopWorkerThreads(0);
     }
 
 
@@ -608,8 +1758,6 @@ public:
     //------------------------------------------------------------------------------
     //  Concurrent callback from multiple threads
     static int64_t MultiThreadedCounterCallback(struct stMATH_WORKER_ITEM* pstWorkerItem, int core, int64_t workIndex) {
-        // -1 is the first core
-        core = core + 1;
         int64_t didSomeWork = 0;
 
         int64_t index;
@@ -620,11 +1768,12 @@ public:
             // First index is 1 so we subtract
             index--;
 
-            pstWorkerItem->MTWorkCallback(pstWorkerItem->WorkCallbackArg, core, index);
+            // -1 is the first core
+            pstWorkerItem->MTWorkCallback(pstWorkerItem->WorkCallbackArg, core + 1, index);
 
             didSomeWork++;
             // tell others we completed this work block
-            pstWorkerItem->CompleteWorkBlock();
+            pstWorkerItem->CompleteWorkBlock(core);
 
         }
         return didSomeWork;
@@ -668,22 +1817,21 @@ public:
     // callback sig: typedef BOOL(*MTCHUNK_CALLBACK)(void* callbackArg, int core, int64_t start, int64_t length);
 
     static int64_t MultiThreadedChunkCallback(struct stMATH_WORKER_ITEM* pstWorkerItem, int core, int64_t workIndex) {
-        // -1 is the first core
-        core = core + 1;
         int64_t didSomeWork = 0;
 
         int64_t lenX;
         int64_t workBlock;
 
         // As long as there is work to do
-        while ((lenX = pstWorkerItem->GetNextWorkBlock(&workBlock)) > 0) {
+        while ((lenX = pstWorkerItem->GetNextWorkBlock(&workBlock, core)) > 0) {
             int64_t start = pstWorkerItem->BlockSize * workBlock;
 
-            pstWorkerItem->MTChunkCallback(pstWorkerItem->WorkCallbackArg, core, start, lenX);
+            // -1 is the first core
+            pstWorkerItem->MTChunkCallback(pstWorkerItem->WorkCallbackArg, core + 1, start, lenX);
 
             didSomeWork++;
             // tell others we completed this work block
-            pstWorkerItem->CompleteWorkBlock();
+            pstWorkerItem->CompleteWorkBlock(core);
         }
 
         return didSomeWork;
@@ -719,6 +1867,28 @@ public:
     }
 
 
+    //------------------------------------------------------------------------------
+    // Takes a free producer slot for the calling thread until its job completes
+    // Returns -1 when every slot is taken, the caller then runs the job itself
+    int32_t ClaimProducer() {
+        CheckFork();
+        while (true) {
+            int64_t mask = ProducerMask;
+            if (mask == -1) {
+                InterlockedIncrement64(&ProducerSlotsFull);
+                return -1;
+            }
+            int32_t slot = (int32_t)tzcnt_64((uint64_t)~mask);
+            if (InterlockedCompareExchange64(&ProducerMask, mask | ((int64_t)1 << slot), mask) == mask) {
+                return slot;
+            }
+        }
+    }
+
+    FORCE_INLINE void ReleaseProducer(int32_t slot) {
+        FMInterlockedAnd(&ProducerMask, ~((int64_t)1 << slot));
+    }
+
     //------------------------------------------------------------------------------
     // Returns NULL if work item is too small or threading turned off
     // Otherwise returns a work item
@@ -728,8 +1898,15 @@ public:
             return NULL;
         }
 
-        // Otherwise allow parallel processing
-        stMATH_WORKER_ITEM* pWorkItem = pWorkerRing->GetWorkItem();
+        int32_t slot = ClaimProducer();
+        if (slot < 0) {
+            return NULL;
+        }
+
+        // Otherwise allow parallel processing on all nodes
+        stMATH_WORKER_ITEM* pWorkItem = pWorkerRing->GetWorkItem(slot);
+        pWorkItem->NumaNode = 0;
+        pWorkItem->NumaNodeMask = ((uint64_t)1 << NumaNodeCount) - 1;
         return pWorkItem;
     }
 
@@ -737,17 +1914,277 @@ public:
     //------------------------------------------------------------------------------
     // Returns NULL if work item is too small or threading turned off
     // Otherwise returns a work item
-    inline stMATH_WORKER_ITEM* GetWorkItem(int64_t len) {
+    // pData and stride (optional) describe the main input and are used to pick a numa node
+    // minElements is the smallest len worth threading (the ufuncs calibrate their own)
+    inline stMATH_WORKER_ITEM* GetWorkItem(int64_t len, const char* pData = NULL, int64_t stride = 0, int64_t minElements = WORK_ITEM_BIG) {
         // If it is a small work item, process it immediately
-        if (len < WORK_ITEM_BIG || NoThreading) {
+        if (len < minElements || NoThreading) {
             return NULL;
         }
 
+        int32_t slot = ClaimProducer();
+        if (slot < 0) {
+            return NULL;
+        }
+
+        if (NumaNodeCount > 1) {
+            return GetWorkItemNuma(slot, len, pData, stride);
+        }
+
         // Otherwise allow parallel processing
-        stMATH_WORKER_ITEM* pWorkItem = pWorkerRing->GetWorkItem();
+        stMATH_WORKER_ITEM* pWorkItem = pWorkerRing->GetWorkItem(slot);
+        pWorkItem->NumaNode = 0;
+        pWorkItem->NumaNodeMask = 1;
+        return pWorkItem;
+    }
+
+    //------------------------------------------------------------------------------
+    // Route the work item to the group of the node that owns the first and last page
+    // If they live on different nodes (or are not faulted in) all groups work on it
+    stMATH_WORKER_ITEM* GetWorkItemNuma(int32_t slot, int64_t len, const char* pData, int64_t stride) {
+        const uint64_t allNodes = ((uint64_t)1 << NumaNodeCount) - 1;
+        int32_t home = -1;
+        uint64_t mask = allNodes;
+
+        int32_t first = GetMemoryNode(&Topology, pData);
+        if (NumaPolicy == NUMA_LOCAL && first >= 0) {
+            int32_t last = stride ? GetMemoryNode(&Topology, pData + (len - 1) * stride) : first;
+            if (first == last) {
+                mask = 0;
+            }
+        }
+
+        // Map the topology node to our group
+        for (int32_t g = 0; g < NumaNodeCount; g++) {
+            if (first >= 0 && NumaNodeIds[g] == Topology.NodeId[first]) home = g;
+        }
+
+        if (home < 0) {
+            home = 0;
+            mask = allNodes;
+        }
+        else if (mask == 0) {
+            mask = (uint64_t)1 << home;
+        }
+
+        stMATH_WORKER_ITEM* pWorkItem = pWorkerRings[home]->GetWorkItem(slot);
+        pWorkItem->NumaNode = home;
+        pWorkItem->NumaNodeMask = mask;
         return pWorkItem;
     }
 
+    //------------------------------------------------------------------------------
+    // Called from main thread before the work item is published
+    // Gives the main thread and the threads likely to wake up an equal range of blocks
+    // SCHEDULE_STATIC keeps the last 1/STATIC_TAIL_DIVISOR of the blocks (the tail) out of
+    // the ranges, they are handed out from BlockNext to even out threads that finish late
+    // Stays on SCHEDULE_RING if the ranges cannot be allocated
+    void PreSplitWork(stMATH_WORKER_ITEM* pWorkItem, stWorkerRing* pHomeRing, int64_t participants, int32_t schedule) {
+        // Only older jobs in the same slot could have left ranges behind
+        const int64_t tag = pWorkItem->JobTag + 1;
+        const int64_t blockLast = pWorkItem->BlockLast;
+        int32_t rangeCount = WorkerThreadCount + 1;
+        if (rangeCount > stWorkerRing::MAX_STEAL_RANGES) rangeCount = stWorkerRing::MAX_STEAL_RANGES;
+
+        stStealRange* pStealRanges = pHomeRing->GetStealRanges(pWorkItem->Slot, rangeCount);
+        if (!pStealRanges) return;
+
+        if (participants > rangeCount) participants = rangeCount;
+
+        int64_t splitEnd = blockLast;
+        if (schedule == SCHEDULE_STATIC) {
+            int64_t tail = blockLast / STATIC_TAIL_DIVISOR;
+            if (tail < participants) tail = participants;
+            if (tail > blockLast) tail = blockLast;
+            splitEnd = blockLast - tail;
+        }
+
+        for (int32_t i = 0; i < rangeCount; i++) {
+            stStealRange* pRange = &pStealRanges[i];
+            int64_t start = splitEnd;
+            int64_t end = splitEnd;
+            if (i < participants) {
+                start = (splitEnd * i) / participants;
+                end = (splitEnd * (i + 1)) / participants;
+            }
+            pRange->PendingCompleted = 0;
+            pRange->Range = stStealRange::Pack(tag, start, end);
+        }
+
+        pWorkItem->BlockNext = splitEnd;
+        pWorkItem->JobTag = tag;
+        pWorkItem->StealRangeCount = rangeCount;
+        pWorkItem->pStealRanges = pStealRanges;
+        pWorkItem->Schedule = schedule;
+    }
+
+    //------------------------------------------------------------------------------
+    // Called from main thread
+    // Puts a forwarding entry in the ring of every other numa node group in the mask
+    // Returns the mask of groups that need CompleteWorkItem called
+    uint64_t ForwardWorkItem(stMATH_WORKER_ITEM* pWorkItem, int32_t threadWakeup) {
+        uint64_t forwarded = pWorkItem->NumaNodeMask & ~((uint64_t)1 << pWorkItem->NumaNode);
+
+        for (int32_t g = 0; g < NumaNodeCount; g++) {
+            if (forwarded & ((uint64_t)1 << g)) {
+                stMATH_WORKER_ITEM* pForwardItem = pWorkerRings[g]->GetWorkItem(pWorkItem->Slot);
+                pForwardItem->pForward = pWorkItem;
+                pForwardItem->ThreadWakeup = threadWakeup;
+                pWorkerRings[g]->SetWorkItem(pWorkItem->Slot, threadWakeup, pWorkItem->Priority);
+            }
+        }
+        return forwarded;
+    }
+
+    //------------------------------------------------------------------------------
+    // Main thread waits for the workers to complete the last blocks
+    // Spins for WaitSpinNanos (short jobs finish quickly) then sleeps so a long job
+    // gets the core back, the worker completing the last block wakes us
+    void WaitForCompletion(stMATH_WORKER_ITEM* pWorkItem) {
+        if (pWorkItem->BlocksCompleted >= pWorkItem->BlocksToComplete) {
+            InterlockedIncrement64(&WaitSpinCount);
+            return;
+        }
+
+        int64_t startTime = GetMonotonicNanos();
+        int64_t deadline = startTime + WaitSpinNanos;
+        int32_t checks = 0;
+
+        while (pWorkItem->BlocksCompleted < pWorkItem->BlocksToComplete) {
+            MATHLOGGING("Waiting %llu  %llu \n", pWorkItem->BlocksCompleted, pWorkItem->BlocksToComplete);
+            YieldProcessor();
+            if ((++checks & 63) == 0 && GetMonotonicNanos() >= deadline) break;
+        }
+
+        int64_t blockTime = GetMonotonicNanos();
+        InterlockedAdd64(&WaitSpinNanosTotal, blockTime - startTime);
+
+        if (pWorkItem->BlocksCompleted >= pWorkItem->BlocksToComplete) {
+            InterlockedIncrement64(&WaitSpinCount);
+            return;
+        }
+
+        // Either we see CompletionDone or the last worker sees MainWaiting
+        InterlockedIncrement64(&pWorkItem->MainWaiting);
+
+#if defined(_WIN32)
+        if (g_WaitAddress != NULL) {
+            int64_t notDone = 0;
+            while (pWorkItem->CompletionDone == 0) {
+                g_WaitAddress(&pWorkItem->CompletionDone, &notDone, 8, 1000);
+            }
+        }
+#elif defined(__linux__)
+        while (pWorkItem->CompletionDone == 0) {
+            futex((int*)&pWorkItem->CompletionDone, FUTEX_WAIT, 0, NULL, NULL, 0);
+        }
+#endif
+        // Platforms we cannot sleep on keep spinning
+        while (pWorkItem->BlocksCompleted < pWorkItem->BlocksToComplete) {
+            YieldProcessor();
+        }
+
+        InterlockedIncrement64(&WaitBlockedCount);
+        InterlockedAdd64(&WaitBlockedNanosTotal, GetMonotonicNanos() - blockTime);
+    }
+
+    //------------------------------------------------------------------------------
+    // Elements per block for a job of len elements
+    // bytesPerElement is summed over all the inputs and outputs
+    // A block of a cheap op uses up to the whole L2 since the op is bound by memory,
+    // expensive ops get smaller blocks so all the threads finish at about the same time
+    int64_t GetBlockSize(int64_t len, int64_t bytesPerElement, int32_t costClass, int32_t maxThreads) {
+        if (BlockSizeOverride > 0) return BlockSizeOverride;
+
+        int64_t budget = L2CacheSize;
+        if (costClass == COST_LIGHT) budget /= 4;
+        else if (costClass == COST_HEAVY) budget /= 16;
+
+        if (bytesPerElement < 1) bytesPerElement = 1;
+
+        int64_t blockSize = MAX_BLOCK_SIZE;
+        while (blockSize > MIN_BLOCK_SIZE && blockSize * bytesPerElement > budget) {
+            blockSize >>= 1;
+        }
+
+        // Give every thread that wakes up at least one block
+        int64_t threads = GetFutexWakeup();
+        if (maxThreads > 0 && maxThreads < threads) threads = maxThreads;
+        if (threads > WorkerThreadCount) threads = WorkerThreadCount;
+
+        while (blockSize > MIN_BLOCK_SIZE && blockSize * (threads + 1) > len) {
+            blockSize >>= 1;
+        }
+        return blockSize;
+    }
+
+    //------------------------------------------------------------------------------
+    // Worker threads to wake up for a job of len elements, always at least 1
+    // Each thread should get enough bytes to pay for waking it up, cheap ops need more.
+    // Memory bound ops stop scaling once the memory channels are full, so they are
+    // also capped per numa node. maxThreads > 0 is a cap set for the ufunc.
+    int32_t GetThreadCount(int64_t len, int64_t bytesPerElement, int32_t costClass, int32_t maxThreads) {
+        int64_t bytesPerThread = MEMORY_BYTES_PER_THREAD;
+        if (costClass == COST_LIGHT) bytesPerThread /= 4;
+        else if (costClass == COST_HEAVY) bytesPerThread /= 32;
+
+        if (bytesPerElement < 1) bytesPerElement = 1;
+
+        int64_t threads = (len * bytesPerElement) / bytesPerThread;
+
+        int64_t limit = GetFutexWakeup();
+        if (limit > WorkerThreadCount) limit = WorkerThreadCount;
+        if (costClass == COST_MEMORY && limit > MEMORY_THREADS_PER_NODE * NumaNodeCount) {
+            limit = MEMORY_THREADS_PER_NODE * NumaNodeCount;
+        }
+        if (maxThreads > 0 && limit > maxThreads) limit = maxThreads;
+
+        if (threads > limit) threads = limit;
+        if (threads < 1) threads = 1;
+        return (int32_t)threads;
+    }
+
+    //---------------------------------
+    // Sets the elements per block for every job, 0 to use the cost model, returns previous value
+    int64_t SetBlockSize(int64_t blockSize) {
+        int64_t previousVal = BlockSizeOverride;
+        BlockSizeOverride = blockSize < 0 ? 0 : blockSize;
+        return previousVal;
+    }
+
+    //---------------------------------
+    // Lane for a job of len elements, small jobs are picked up by workers busy with large ones
+    // bytesPerElement is summed over all the inputs and outputs
+    FORCE_INLINE int32_t GetPriority(int64_t len, int64_t bytesPerElement) {
+        return len * bytesPerElement <= LatencyBytes ? PRIORITY_LATENCY : PRIORITY_BULK;
+    }
+
+    //---------------------------------
+    // Threads to wake up and elements per block for a job of len elements, sets the lane of pWorkItem (if any)
+    // Returns the threads, the block size goes in *pBlockSize
+    int32_t PlanWork(stMATH_WORKER_ITEM* pWorkItem, int64_t len, int64_t bytesPerElement, int32_t costClass, int32_t maxThreads, int64_t* pBlockSize) {
+        int32_t threads = GetThreadCount(len, bytesPerElement, costClass, maxThreads);
+        *pBlockSize = GetBlockSize(len, bytesPerElement, costClass, threads);
+        if (pWorkItem) pWorkItem->Priority = GetPriority(len, bytesPerElement);
+        return threads;
+    }
+
+    //---------------------------------
+    // Sets the most bytes a job in the latency lane touches, 0 for no latency lane, returns previous value
+    int64_t SetLatencyBytes(int64_t bytes) {
+        int64_t previousVal = LatencyBytes;
+        LatencyBytes = bytes < 0 ? 0 : bytes;
+        return previousVal;
+    }
+
+    //---------------------------------
+    // Changes how long the main thread spins before it sleeps waiting for a job, returns previous value
+    int64_t SetWaitSpin(int64_t spinNanos) {
+        int64_t previousVal = WaitSpinNanos;
+        WaitSpinNanos = spinNanos < 0 ? 0 : spinNanos;
+        return previousVal;
+    }
+
     //------------------------------------------------------------------------------
     // Called from main thread
     void WorkMain(
@@ -757,13 +2194,34 @@ public:
         int64_t BlockSize = WORK_ITEM_CHUNK,
         bool bGenericMode = TRUE) {
 
+        WorkStart(pWorkItem, len, threadWakeup, BlockSize, bGenericMode);
+        WorkWait(pWorkItem);
+    }
+
+    //------------------------------------------------------------------------------
+    // Publishes the work item to the worker threads and returns right away
+    // The work item is the handle for the job, the caller must pass it to WorkWait
+    // and keep the data alive until then.
+    // With autoRelease the thread completing the last block gives back the work item,
+    // so a job nobody waits on does not keep its producer slot. Pass the returned serial
+    // to WorkJoin instead of calling WorkWait, IsWorkDone polls without blocking.
+    int64_t WorkStart(
+        stMATH_WORKER_ITEM* pWorkItem,
+        int64_t len,
+        int32_t  threadWakeup,
+        int64_t BlockSize = WORK_ITEM_CHUNK,
+        bool bGenericMode = TRUE,
+        bool autoRelease = FALSE) {
+
+        int64_t serial = ++pWorkItem->Serial;
         pWorkItem->TotalElements = len;
+        pWorkItem->pForward = NULL;
+
+        stWorkerRing* pHomeRing = pWorkerRings[pWorkItem->NumaNode];
 
         const int32_t   maxWakeup = GetFutexWakeup();
 
         MATHLOGGING("wakeup max:%d  requested:%d\n", maxWakeup, threadWakeup);
-        // Only windows uses ThreadWakup
-        // Linux uses the futex to wakup more threads
         // If the number of threads to wakeup is not specified, we use the default
         if (threadWakeup <= 0) {
 
@@ -775,11 +2233,25 @@ public:
             threadWakeup = threadWakeup < maxWakeup ? threadWakeup : maxWakeup;
         }
 
-        // only windows uses this for now
+        // Every worker we wake needs a token of the process wide budget
+        // With none left the calling thread does the job alone
+        int32_t groups = 0;
+        for (int32_t g = 0; g < NumaNodeCount; g++) {
+            if (pWorkItem->NumaNodeMask & ((uint64_t)1 << g)) groups++;
+        }
+        if (groups < 1) groups = 1;
+        int32_t granted = BudgetAcquire(threadWakeup * groups);
+        if (granted < threadWakeup * groups) {
+            threadWakeup = granted / groups;
+            BudgetRelease(granted - threadWakeup * groups);
+        }
+        pWorkItem->BudgetTokens = threadWakeup * groups;
+
+        // Workers take one each when they join, the ones that find none leave the job alone
         pWorkItem->ThreadWakeup = threadWakeup;
 
         if (bGenericMode) {
-            // WORK_ITEM_CHUNK at a time
+            // BlockSize at a time
             pWorkItem->BlockLast = (len + (BlockSize - 1)) / BlockSize;
         }
         else {
@@ -789,40 +2261,136 @@ public:
         }
 
         pWorkItem->BlocksCompleted = 0;
+        pWorkItem->BlocksToComplete = bGenericMode ? pWorkItem->BlockLast : len;
+        // After the counts, a worker leaving the last job in this slot must not see it complete
+        pWorkItem->AutoRelease = autoRelease;
+        pWorkItem->MainWaiting = 0;
+        pWorkItem->CompletionDone = 0;
         pWorkItem->BlockNext = 0;
         pWorkItem->BlockSize = BlockSize;
+        pWorkItem->Schedule = SCHEDULE_RING;
+
+        if (bGenericMode && Schedule != SCHEDULE_RING && pWorkItem->BlockLast <= stStealRange::MAX_BLOCKS) {
+            // main thread plus the workers we wake on each node
+            int64_t participants = 1;
+            for (int32_t g = 0; g < NumaNodeCount; g++) {
+                if (pWorkItem->NumaNodeMask & ((uint64_t)1 << g)) {
+                    participants += threadWakeup < NumaThreadCount[g] ? threadWakeup : NumaThreadCount[g];
+                }
+            }
+            PreSplitWork(pWorkItem, pHomeRing, participants, Schedule);
+        }
 
         // Tell all worker threads about this new work item (futex or wakeall)
         // TODO: Consider waking a different number of threads based on complexity
         // NOTE: This is a common optimization point: how long it takes to wake up threads
         // uint64_t currentTSC = __rdtsc();
 
-        pWorkerRing->SetWorkItem(threadWakeup);
+        if (pWorkItem->Priority == PRIORITY_LATENCY) InterlockedIncrement64(&g_LatencyJobs);
+        pHomeRing->SetWorkItem(pWorkItem->Slot, threadWakeup, pWorkItem->Priority);
+        pWorkItem->ForwardedMask = NumaNodeCount > 1 ? ForwardWorkItem(pWorkItem, threadWakeup) : 0;
 
         // MATHLOGGING("Took %lld cycles to wakeup\n", __rdtsc() - currentTSC);
+        return serial;
+    }
+
+    //------------------------------------------------------------------------------
+    // TRUE once an autoRelease job from WorkStart is complete and its work item given back
+    FORCE_INLINE BOOL IsWorkDone(stMATH_WORKER_ITEM* pWorkItem, int64_t serial) {
+        return pWorkItem->ReleasedSerial >= serial;
+    }
 
+    //------------------------------------------------------------------------------
+    // Called from the thread that called WorkStart
+    // Helps with the blocks that are left, waits for the job to complete and
+    // gives back the work item
+    void WorkWait(stMATH_WORKER_ITEM* pWorkItem) {
         // Also do work
         pWorkItem->DoWork(-1, 0);
 
-        if (bGenericMode) {
-            // Check if all workers have completed
-            while (pWorkItem->BlocksCompleted < pWorkItem->BlockLast) {
-                MATHLOGGING("Waiting %llu  %llu \n", pWorkItem->BlocksCompleted, pWorkItem->BlockLast);
-                YieldProcessor();
-                // We yield instead of Sleep(0)
-            }
+        // Check if all workers have completed
+        WaitForCompletion(pWorkItem);
+
+        FinishWorkItem(pWorkItem, FALSE);
+    }
+
+    //------------------------------------------------------------------------------
+    // Called from the thread that called WorkStart with autoRelease, serial is what it returned
+    // Helps with the blocks that are left, then waits until whichever thread completed
+    // the last block gave back the work item
+    void WorkJoin(stMATH_WORKER_ITEM* pWorkItem, int64_t serial) {
+        stWorkerRing* pHomeRing = pWorkerRings[pWorkItem->NumaNode];
+
+        // The same handshake as a worker, the item is not given back while we are a user
+        // Once the slot bit is clear, or the slot has a newer job, ours is complete
+        InterlockedIncrement64(&pWorkItem->Users);
+        if ((pHomeRing->ActiveMask & ((int64_t)1 << pWorkItem->Slot)) && pWorkItem->Serial == serial) {
+            pWorkItem->DoWork(-1, 0);
         }
-        else {
-            // Check if all workers have completed
-            while (pWorkItem->BlocksCompleted < len) {
-                MATHLOGGING("Waiting %llu  %llu \n", pWorkItem->BlocksCompleted, pWorkItem->BlockLast);
+        InterlockedDecrement64(&pWorkItem->Users);
+
+        if (pWorkItem->ClaimRelease()) {
+            FinishWorkItem(pWorkItem, TRUE);
+        }
+
+        WaitReleased(pWorkItem, serial);
+    }
+
+    //------------------------------------------------------------------------------
+    // Sleeps until the autoRelease job with this serial was given back
+    // More threads can wait on the same job, only one of them should call WorkJoin
+    void WaitReleased(stMATH_WORKER_ITEM* pWorkItem, int64_t serial) {
+        while (pWorkItem->ReleasedSerial < serial) {
+            int64_t released = pWorkItem->ReleasedSerial;
+#if defined(_WIN32)
+            if (g_WaitAddress != NULL) {
+                g_WaitAddress(&pWorkItem->ReleasedSerial, &released, 8, 1000);
+            }
+            else {
                 YieldProcessor();
-                // We yield instead of Sleep(0)
             }
+#elif defined(__linux__)
+            futex((int*)&pWorkItem->ReleasedSerial, FUTEX_WAIT, (int)released, NULL, NULL, 0);
+#else
+            YieldProcessor();
+#endif
         }
+    }
+
+    //------------------------------------------------------------------------------
+    // Called once all blocks are complete, by the thread that called WorkStart or
+    // for an autoRelease job by the thread that won ClaimRelease
+    // Gives back the producer slot, the latency lane count and the budget tokens
+    void FinishWorkItem(stMATH_WORKER_ITEM* pWorkItem, BOOL wakeJoin) {
+        stWorkerRing* pHomeRing = pWorkerRings[pWorkItem->NumaNode];
 
         // Mark this as completed
-        pWorkerRing->CompleteWorkItem();
+        pHomeRing->CompleteWorkItem(pWorkItem->Slot);
+        uint64_t forwarded = pWorkItem->ForwardedMask;
+        for (int32_t g = 0; forwarded; g++, forwarded >>= 1) {
+            if (forwarded & 1) pWorkerRings[g]->CompleteWorkItem(pWorkItem->Slot);
+        }
+
+        if (pWorkItem->Priority == PRIORITY_LATENCY) {
+            InterlockedDecrement64(&g_LatencyJobs);
+            pWorkItem->Priority = PRIORITY_BULK;
+        }
+
+        BudgetRelease((int32_t)pWorkItem->BudgetTokens);
+        pWorkItem->BudgetTokens = 0;
+
+        // Before the slot is released, so the next job in it cannot be given back first
+        pWorkItem->ReleasedSerial = pWorkItem->Serial;
+        if (wakeJoin) {
+#if defined(_WIN32)
+            if (g_WakeAllAddress != NULL) g_WakeAllAddress((PVOID)&pWorkItem->ReleasedSerial);
+#elif defined(__linux__)
+            futex((int*)&pWorkItem->ReleasedSerial, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+#endif
+        }
+
+        // The slot can be used by the next job of any thread
+        ReleaseProducer(pWorkItem->Slot);
     }
 
 
@@ -0,0 +1,512 @@
+#include "topology.h"
+
+#define LOGGING(...)
+//#define LOGGING printf
+
+#if defined(RT_OS_LINUX)
+
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+//-----------------------------------------------------------
+// Reads a kernel list such as "0-3,8-11" into a bool per entry
+// Returns number of entries set
+static int32_t ReadSysList(const char* path, BYTE* pSet, int32_t maxEntries) {
+    char buffer[4096];
+    int32_t count = 0;
+
+    FILE* fp = fopen(path, "r");
+    if (!fp) return 0;
+
+    if (fgets(buffer, sizeof(buffer), fp)) {
+        char* p = buffer;
+        while (*p >= '0' && *p <= '9') {
+            long first = strtol(p, &p, 10);
+            long last = first;
+            if (*p == '-') {
+                p++;
+                last = strtol(p, &p, 10);
+            }
+            for (long i = first; i <= last && i < maxEntries; i++) {
+                if (!pSet[i]) count++;
+                pSet[i] = 1;
+            }
+            if (*p == ',') p++;
+        }
+    }
+    fclose(fp);
+    return count;
+}
+
+//-----------------------------------------------------------
+void ReadNumaTopology(stNumaTopology* pTopology) {
+    BYTE nodes[MAX_TOPOLOGY_CPUS];
+    BYTE cpus[MAX_TOPOLOGY_CPUS];
+    cpu_set_t allowed;
+
+    memset(pTopology, 0, sizeof(stNumaTopology));
+    memset(nodes, 0, sizeof(nodes));
+
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        CPU_ZERO(&allowed);
+    }
+
+    ReadSysList("/sys/devices/system/node/online", nodes, MAX_TOPOLOGY_CPUS);
+
+    for (int32_t n = 0; n < MAX_TOPOLOGY_CPUS && pTopology->NodeCount < MAX_NUMA_NODES; n++) {
+        if (!nodes[n]) continue;
+
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n);
+        memset(cpus, 0, sizeof(cpus));
+        ReadSysList(path, cpus, MAX_TOPOLOGY_CPUS);
+
+        int32_t index = pTopology->NodeCount;
+        int32_t cpuCount = 0;
+        for (int32_t c = 0; c < MAX_TOPOLOGY_CPUS && c < CPU_SETSIZE; c++) {
+            if (cpus[c] && CPU_ISSET(c, &allowed)) {
+                pTopology->Cpus[index][cpuCount++] = (int16_t)c;
+            }
+        }
+
+        // Skip memory only nodes and nodes we are not allowed to run on
+        if (cpuCount == 0) continue;
+
+        LOGGING("numa node %d has %d cpus\n", n, cpuCount);
+        pTopology->NodeId[index] = n;
+        pTopology->CpuCount[index] = cpuCount;
+        pTopology->NodeCount++;
+    }
+
+    if (pTopology->NodeCount == 0) {
+        // No numa information (sysfs not mounted), treat as one node
+        pTopology->NodeCount = 1;
+        pTopology->NodeId[0] = 0;
+        pTopology->CpuCount[0] = 0;
+    }
+}
+
+//-----------------------------------------------------------
+// Reads a single number from a sysfs file
+static int32_t ReadSysInt(const char* path, int32_t defaultValue) {
+    int32_t value = defaultValue;
+    FILE* fp = fopen(path, "r");
+    if (fp) {
+        if (fscanf(fp, "%d", &value) != 1) value = defaultValue;
+        fclose(fp);
+    }
+    return value;
+}
+
+//-----------------------------------------------------------
+void ReadCpuTopology(stCpuTopology* pCpuTopology, const stNumaTopology* pTopology) {
+    cpu_set_t allowed;
+    int32_t count = 0;
+
+    memset(pCpuTopology, 0, sizeof(stCpuTopology));
+
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return;
+
+    for (int32_t c = 0; c < MAX_TOPOLOGY_CPUS && c < CPU_SETSIZE; c++) {
+        if (!CPU_ISSET(c, &allowed)) continue;
+
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", c);
+        int32_t package = ReadSysInt(path, 0);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", c);
+        int32_t core = ReadSysInt(path, c);
+
+        // The hyperthread index is how many cpus before us share our core
+        int32_t smt = 0;
+        for (int32_t i = 0; i < count; i++) {
+            if (pCpuTopology->Package[i] == package && pCpuTopology->Core[i] == core) smt++;
+        }
+
+        int32_t node = 0;
+        for (int32_t n = 0; n < pTopology->NodeCount; n++) {
+            for (int32_t i = 0; i < pTopology->CpuCount[n]; i++) {
+                if (pTopology->Cpus[n][i] == c) node = n;
+            }
+        }
+
+        // cpus in the same L3 (a CCX on AMD) list the same cpus
+        BYTE shared[MAX_TOPOLOGY_CPUS];
+        memset(shared, 0, sizeof(shared));
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index3/shared_cpu_list", c);
+        int32_t cache = -1;
+        if (ReadSysList(path, shared, MAX_TOPOLOGY_CPUS) > 0) {
+            for (int32_t i = 0; i < MAX_TOPOLOGY_CPUS; i++) {
+                if (shared[i]) {
+                    cache = i;
+                    break;
+                }
+            }
+        }
+
+        pCpuTopology->Cpu[count] = (int16_t)c;
+        pCpuTopology->Cache[count] = (int16_t)cache;
+        pCpuTopology->Package[count] = (int16_t)package;
+        pCpuTopology->Core[count] = (int16_t)core;
+        pCpuTopology->Smt[count] = (int16_t)smt;
+        pCpuTopology->Node[count] = (int16_t)node;
+        count++;
+    }
+    pCpuTopology->CpuCount = count;
+}
+
+//-----------------------------------------------------------
+// Where a cgroup hierarchy is mounted, from a /proc/self/mountinfo line
+struct stCgroupMount {
+    char        Root[512];
+    char        Point[512];
+};
+
+//-----------------------------------------------------------
+// Looks for the mount of the cgroup2 hierarchy (controller NULL) or the v1 hierarchy
+// with the controller, such as "cpu" in "rw,cpu,cpuacct"
+// Returns FALSE if not mounted
+static BOOL FindCgroupMount(const char* controller, stCgroupMount* pMount) {
+    char line[2048];
+    BOOL found = FALSE;
+
+    FILE* fp = fopen("/proc/self/mountinfo", "r");
+    if (!fp) return FALSE;
+
+    while (!found && fgets(line, sizeof(line), fp)) {
+        // id parent major:minor root mountpoint options [optional fields] - fstype source superoptions
+        char root[512], point[512], fstype[64], source[256], options[512];
+        char* dash = strstr(line, " - ");
+        if (!dash) continue;
+        if (sscanf(line, "%*d %*d %*s %511s %511s", root, point) != 2) continue;
+        if (sscanf(dash + 3, "%63s %255s %511s", fstype, source, options) != 3) continue;
+
+        if (controller == NULL) {
+            found = strcmp(fstype, "cgroup2") == 0;
+        }
+        else if (strcmp(fstype, "cgroup") == 0) {
+            for (char* token = strtok(options, ","); token; token = strtok(NULL, ",")) {
+                if (strcmp(token, controller) == 0) found = TRUE;
+            }
+        }
+        if (found) {
+            strcpy(pMount->Root, root);
+            strcpy(pMount->Point, point);
+        }
+    }
+    fclose(fp);
+    return found;
+}
+
+//-----------------------------------------------------------
+// Our cgroup path for the cgroup2 hierarchy (controller NULL) or a v1 controller
+// from /proc/self/cgroup lines such as "0::/pod/x" or "4:cpu,cpuacct:/pod/x"
+static BOOL FindCgroupPath(const char* controller, char* pPath, size_t pathSize) {
+    char line[2048];
+    BOOL found = FALSE;
+
+    FILE* fp = fopen("/proc/self/cgroup", "r");
+    if (!fp) return FALSE;
+
+    while (!found && fgets(line, sizeof(line), fp)) {
+        char* controllers = strchr(line, ':');
+        if (!controllers) continue;
+        controllers++;
+        char* path = strchr(controllers, ':');
+        if (!path) continue;
+        *path++ = 0;
+        path[strcspn(path, "\n")] = 0;
+
+        if (controller == NULL) {
+            found = line[0] == '0' && controllers[0] == 0;
+        }
+        else {
+            for (char* token = strtok(controllers, ","); token; token = strtok(NULL, ",")) {
+                if (strcmp(token, controller) == 0) found = TRUE;
+            }
+        }
+        if (found) snprintf(pPath, pathSize, "%s", path);
+    }
+    fclose(fp);
+    return found;
+}
+
+//-----------------------------------------------------------
+// Directories of our cgroup and its parents up to the root of the mount
+// pDirs gets the full paths in sysfs, returns how many
+static int32_t GetCgroupDirs(const char* controller, char pDirs[][1024], int32_t maxDirs) {
+    stCgroupMount mount;
+    char path[512];
+
+    if (!FindCgroupMount(controller, &mount) || !FindCgroupPath(controller, path, sizeof(path))) return 0;
+
+    // In a cgroup namespace the root of the mount is our cgroup so strip it off
+    const char* relative = path;
+    size_t rootLength = strlen(mount.Root);
+    if (strcmp(mount.Root, "/") != 0 && strncmp(path, mount.Root, rootLength) == 0) relative += rootLength;
+
+    char current[512];
+    snprintf(current, sizeof(current), "%s", relative);
+
+    int32_t count = 0;
+    while (count < maxDirs) {
+        snprintf(pDirs[count++], 1024, "%s%s", mount.Point, strcmp(current, "/") == 0 ? "" : current);
+
+        char* slash = strrchr(current, '/');
+        if (!slash || slash == current) {
+            if (strcmp(current, "/") == 0 || current[0] == 0) break;
+            strcpy(current, "/");
+        }
+        else {
+            *slash = 0;
+        }
+    }
+    return count;
+}
+
+//-----------------------------------------------------------
+// Keeps the quota that allows the fewest cpus
+static void MergeQuota(stCgroupLimits* pLimits, int64_t quota, int64_t period) {
+    if (quota <= 0 || period <= 0) return;
+    if (pLimits->QuotaMicros < 0 || quota * pLimits->PeriodMicros < pLimits->QuotaMicros * period) {
+        pLimits->QuotaMicros = quota;
+        pLimits->PeriodMicros = period;
+    }
+}
+
+//-----------------------------------------------------------
+// Keeps the cpuset with the fewest cpus
+static void MergeCpuset(stCgroupLimits* pLimits, const char* path) {
+    BYTE cpus[MAX_TOPOLOGY_CPUS];
+    memset(cpus, 0, sizeof(cpus));
+    int32_t count = ReadSysList(path, cpus, MAX_TOPOLOGY_CPUS);
+    if (count > 0 && (pLimits->CpusetCount == 0 || count < pLimits->CpusetCount)) {
+        pLimits->CpusetCount = count;
+    }
+}
+
+//-----------------------------------------------------------
+// Joins a cgroup dir and a file name, returns FALSE if the path does not fit
+static BOOL CgroupFile(char* path, size_t size, const char* dir, const char* name) {
+    int len = snprintf(path, size, "%s/%s", dir, name);
+    return len > 0 && (size_t)len < size;
+}
+
+//-----------------------------------------------------------
+void ReadCgroupLimits(stCgroupLimits* pLimits) {
+    const int32_t MAX_CGROUP_DEPTH = 32;
+    char dirs[MAX_CGROUP_DEPTH][1024];
+    char path[1200];
+
+    pLimits->Version = 0;
+    pLimits->QuotaMicros = -1;
+    pLimits->PeriodMicros = 0;
+    pLimits->CpusetCount = 0;
+
+    // cgroup v2: "max 100000" or "400000 100000" in cpu.max
+    int32_t count = GetCgroupDirs(NULL, dirs, MAX_CGROUP_DEPTH);
+    if (count > 0) {
+        // A hybrid system mounts a cgroup2 without the cpu controllers next to the v1 ones
+        FILE* fp = CgroupFile(path, sizeof(path), dirs[count - 1], "cgroup.controllers") ? fopen(path, "r") : NULL;
+        char controllers[512] = { 0 };
+        BOOL hasCpu = FALSE;
+        if (fp) {
+            if (fgets(controllers, sizeof(controllers), fp)) {
+                char* next = NULL;
+                for (char* token = strtok_r(controllers, " \n", &next); token; token = strtok_r(NULL, " \n", &next)) {
+                    if (strcmp(token, "cpu") == 0 || strcmp(token, "cpuset") == 0) hasCpu = TRUE;
+                }
+            }
+            fclose(fp);
+        }
+        if (!hasCpu) count = 0;
+    }
+    for (int32_t i = 0; i < count; i++) {
+        pLimits->Version = 2;
+        char quota[32];
+        long long period = 0;
+        FILE* fp = CgroupFile(path, sizeof(path), dirs[i], "cpu.max") ? fopen(path, "r") : NULL;
+        if (fp) {
+            if (fscanf(fp, "%31s %lld", quota, &period) == 2 && strcmp(quota, "max") != 0) {
+                MergeQuota(pLimits, atoll(quota), period);
+            }
+            fclose(fp);
+        }
+        if (CgroupFile(path, sizeof(path), dirs[i], "cpuset.cpus.effective")) MergeCpuset(pLimits, path);
+    }
+    if (pLimits->Version == 2) return;
+
+    // cgroup v1: cpu.cfs_quota_us is -1 for no quota
+    count = GetCgroupDirs("cpu", dirs, MAX_CGROUP_DEPTH);
+    for (int32_t i = 0; i < count; i++) {
+        pLimits->Version = 1;
+        if (!CgroupFile(path, sizeof(path), dirs[i], "cpu.cfs_quota_us")) continue;
+        int32_t quota = ReadSysInt(path, -1);
+        if (!CgroupFile(path, sizeof(path), dirs[i], "cpu.cfs_period_us")) continue;
+        MergeQuota(pLimits, quota, ReadSysInt(path, 0));
+    }
+
+    count = GetCgroupDirs("cpuset", dirs, MAX_CGROUP_DEPTH);
+    for (int32_t i = 0; i < count; i++) {
+        pLimits->Version = 1;
+        if (CgroupFile(path, sizeof(path), dirs[i], "cpuset.effective_cpus")) MergeCpuset(pLimits, path);
+    }
+}
+
+//-----------------------------------------------------------
+int64_t ReadL2CacheSize() {
+    int64_t size = 0;
+#if defined(_SC_LEVEL2_CACHE_SIZE)
+    size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    if (size <= 0) {
+        // sysfs has it as "1024K"
+        char buffer[64];
+        size = 0;
+        FILE* fp = fopen("/sys/devices/system/cpu/cpu0/cache/index2/size", "r");
+        if (fp) {
+            if (fgets(buffer, sizeof(buffer), fp)) {
+                char* p = buffer;
+                size = strtol(buffer, &p, 10);
+                if (*p == 'K') size *= 1024;
+                else if (*p == 'M') size *= 1024 * 1024;
+            }
+            fclose(fp);
+        }
+    }
+    return size;
+}
+
+//-----------------------------------------------------------
+int32_t GetMemoryNode(const stNumaTopology* pTopology, const void* pData) {
+    if (pTopology->NodeCount <= 1 || !pData) return -1;
+
+    static long pageSize = sysconf(_SC_PAGESIZE);
+    void* page = (void*)((uintptr_t)pData & ~((uintptr_t)pageSize - 1));
+    int status = -1;
+
+    // With no target nodes move_pages only reports where the page lives
+    if (syscall(SYS_move_pages, 0, 1UL, &page, NULL, &status, 0) != 0 || status < 0) {
+        return -1;
+    }
+
+    for (int32_t i = 0; i < pTopology->NodeCount; i++) {
+        if (pTopology->NodeId[i] == status) return i;
+    }
+    return -1;
+}
+
+//-----------------------------------------------------------
+BOOL PinThreadToNode(const stNumaTopology* pTopology, int32_t node) {
+    if (node < 0 || node >= pTopology->NodeCount || pTopology->CpuCount[node] == 0) return FALSE;
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (int32_t i = 0; i < pTopology->CpuCount[node]; i++) {
+        CPU_SET(pTopology->Cpus[node][i], &cpuset);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) == 0;
+}
+
+#else
+
+//-----------------------------------------------------------
+// TODO: Windows has GetLogicalProcessorInformationEx
+void ReadCpuTopology(stCpuTopology* pCpuTopology, const stNumaTopology* pTopology) {
+    memset(pCpuTopology, 0, sizeof(stCpuTopology));
+}
+
+//-----------------------------------------------------------
+// TODO: Windows has GetNumaNodeProcessorMaskEx and QueryWorkingSetEx
+void ReadNumaTopology(stNumaTopology* pTopology) {
+    memset(pTopology, 0, sizeof(stNumaTopology));
+    pTopology->NodeCount = 1;
+}
+
+int32_t GetMemoryNode(const stNumaTopology* pTopology, const void* pData) {
+    return -1;
+}
+
+int64_t ReadL2CacheSize() {
+    return 0;
+}
+
+// TODO: Windows has job object cpu rate limits
+void ReadCgroupLimits(stCgroupLimits* pLimits) {
+    pLimits->Version = 0;
+    pLimits->QuotaMicros = -1;
+    pLimits->PeriodMicros = 0;
+    pLimits->CpusetCount = 0;
+}
+
+BOOL PinThreadToNode(const stNumaTopology* pTopology, int32_t node) {
+    return FALSE;
+}
+
+#endif
+
+
+//-----------------------------------------------------------
+// The kernel already keeps the affinity mask (and so cpuCount) inside the cpuset
+int32_t GetUsableCpuCount(const stCgroupLimits* pLimits, int32_t cpuCount) {
+    if (pLimits->QuotaMicros > 0 && pLimits->PeriodMicros > 0) {
+        int64_t quotaCpus = (pLimits->QuotaMicros + pLimits->PeriodMicros - 1) / pLimits->PeriodMicros;
+        if (quotaCpus < cpuCount) cpuCount = (int32_t)quotaCpus;
+    }
+    return cpuCount > 0 ? cpuCount : 1;
+}
+
+//-----------------------------------------------------------
+struct stCpuSortKey {
+    int64_t Key;
+    int16_t Cpu;
+};
+
+static int CompareCpuSortKey(const void* a, const void* b) {
+    int64_t keyA = ((const stCpuSortKey*)a)->Key;
+    int64_t keyB = ((const stCpuSortKey*)b)->Key;
+    return keyA < keyB ? -1 : keyA > keyB ? 1 : 0;
+}
+
+//-----------------------------------------------------------
+int32_t OrderCpus(const stCpuTopology* pCpuTopology, int32_t policy, int16_t* pOrder, int32_t maxOrder) {
+    stCpuSortKey keys[MAX_TOPOLOGY_CPUS];
+    int32_t count = 0;
+
+    for (int32_t i = 0; i < pCpuTopology->CpuCount; i++) {
+        int64_t package = pCpuTopology->Package[i];
+        int64_t core = pCpuTopology->Core[i];
+        int64_t smt = pCpuTopology->Smt[i];
+        int64_t cpu = pCpuTopology->Cpu[i];
+        int64_t key;
+
+        switch (policy) {
+        case AFFINITY_COMPACT:
+            key = (package << 48) | (core << 32) | (smt << 16) | cpu;
+            break;
+        case AFFINITY_SCATTER:
+            // alternate packages, then cores, hyperthreads last
+            key = (smt << 48) | (core << 32) | (package << 16) | cpu;
+            break;
+        case AFFINITY_PHYSICAL:
+            if (smt != 0) continue;
+            key = (package << 48) | (core << 32) | cpu;
+            break;
+        default:
+            return 0;
+        }
+        keys[count].Key = key;
+        keys[count].Cpu = (int16_t)cpu;
+        count++;
+    }
+
+    qsort(keys, count, sizeof(stCpuSortKey), CompareCpuSortKey);
+
+    if (count > maxOrder) count = maxOrder;
+    for (int32_t i = 0; i < count; i++) {
+        pOrder[i] = keys[i].Cpu;
+    }
+    return count;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "common_inc.h"
+
+//-----------------------------------------------------
+// Most numa nodes we create worker groups for
+#define MAX_NUMA_NODES 8
+
+// Most cpus we keep track of
+#define MAX_TOPOLOGY_CPUS 1024
+
+//-----------------------------------------------------
+// The numa nodes and the cpus on each node this process is allowed to run on
+// On platforms without numa support there is one node with no cpus listed
+struct stNumaTopology {
+    int32_t     NodeCount;
+
+    // node number as used by the kernel
+    int32_t     NodeId[MAX_NUMA_NODES];
+
+    // how many cpus are in Cpus[node]
+    int32_t     CpuCount[MAX_NUMA_NODES];
+
+    int16_t     Cpus[MAX_NUMA_NODES][MAX_TOPOLOGY_CPUS];
+};
+
+//-----------------------------------------------------
+// How worker threads (and the main thread) are pinned to cpus
+enum AFFINITY_POLICY : int32_t {
+    // Threads are not pinned (numa groups still keep to their node)
+    AFFINITY_NONE = 0,
+
+    // Fill every hyperthread of a core before moving to the next core
+    AFFINITY_COMPACT = 1,
+
+    // Spread over packages and physical cores before using hyperthreads
+    AFFINITY_SCATTER = 2,
+
+    // Only one thread per physical core
+    AFFINITY_PHYSICAL = 3,
+
+    // An explicit list of cpus
+    AFFINITY_LIST = 4,
+
+    AFFINITY_LAST = 5
+};
+
+//-----------------------------------------------------
+// Every cpu this process is allowed to run on
+struct stCpuTopology {
+    int32_t     CpuCount;
+
+    int16_t     Cpu[MAX_TOPOLOGY_CPUS];
+    int16_t     Package[MAX_TOPOLOGY_CPUS];
+    int16_t     Core[MAX_TOPOLOGY_CPUS];
+
+    // Index of the hyperthread within its physical core, 0 for the first
+    int16_t     Smt[MAX_TOPOLOGY_CPUS];
+
+    // Index of the node in stNumaTopology
+    int16_t     Node[MAX_TOPOLOGY_CPUS];
+
+    // Lowest cpu sharing the last level (L3) cache, the same for every cpu of a CCX
+    // -1 when not known
+    int16_t     Cache[MAX_TOPOLOGY_CPUS];
+};
+
+//-----------------------------------------------------
+// Cpu limits of the cgroup (container) this process runs in
+struct stCgroupLimits {
+    // 1 or 2 for the cgroup version, 0 when no cgroup was found
+    int32_t     Version;
+
+    // Cpu time the cgroup may use per period (cpu.max or cpu.cfs_quota_us), -1 for no quota
+    int64_t     QuotaMicros;
+    int64_t     PeriodMicros;
+
+    // Cpus in the cgroup cpuset, 0 when not known
+    int32_t     CpusetCount;
+};
+
+// Fill in the topology, always returns at least one node
+void ReadNumaTopology(stNumaTopology* pTopology);
+
+// Returns the index in the topology of the node holding the page for pData
+// Returns -1 if not known (page not faulted in or no numa support)
+int32_t GetMemoryNode(const stNumaTopology* pTopology, const void* pData);
+
+// Restrict the calling thread to the cpus on a node
+// Returns FALSE if nothing was changed
+BOOL PinThreadToNode(const stNumaTopology* pTopology, int32_t node);
+
+// Fill in the cpus, CpuCount is 0 when not supported on this platform
+void ReadCpuTopology(stCpuTopology* pCpuTopology, const stNumaTopology* pTopology);
+
+// Fill in the quota and cpuset of our cgroup, the tightest limit of the cgroup and its parents
+void ReadCgroupLimits(stCgroupLimits* pLimits);
+
+// Returns how many cpus this process can keep busy: cpuCount (from the affinity mask)
+// capped by the quota rounded up, at least 1
+int32_t GetUsableCpuCount(const stCgroupLimits* pLimits, int32_t cpuCount);
+
+// Returns the size in bytes of the L2 cache of the first cpu, 0 if not known
+int64_t ReadL2CacheSize();
+
+// Order the cpus for AFFINITY_COMPACT, AFFINITY_SCATTER or AFFINITY_PHYSICAL
+// The first thread pinned gets pOrder[0], the second pOrder[1], etc.
+// Returns how many cpus were put in pOrder
+int32_t OrderCpus(const stCpuTopology* pCpuTopology, int32_t policy, int16_t* pOrder, int32_t maxOrder);
@@ -28,20 +28,151 @@ enable/disable any of the subsystems:
 """
 __version__ = '0.0.0'
 __all__ = [
-    'initialize', 'atop_enable', 'atop_disable', 'atop_isenabled', 'cpustring',
+    'initialize', 'atop_enable', 'atop_disable', 'atop_isenabled', 'atop_getsummode', 'atop_setsummode',
+    'cpustring', 'topology',
     'thread_enable', 'thread_disable', 'thread_isenabled', 'thread_getworkers', 'thread_setworkers',
+    'thread_getpoolsize', 'thread_setpoolsize',
+    'thread_getspin', 'thread_setspin', 'thread_spinstats', 'thread_setwaitspin', 'thread_waitstats',
+    'thread_getblocksize', 'thread_setblocksize', 'thread_calibrate',
+    'thread_getlatencybytes', 'thread_setlatencybytes',
+    'thread_getbudget', 'thread_setbudget', 'thread_budgetstats', 'thread_reserve', 'thread_unreserve',
+    'reserve_cores',
+    'thread_getmaxthreads', 'thread_setmaxthreads',
+    'thread_submit', 'thread_wait', 'thread_isdone', 'submit', 'ThreadFuture',
+    'thread_reducerows', 'thread_reducecols', 'reduce',
+    'thread_getschedule', 'thread_setschedule', 'thread_getwakemode', 'thread_setwakemode',
+    'thread_getdeterministic', 'thread_setdeterministic',
+    'thread_getnumapolicy', 'thread_setnumapolicy', 'thread_numainfo',
+    'thread_info', 'thread_wakebench',
+    'thread_getaffinity', 'thread_setaffinity',
     'ledger_enable', 'ledger_disable', 'ledger_isenabled', 'ledger_info',
     'recycler_enable', 'recycler_disable', 'recycler_isenabled', 'recycler_info',
     'timer_gettsc','timer_getutc']
 
-from fast_numpy_loops._fast_numpy_loops import initialize, atop_enable, atop_disable, atop_isenabled, cpustring 
+from fast_numpy_loops._fast_numpy_loops import initialize, atop_enable, atop_disable, atop_isenabled, cpustring, topology
+from fast_numpy_loops._fast_numpy_loops import atop_getsummode, atop_setsummode
 from fast_numpy_loops._fast_numpy_loops import thread_enable, thread_disable, thread_isenabled, thread_getworkers, thread_setworkers
+from fast_numpy_loops._fast_numpy_loops import thread_getpoolsize, thread_setpoolsize
+from fast_numpy_loops._fast_numpy_loops import thread_getspin, thread_setspin, thread_spinstats
+from fast_numpy_loops._fast_numpy_loops import thread_setwaitspin, thread_waitstats
+from fast_numpy_loops._fast_numpy_loops import thread_getblocksize, thread_setblocksize, thread_calibrate
+from fast_numpy_loops._fast_numpy_loops import thread_getlatencybytes, thread_setlatencybytes
+from fast_numpy_loops._fast_numpy_loops import thread_getbudget, thread_setbudget, thread_budgetstats
+from fast_numpy_loops._fast_numpy_loops import thread_reserve, thread_unreserve
+from fast_numpy_loops._fast_numpy_loops import thread_getmaxthreads, thread_setmaxthreads
+from fast_numpy_loops._fast_numpy_loops import thread_submit, thread_wait, thread_isdone
+from fast_numpy_loops._fast_numpy_loops import thread_reducerows, thread_reducecols
+from fast_numpy_loops._fast_numpy_loops import thread_getschedule, thread_setschedule
+from fast_numpy_loops._fast_numpy_loops import thread_getwakemode, thread_setwakemode
+from fast_numpy_loops._fast_numpy_loops import thread_getdeterministic, thread_setdeterministic
+from fast_numpy_loops._fast_numpy_loops import thread_getnumapolicy, thread_setnumapolicy, thread_numainfo
+from fast_numpy_loops._fast_numpy_loops import thread_info, thread_wakebench
+from fast_numpy_loops._fast_numpy_loops import thread_getaffinity, thread_setaffinity
 from fast_numpy_loops._fast_numpy_loops import timer_gettsc, timer_getutc
 from fast_numpy_loops._fast_numpy_loops import ledger_enable, ledger_disable, ledger_isenabled, ledger_info
 from fast_numpy_loops._fast_numpy_loops import recycler_enable, recycler_disable, recycler_isenabled, recycler_info
 
 import numpy as np
 
+
+class ThreadFuture():
+    """
+    The result of ``submit``: a ufunc running on the worker threads while the
+    calling thread does something else. Do not touch the arrays passed to
+    ``submit`` until ``wait`` returns.
+    """
+    def __init__(self, job, out):
+        self._job = job
+        self._out = out
+
+    def done(self):
+        """Return True when the ufunc is complete, does not block"""
+        return self._job is None or thread_isdone(self._job)
+
+    def wait(self):
+        """Block until the ufunc is complete and return its output"""
+        if self._job is not None:
+            thread_wait(self._job)
+            self._job = None
+        return self._out
+
+    result = wait
+
+
+def submit(ufunc, *args, out=None):
+    """
+    Start ``ufunc(*args, out=out)`` on the worker threads and return a
+    ``ThreadFuture`` right away. Calls that cannot run in the background
+    (see ``thread_submit``) run before ``submit`` returns.
+    """
+    job = None
+    if out is not None:
+        job = thread_submit(ufunc, out, *args)
+    if job is None:
+        out = ufunc(*args, out=out)
+    return ThreadFuture(job, out)
+
+
+def reduce(ufunc, a, axis=-1, dtype=None, out=None, initial=None):
+    """
+    ``ufunc.reduce(a, axis=axis, dtype=dtype, out=out, initial=initial)``. A
+    reduce of the last axis of a C contiguous array (``a.sum(axis=-1)`` on a
+    tall matrix) splits the rows over the worker threads, see
+    ``thread_reducerows``, and a reduce of the first axis (``a.sum(axis=0)``)
+    splits the columns or row panels, see ``thread_reducecols``. Anything
+    else calls ``ufunc.reduce``. Float sums are not always bit identical to
+    ``ufunc.reduce``, which adds in a different order for long rows and for
+    the first axis.
+    """
+    a = np.asarray(a)
+    if a.ndim >= 2 and axis in (0, -1, a.ndim - 1):
+        # add and multiply upcast small ints (and bool) to int_ without dtype=
+        result = a.dtype if dtype is None else np.dtype(dtype)
+        if (dtype is None and ufunc in (np.add, np.multiply) and a.dtype.kind in 'biu'
+                and a.dtype.itemsize < np.dtype(np.int_).itemsize):
+            result = None
+        shape = a.shape[1:] if axis == 0 else a.shape[:-1]
+        if result == a.dtype and (out is None or out.shape == shape):
+            reduced = out
+            if reduced is None:
+                reduced = np.empty(shape, dtype=a.dtype)
+            # like numpy, start from initial or the identity before the first element
+            start = ufunc.identity if initial is None else initial
+            if start is not None:
+                reduced[...] = start
+            driver = thread_reducecols if axis == 0 else thread_reducerows
+            if driver(ufunc, reduced, a, start is not None) is not None:
+                return reduced
+    if initial is not None:
+        return ufunc.reduce(a, axis=axis, dtype=dtype, out=out, initial=initial)
+    return ufunc.reduce(a, axis=axis, dtype=dtype, out=out)
+
+
+class reserve_cores():
+    """
+    Context manager that holds cores of the concurrency budget (see
+    ``thread_setbudget``) for another thread pool, so the worker threads leave
+    them alone. ``as`` gives the number of cores granted, which can be fewer
+    than asked for::
+
+        with reserve_cores(4) as granted:
+            with threadpoolctl.threadpool_limits(max(granted, 1), user_api='blas'):
+                np.dot(a, b)
+    """
+    def __init__(self, count):
+        self.count = count
+        self.granted = 0
+
+    def __enter__(self):
+        self.granted = thread_reserve(self.count)
+        return self.granted
+
+    def __exit__(self, *exc):
+        thread_unreserve(self.granted)
+        self.granted = 0
+        return False
+
+
 # TODO: move this to new location
 def debug_timeit(func=np.equal, ctypes=[np.bool, np.int8, np.int16, np.int32, np.int64, np.float32, np.float64], scalar=False, unary = False, outdtype=None, recycle=True):
     timedelta = np.zeros(len(ctypes), np.int64)
@@ -69,8 +69,8 @@ static stUFuncToAtop gBinaryMapping[]={
     {"multiply",      BINARY_OPERATION::MUL },
     {"true_divide",   BINARY_OPERATION::DIV },
     {"floor_divide",  BINARY_OPERATION::FLOORDIV },
-    //{"minimum",       BINARY_OPERATION::MIN },
-    //{"maximum",       BINARY_OPERATION::MAX },
+    {"minimum",       BINARY_OPERATION::MIN },
+    {"maximum",       BINARY_OPERATION::MAX },
     {"power",         BINARY_OPERATION::POWER },
     {"remainder",     BINARY_OPERATION::REMAINDER },
     {"logical_and",   BINARY_OPERATION::LOGICAL_AND },
@@ -193,13 +193,29 @@ struct stUFunc {
     PyUFuncGenericFunction  pOldFunc;
     REDUCE_FUNC             pReduceFunc;
 
-    // the maximum threads to deploy
+    // the maximum worker threads to deploy, 0 to pick from the length and cost of the op
     int32_t                 MaxThreads;
 
     // the minimum number of elements in the array before threading allowed
     int32_t                 MinElementsToThread;
+
+    // how expensive the op is per element, see WORK_COST
+    int32_t                 CostClass;
+
+    // itemsize of the output, used when calibrating
+    int32_t                 OutputItemSize;
+
+    // numpy dtype of the output, checked by thread_submit
+    int32_t                 OutputType;
 };
 
+// Bytes an element adds to a block for the block size cost model
+// A scalar (stride 0) is free, strided access costs at most a cache line
+static inline int64_t StrideBytes(npy_intp stride) {
+    if (stride < 0) stride = -stride;
+    return stride > 64 ? 64 : stride;
+}
+
 // global lookup tables for math opcode enum + dtype enum
 stUFunc  g_UFuncLUT[BINARY_OPERATION::BINARY_LAST][ATOP_LAST];
 stUFunc  g_CompFuncLUT[COMP_OPERATION::CMP_LAST][ATOP_LAST];
@@ -209,12 +225,55 @@ stUFunc  g_TrigFuncLUT[TRIG_OPERATION::TRIG_LAST][ATOP_LAST];
 // set to 0 to disable
 stSettings g_Settings = { 1, 0, 0, 0 };
 
+// How float sums are reduced, see atop_setsummode
+enum SUM_MODE {
+    SUM_PAIRWISE = 0,   // numpy's pairwise order, same result as numpy
+    SUM_FAST = 1,       // 4 vector accumulators then a serial loop
+    SUM_LAST = 2,
+};
+
+static int32_t g_SumMode = SUM_PAIRWISE;
+
+// Float reduces split into fixed blocks whatever the threads, see thread_setdeterministic
+static int32_t g_Deterministic = 0;
+static const int64_t DETERMINISTIC_BLOCK = CMathWorker::WORK_ITEM_CHUNK;
+
+static inline bool IsDeterministicReduce(int atype, REDUCE_FUNC pReduceFunc) {
+    return g_Deterministic && g_Settings.AtopEnabled && pReduceFunc && (atype == ATOP_FLOAT || atype == ATOP_DOUBLE);
+}
+
+static REDUCE_FUNC GetReduceFunc(int atop, int atype) {
+    REDUCE_FUNC pReduceFunc = NULL;
+    if (g_SumMode == SUM_PAIRWISE) {
+        pReduceFunc = GetReducePairwise(atop, atype);
+    }
+    return pReduceFunc ? pReduceFunc : GetReduceMathOpFast(atop, atype);
+}
+
+// Threads (including the calling thread) that worked on the last ufunc called from this thread, for the ledger
+static thread_local int32_t g_LedgerThreads = 1;
+
+// Threads and block size for a job of the ufunc, see CMathWorker::PlanWork
+// Threaded jobs also record their threads for the ledger
+static inline int32_t PlanUFuncWork(stMATH_WORKER_ITEM* pWorkItem, int64_t n, int64_t bytesPerElement, const stUFunc* pstUFunc, int64_t* pBlockSize) {
+    int32_t threads = THREADER->PlanWork(pWorkItem, n, bytesPerElement, pstUFunc->CostClass, pstUFunc->MaxThreads, pBlockSize);
+    if (pWorkItem) g_LedgerThreads = threads + 1;
+    return threads;
+}
+
 // Macro used just before call a ufunc
-#define LEDGER_START()    g_Settings.LedgerEnabled = 0; int64_t ledgerStartTime = __rdtsc();
+#define LEDGER_START()    g_Settings.LedgerEnabled = 0; g_LedgerThreads = 1; int64_t ledgerStartTime = __rdtsc();
 
 // Macro used just after ufunc call returns
-#define LEDGER_END(_cat_) g_Settings.LedgerEnabled = 1; LedgerRecord(_cat_, ledgerStartTime, (int64_t)__rdtsc(), args, dimensions, steps, innerloop, funcop, atype);
+#define LEDGER_END(_cat_) g_Settings.LedgerEnabled = 1; LedgerRecord(_cat_, ledgerStartTime, (int64_t)__rdtsc(), args, dimensions, steps, innerloop, funcop, atype, g_LedgerThreads);
+
 
+//------------------------------------------------------------------------------
+// Reduce one block into pOut
+// Each block starts from its own first element, the output val (which can be initial=) is used once in the reduce of reduce
+static inline void ReduceBlock(REDUCE_FUNC pReduceFunc, char* pFirst, char* pOut, int64_t len, int64_t stride) {
+    pReduceFunc(pFirst + stride, pOut, pFirst, len - 1, stride);
+}
 
 //------------------------------------------------------------------------------
 //  Concurrent callback from multiple threads
@@ -228,19 +287,19 @@ static int64_t ReduceThreadCallbackStrided(struct stMATH_WORKER_ITEM* pstWorkerI
     int64_t workBlock;
 
     // As long as there is work to do
-    while ((lenX = pstWorkerItem->GetNextWorkBlock(&workBlock)) > 0) {
+    while ((lenX = pstWorkerItem->GetNextWorkBlock(&workBlock, core)) > 0) {
 
         int64_t inputAdj2 = pstWorkerItem->BlockSize * workBlock * Callback->itemSizeIn2;
         int64_t outputAdj = workBlock * Callback->itemSizeOut;
 
         //printf("[%d] reduce on %lld with len %lld   block: %lld  itemsize: %lld\n", core, workIndex, lenX, workBlock, Callback->itemSizeIn2);
-        Callback->pReduceFunc(pDataIn2 + inputAdj2, pDataOut + outputAdj, Callback->pStartVal, lenX, Callback->itemSizeIn2);
+        ReduceBlock(Callback->pReduceFunc, pDataIn2 + inputAdj2, pDataOut + outputAdj, lenX, Callback->itemSizeIn2);
 
         // Indicate we completed a block
         didSomeWork++;
 
         // tell others we completed this work block
-        pstWorkerItem->CompleteWorkBlock();
+        pstWorkerItem->CompleteWorkBlock(core);
     }
 
     return didSomeWork;
@@ -258,7 +317,7 @@ static int64_t ReduceThreadCallbackNumpy(struct stMATH_WORKER_ITEM* pstWorkerIte
     int64_t workBlock;
 
     // As long as there is work to do
-    while ((lenX = pstWorkerItem->GetNextWorkBlock(&workBlock)) > 0) {
+    while ((lenX = pstWorkerItem->GetNextWorkBlock(&workBlock, core)) > 0) {
 
         int64_t inputAdj2 = pstWorkerItem->BlockSize * workBlock * Callback->itemSizeIn2;
         int64_t outputAdj = workBlock * Callback->itemSizeOut;
@@ -267,27 +326,29 @@ static int64_t ReduceThreadCallbackNumpy(struct stMATH_WORKER_ITEM* pstWorkerIte
         npy_intp dimensions[1];
         npy_intp steps[3];
 
+        char* pFirst = pDataIn2 + inputAdj2;
         args[0] = args[2] = pDataOut + outputAdj;
-        args[1] = pDataIn2 + inputAdj2;
-        dimensions[0] = lenX;
+        args[1] = pFirst + Callback->itemSizeIn2;
+        dimensions[0] = lenX - 1;
         steps[0] = 0;
         steps[2] = 0;
         steps[1] = Callback->itemSizeIn2;
 
         // this is also hackish
         // to set the start value, which is overloaded as first element in output value
+        // each block starts from its own first element, the output val is used once in the reduce of reduce
         switch (Callback->itemSizeOut) {
         case 1:
-            *(int8_t*)args[0] = *(int8_t*)(Callback->pStartVal);
+            *(int8_t*)args[0] = *(int8_t*)pFirst;
             break;
         case 2:
-            *(int16_t*)args[0] = *(int16_t*)(Callback->pStartVal);
+            *(int16_t*)args[0] = *(int16_t*)pFirst;
             break;
         case 4:
-            *(int32_t*)args[0] = *(int32_t*)(Callback->pStartVal);
+            *(int32_t*)args[0] = *(int32_t*)pFirst;
             break;
         case 8:
-            *(int64_t*)args[0] = *(int64_t*)(Callback->pStartVal);
+            *(int64_t*)args[0] = *(int64_t*)pFirst;
             break;
         }
 
@@ -298,7 +359,7 @@ static int64_t ReduceThreadCallbackNumpy(struct stMATH_WORKER_ITEM* pstWorkerIte
         didSomeWork++;
 
         // tell others we completed this work block
-        pstWorkerItem->CompleteWorkBlock();
+        pstWorkerItem->CompleteWorkBlock(core);
     }
 
     return didSomeWork;
@@ -318,7 +379,7 @@ static int64_t BinaryThreadCallbackStrided(struct stMATH_WORKER_ITEM* pstWorkerI
     int64_t workBlock;
 
     // As long as there is work to do
-    while ((lenX = pstWorkerItem->GetNextWorkBlock(&workBlock)) > 0) {
+    while ((lenX = pstWorkerItem->GetNextWorkBlock(&workBlock, core)) > 0) {
 
         int64_t inputAdj1 = pstWorkerItem->BlockSize * workBlock * Callback->itemSizeIn1;
         int64_t inputAdj2 = pstWorkerItem->BlockSize * workBlock * Callback->itemSizeIn2;
@@ -331,7 +392,7 @@ static int64_t BinaryThreadCallbackStrided(struct stMATH_WORKER_ITEM* pstWorkerI
         didSomeWork++;
 
         // tell others we completed this work block
-        pstWorkerItem->CompleteWorkBlock();
+        pstWorkerItem->CompleteWorkBlock(core);
         //printf("|%d %d", core, (int)workBlock);
     }
 
@@ -353,7 +414,7 @@ static int64_t BinaryThreadCallbackNumpy(struct stMATH_WORKER_ITEM* pstWorkerIte
     int64_t workBlock;
 
     // As long as there is work to do
-    while ((lenX = pstWorkerItem->GetNextWorkBlock(&workBlock)) > 0) {
+    while ((lenX = pstWorkerItem->GetNextWorkBlock(&workBlock, core)) > 0) {
 
         int64_t inputAdj1 = pstWorkerItem->BlockSize * workBlock * Callback->itemSizeIn1;
         int64_t inputAdj2 = pstWorkerItem->BlockSize * workBlock * Callback->itemSizeIn2;
@@ -369,7 +430,7 @@ static int64_t BinaryThreadCallbackNumpy(struct stMATH_WORKER_ITEM* pstWorkerIte
         didSomeWork++;
 
         // tell others we completed this work block
-        pstWorkerItem->CompleteWorkBlock();
+        pstWorkerItem->CompleteWorkBlock(core);
         //printf("|%d %d", core, (int)workBlock);
     }
 
@@ -390,7 +451,7 @@ static int64_t UnaryThreadCallbackNumpy(struct stMATH_WORKER_ITEM* pstWorkerItem
     int64_t workBlock;
 
     // As long as there is work to do
-    while ((lenX = pstWorkerItem->GetNextWorkBlock(&workBlock)) > 0) {
+    while ((lenX = pstWorkerItem->GetNextWorkBlock(&workBlock, core)) > 0) {
 
         int64_t inputAdj1 = pstWorkerItem->BlockSize * workBlock * Callback->itemSizeIn1;
         int64_t outputAdj = pstWorkerItem->BlockSize * workBlock * Callback->itemSizeOut;
@@ -406,7 +467,7 @@ static int64_t UnaryThreadCallbackNumpy(struct stMATH_WORKER_ITEM* pstWorkerItem
         didSomeWork++;
 
         // tell others we completed this work block
-        pstWorkerItem->CompleteWorkBlock();
+        pstWorkerItem->CompleteWorkBlock(core);
         //printf("|%d %d", core, (int)workBlock);
     }
 
@@ -425,7 +486,7 @@ static int64_t UnaryThreadCallbackStrided(struct stMATH_WORKER_ITEM* pstWorkerIt
     int64_t workBlock;
 
     // As long as there is work to do
-    while ((lenX = pstWorkerItem->GetNextWorkBlock(&workBlock)) > 0) {
+    while ((lenX = pstWorkerItem->GetNextWorkBlock(&workBlock, core)) > 0) {
 
         int64_t inputAdj1 = pstWorkerItem->BlockSize * workBlock * Callback->itemSizeIn1;
         int64_t outputAdj = pstWorkerItem->BlockSize * workBlock * Callback->itemSizeOut;
@@ -437,7 +498,7 @@ static int64_t UnaryThreadCallbackStrided(struct stMATH_WORKER_ITEM* pstWorkerIt
         didSomeWork++;
 
         // tell others we completed this work block
-        pstWorkerItem->CompleteWorkBlock();
+        pstWorkerItem->CompleteWorkBlock(core);
         //printf("|%d %d", core, (int)workBlock);
     }
 
@@ -452,17 +513,28 @@ static void AtopBinaryMathFunction(char** args, const npy_intp* dimensions, cons
     if (!g_Settings.LedgerEnabled) {
         stUFunc* pstUFunc = &g_UFuncLUT[funcop][atype];
         npy_intp n = dimensions[0];
-        stMATH_WORKER_ITEM* pWorkItem = THREADER->GetWorkItem(n);
+
+        // A deterministic reduce of a single block is never split
+        bool deterministic = IS_BINARY_REDUCE && IsDeterministicReduce(atype, pstUFunc->pReduceFunc);
+        int64_t minElements = pstUFunc->MinElementsToThread;
+        if (deterministic && minElements <= DETERMINISTIC_BLOCK) minElements = DETERMINISTIC_BLOCK + 1;
+
+        // The first input that is not a scalar picks the numa node (for a reduce it is the middle array)
+        int numaArg = steps[0] ? 0 : 1;
+        stMATH_WORKER_ITEM* pWorkItem = THREADER->GetWorkItem(n, args[numaArg], steps[numaArg], minElements);
         LOGGING("called with %d %d   funcp: %p  len:%lld   inputs: %p %p %p  steps: %lld %lld %lld\n", funcop, atype, g_UFuncLUT[funcop][atype].pOldFunc, (long long)n, args[0], args[1], args[2], (long long)steps[0], (long long)steps[1], (long long)steps[2]);
 
         if (IS_BINARY_REDUCE) {
             // In a numpy binary reduce, the middle array is the real array
             REDUCE_FUNC pReduceFunc = pstUFunc->pReduceFunc;
 
+            // Deterministic: more than one block is always split into the same blocks, threaded or not
+            deterministic = deterministic && n > DETERMINISTIC_BLOCK;
+
             LOGGING("pReduce %p   opcode:%d   dtype:%d   %lld %lld %lld %lld\n", pReduceFunc, funcop, atype, (long long)dimensions[0], (long long)steps[0], (long long)steps[1], (long long)steps[2]);
             char* ip2 = args[1];
             char* op1 = args[0];
-            if (!pWorkItem) {
+            if (!pWorkItem && !deterministic) {
                 // Not threaded
                 if (g_Settings.AtopEnabled && pReduceFunc) {
                     // Call fast vectorized function without any threading
@@ -474,9 +546,13 @@ static void AtopBinaryMathFunction(char** args, const npy_intp* dimensions, cons
                 }
             }
             else {
-                // Threaded
+                // Threaded (or deterministic)
                 int64_t itemsize = convert_atop_to_itemsize[atype];
-                int64_t chunks = 1 + ((n - 1) / THREADER->WORK_ITEM_CHUNK);
+                int64_t bytesPerElement = StrideBytes(steps[1]);
+                int64_t blockSize;
+                int32_t threads = PlanUFuncWork(pWorkItem, n, bytesPerElement, pstUFunc, &blockSize);
+                if (deterministic) blockSize = DETERMINISTIC_BLOCK;
+                int64_t chunks = 1 + ((n - 1) / blockSize);
                 int64_t allocsize = chunks * itemsize;
 
                 // try to alloc on stack for speed
@@ -493,16 +569,24 @@ static void AtopBinaryMathFunction(char** args, const npy_intp* dimensions, cons
                 stCallback.itemSizeIn2 = steps[1];
                 stCallback.itemSizeOut = itemsize; // sizeof(T)
 
-                pWorkItem->WorkCallbackArg = &stCallback;
-
                 // Each thread will call this routine with the callbackArg
                 if (g_Settings.AtopEnabled && pReduceFunc) {
-                    stCallback.pReduceFunc = pReduceFunc;
-                    pWorkItem->DoWorkCallback = ReduceThreadCallbackStrided;
-
-                    // This will notify the worker threads of a new work item
-                    // most functions are so fast, we do not need more than 4 worker threads
-                    THREADER->WorkMain(pWorkItem, n, pstUFunc->MaxThreads);
+                    if (pWorkItem) {
+                        stCallback.pReduceFunc = pReduceFunc;
+                        pWorkItem->WorkCallbackArg = &stCallback;
+                        pWorkItem->DoWorkCallback = ReduceThreadCallbackStrided;
+
+                        // This will notify the worker threads of a new work item
+                        // how many worker threads depends on the length and cost of the op
+                        THREADER->WorkMain(pWorkItem, n, threads, blockSize);
+                    }
+                    else {
+                        // Deterministic without threads, the same blocks one after another
+                        for (int64_t block = 0; block < chunks; block++) {
+                            int64_t lenX = block < chunks - 1 ? blockSize : n - block * blockSize;
+                            ReduceBlock(pReduceFunc, ip2 + block * blockSize * steps[1], pReduceOfReduce + block * itemsize, lenX, steps[1]);
+                        }
+                    }
                     pReduceFunc(pReduceOfReduce, op1, op1, chunks, itemsize);
                 }
                 else {
@@ -510,11 +594,12 @@ static void AtopBinaryMathFunction(char** args, const npy_intp* dimensions, cons
                     //
                     stCallback.pOldFunc = pstUFunc->pOldFunc;
                     stCallback.innerloop = innerloop;
+                    pWorkItem->WorkCallbackArg = &stCallback;
                     pWorkItem->DoWorkCallback = ReduceThreadCallbackNumpy;
 
                     // This will notify the worker threads of a new work item
-                    // most functions are so fast, we do not need more than 4 worker threads
-                    THREADER->WorkMain(pWorkItem, n, pstUFunc->MaxThreads);
+                    // how many worker threads depends on the length and cost of the op
+                    THREADER->WorkMain(pWorkItem, n, threads, blockSize);
 
                     // Finish it...
                     // Now perform same function over all the threaded results
@@ -594,9 +679,13 @@ static void AtopBinaryMathFunction(char** args, const npy_intp* dimensions, cons
 
                 pWorkItem->WorkCallbackArg = &stCallback;
 
+                int64_t bytesPerElement = StrideBytes(steps[0]) + StrideBytes(steps[1]) + StrideBytes(steps[2]);
+                int64_t blockSize;
+                int32_t threads = PlanUFuncWork(pWorkItem, n, bytesPerElement, pstUFunc, &blockSize);
+
                 // This will notify the worker threads of a new work item
-                // most functions are so fast, we do not need more than 4 worker threads
-                THREADER->WorkMain(pWorkItem, n, pstUFunc->MaxThreads);
+                // how many worker threads depends on the length and cost of the op
+                THREADER->WorkMain(pWorkItem, n, threads, blockSize);
             }
         }
         return;
@@ -617,7 +706,10 @@ static void AtopCompareMathFunction(char** args, const npy_intp* dimensions, con
         // LOGGING("comparison called with %d %d   funcp: %p  len: %lld\n", funcop, atype, g_CompFuncLUT[funcop][atype].pOldFunc, (long long)dimensions[0]);
         stUFunc* pstUFunc = &g_CompFuncLUT[funcop][atype];
         npy_intp n = dimensions[0];
-        stMATH_WORKER_ITEM* pWorkItem = THREADER->GetWorkItem(n);
+
+        // The first input that is not a scalar picks the numa node
+        int numaArg = steps[0] ? 0 : 1;
+        stMATH_WORKER_ITEM* pWorkItem = THREADER->GetWorkItem(n, args[numaArg], steps[numaArg], pstUFunc->MinElementsToThread);
         ANY_TWO_FUNC pBinaryFunc = pstUFunc->pBinaryFunc;
 
         // Check if threading allowed
@@ -661,9 +753,13 @@ static void AtopCompareMathFunction(char** args, const npy_intp* dimensions, con
 
             pWorkItem->WorkCallbackArg = &stCallback;
 
+            int64_t bytesPerElement = StrideBytes(steps[0]) + StrideBytes(steps[1]) + StrideBytes(steps[2]);
+            int64_t blockSize;
+            int32_t threads = PlanUFuncWork(pWorkItem, n, bytesPerElement, pstUFunc, &blockSize);
+
             // This will notify the worker threads of a new work item
-            // most functions are so fast, we do not need more than 4 worker threads
-            THREADER->WorkMain(pWorkItem, n, pstUFunc->MaxThreads);
+            // how many worker threads depends on the length and cost of the op
+            THREADER->WorkMain(pWorkItem, n, threads, blockSize);
         }
         return;
     }
@@ -686,7 +782,7 @@ static void AtopUnaryMathFunction(char** args, const npy_intp* dimensions, const
         UNARY_FUNC pUnaryFunc = pstUFunc->pUnaryFunc;
         LOGGING("unary called with %d %d   funcp: %p  len: %lld  inputs: %p %p  steps: %lld %lld\n", funcop, atype, g_UFuncLUT[funcop][atype].pOldFunc, n, args[0], args[1], (int64_t)steps[0], (int64_t)steps[1]);
 
-        stMATH_WORKER_ITEM* pWorkItem = THREADER->GetWorkItem(n);
+        stMATH_WORKER_ITEM* pWorkItem = THREADER->GetWorkItem(n, args[0], steps[0], pstUFunc->MinElementsToThread);
         int64_t strideOut = steps[1];
         if (strideOut == 0) {
             pUnaryFunc = NULL;
@@ -726,9 +822,13 @@ static void AtopUnaryMathFunction(char** args, const npy_intp* dimensions, const
                 stCallback.innerloop = innerloop;
                 pWorkItem->DoWorkCallback = UnaryThreadCallbackNumpy;
             }
+            int64_t bytesPerElement = StrideBytes(steps[0]) + StrideBytes(strideOut);
+            int64_t blockSize;
+            int32_t threads = PlanUFuncWork(pWorkItem, n, bytesPerElement, pstUFunc, &blockSize);
+
             // This will notify the worker threads of a new work item
-            // most functions are so fast, we do not need more than 4 worker threads
-            THREADER->WorkMain(pWorkItem, n, pstUFunc->MaxThreads);
+            // how many worker threads depends on the length and cost of the op
+            THREADER->WorkMain(pWorkItem, n, threads, blockSize);
         }
         return;
     }
@@ -748,7 +848,7 @@ static void AtopTrigMathFunction(char** args, const npy_intp* dimensions, const
         UNARY_FUNC pUnaryFunc = pstUFunc->pUnaryFunc;
         //printf("trig called with %d %d   funcp: %p  len: %lld  inputs: %p %p  steps: %lld %lld\n", funcop, atype, pstUFunc->pOldFunc, n, args[0], args[1], (int64_t)steps[0], (int64_t)steps[1]);
 
-        stMATH_WORKER_ITEM* pWorkItem = THREADER->GetWorkItem(n);
+        stMATH_WORKER_ITEM* pWorkItem = THREADER->GetWorkItem(n, args[0], steps[0], pstUFunc->MinElementsToThread);
         int64_t strideOut = steps[1];
         if (strideOut == 0) {
             pUnaryFunc = NULL;
@@ -788,9 +888,13 @@ static void AtopTrigMathFunction(char** args, const npy_intp* dimensions, const
                 stCallback.innerloop = innerloop;
                 pWorkItem->DoWorkCallback = UnaryThreadCallbackNumpy;
             }
+            int64_t bytesPerElement = StrideBytes(steps[0]) + StrideBytes(strideOut);
+            int64_t blockSize;
+            int32_t threads = PlanUFuncWork(pWorkItem, n, bytesPerElement, pstUFunc, &blockSize);
+
             // This will notify the worker threads of a new work item
-            // most functions are so fast, we do not need more than 4 worker threads
-            THREADER->WorkMain(pWorkItem, n, pstUFunc->MaxThreads);
+            // how many worker threads depends on the length and cost of the op
+            THREADER->WorkMain(pWorkItem, n, threads, blockSize);
         }
         return;
     }
@@ -891,11 +995,209 @@ PyObject* oldinit(PyObject *self, PyObject *args, PyObject *kwargs) {
 }
 
 
+//---------------------------------------------------------
+// Cost class for the block size, see WORK_COST
+static int32_t GetBinaryCost(int atop) {
+    switch (atop) {
+    case DIV:
+    case MOD:
+    case FLOORDIV:
+    case REMAINDER:
+    case FMOD:
+        return COST_LIGHT;
+    case POWER:
+    case ATAN2:
+    case HYPOT:
+        return COST_HEAVY;
+    }
+    return COST_MEMORY;
+}
+
+static int32_t GetUnaryCost(int atop) {
+    switch (atop) {
+    case SQRT:
+    case RECIPROCAL:
+        return COST_LIGHT;
+    }
+    return COST_MEMORY;
+}
+
+//---------------------------------------------------------
+// Calibration of MinElementsToThread
+// Each hooked loop is timed unthreaded and threaded on doubling lengths.
+// The first length from which threading is faster by CALIBRATE_MARGIN percent
+// becomes MinElementsToThread. If threading never wins it is turned off for the loop.
+static const int64_t CALIBRATE_MIN = 0x400;
+static const int64_t CALIBRATE_MAX = 0x80000;
+static const int     CALIBRATE_REPEAT = 3;
+static const int     CALIBRATE_MARGIN = 10;
+
+typedef void(*ATOP_DISPATCH)(char** args, const npy_intp* dimensions, const npy_intp* steps, void* innerloop, int funcop, int atype);
+
+template<typename T>
+static void CalibrateFill(char* pData, int64_t len, T value) {
+    T* pDataT = (T*)pData;
+    for (int64_t i = 0; i < len; i++) {
+        pDataT[i] = value;
+    }
+}
+
+// Fill with a value every op accepts (no divide by zero or log of 0)
+static void CalibrateFill(char* pData, int64_t len, int atype) {
+    switch (atype) {
+    case ATOP_BOOL:
+    case ATOP_INT8:
+    case ATOP_UINT8:  CalibrateFill<int8_t>(pData, len, 1); break;
+    case ATOP_INT16:
+    case ATOP_UINT16: CalibrateFill<int16_t>(pData, len, 1); break;
+    case ATOP_INT32:
+    case ATOP_UINT32: CalibrateFill<int32_t>(pData, len, 1); break;
+    case ATOP_INT64:
+    case ATOP_UINT64: CalibrateFill<int64_t>(pData, len, 1); break;
+    case ATOP_FLOAT:  CalibrateFill<float>(pData, len, 0.5f); break;
+    case ATOP_DOUBLE: CalibrateFill<double>(pData, len, 0.5); break;
+    }
+}
+
+// Returns the fastest of CALIBRATE_REPEAT calls in nanoseconds
+static int64_t CalibrateTime(ATOP_DISPATCH pDispatch, char** args, npy_intp len, const npy_intp* steps, int funcop, int atype) {
+    int64_t best = INT64_MAX;
+    for (int i = 0; i < CALIBRATE_REPEAT; i++) {
+        int64_t start = GetMonotonicNanos();
+        pDispatch(args, &len, steps, NULL, funcop, atype);
+        int64_t delta = GetMonotonicNanos() - start;
+        if (delta < best) best = delta;
+    }
+    return best;
+}
+
+// Returns the new MinElementsToThread
+// Threading has to win at two lengths in a row so one noisy timing does not count
+static int32_t CalibrateUFunc(stUFunc* pstUFunc, ATOP_DISPATCH pDispatch, char** args, const npy_intp* steps, int funcop, int atype) {
+    int64_t firstWin = 0;
+
+    for (int64_t len = CALIBRATE_MIN; len <= CALIBRATE_MAX; len *= 2) {
+        pstUFunc->MinElementsToThread = INT32_MAX;
+        int64_t single = CalibrateTime(pDispatch, args, (npy_intp)len, steps, funcop, atype);
+
+        pstUFunc->MinElementsToThread = 0;
+        int64_t threaded = CalibrateTime(pDispatch, args, (npy_intp)len, steps, funcop, atype);
+
+        if (threaded * 100 < single * (100 - CALIBRATE_MARGIN)) {
+            if (firstWin) return (int32_t)firstWin;
+            firstWin = len;
+        }
+        else {
+            firstWin = 0;
+        }
+    }
+    return firstWin ? (int32_t)firstWin : INT32_MAX;
+}
+
+// Calibrates every hooked loop with an atop routine
+// Returns a list of (ufunc name, dtype, MinElementsToThread)
+static PyObject* Calibrate() {
+    int64_t bufferSize = CALIBRATE_MAX * 8;
+    char* pBuffers[3];
+    for (int i = 0; i < 3; i++) {
+        pBuffers[i] = (char*)WORKSPACE_ALLOC(bufferSize);
+    }
+
+    // Calibrate with threading and atop on, the ledger off
+    stSettings oldSettings = g_Settings;
+    BOOL oldNoThreading = THREADER->NoThreading;
+    g_Settings.AtopEnabled = TRUE;
+    g_Settings.LedgerEnabled = FALSE;
+    THREADER->NoThreading = FALSE;
+
+    PyObject* result = PyList_New(0);
+
+    for (int32_t category = 0; category < OPCAT_LAST; category++) {
+        stOpCategory* pstOpCategory = &gOpCategory[category];
+
+        for (int32_t i = 0; i < pstOpCategory->NumOps; i++) {
+            int funcop = pstOpCategory->pUFuncToAtop[i].atop_op;
+
+            for (int atype = 0; atype < ATOP_LAST; atype++) {
+                stUFunc* pstUFunc = NULL;
+                ATOP_DISPATCH pDispatch = NULL;
+                int nargs = 3;
+
+                switch (category) {
+                case OPCAT_BINARY:
+                    pstUFunc = &g_UFuncLUT[funcop][atype];
+                    pDispatch = AtopBinaryMathFunction;
+                    break;
+                case OPCAT_COMPARE:
+                    pstUFunc = &g_CompFuncLUT[funcop][atype];
+                    pDispatch = AtopCompareMathFunction;
+                    break;
+                case OPCAT_UNARY:
+                    pstUFunc = &g_UnaryFuncLUT[funcop][atype];
+                    pDispatch = AtopUnaryMathFunction;
+                    nargs = 2;
+                    break;
+                case OPCAT_TRIG:
+                    pstUFunc = &g_TrigFuncLUT[funcop][atype];
+                    pDispatch = AtopTrigMathFunction;
+                    nargs = 2;
+                    break;
+                }
+
+                // Loops without an atop routine need the numpy innerloop to be called
+                if (!pstUFunc->pBinaryFunc || !pstUFunc->pOldFunc || !pstUFunc->OutputItemSize) continue;
+
+                npy_intp steps[3];
+                steps[0] = convert_atop_to_itemsize[atype];
+                steps[1] = nargs == 3 ? steps[0] : pstUFunc->OutputItemSize;
+                steps[2] = pstUFunc->OutputItemSize;
+
+                CalibrateFill(pBuffers[0], CALIBRATE_MAX, atype);
+                CalibrateFill(pBuffers[1], CALIBRATE_MAX, atype);
+                memset(pBuffers[2], 0, bufferSize);
+
+                char* args[3] = { pBuffers[0], nargs == 3 ? pBuffers[1] : pBuffers[2], pBuffers[2] };
+                int32_t minElements = CalibrateUFunc(pstUFunc, pDispatch, args, steps, funcop, atype);
+                pstUFunc->MinElementsToThread = minElements;
+
+                PyObject* item = Py_BuildValue("(sNi)",
+                    pstOpCategory->pUFuncToAtop[i].str_ufunc_name,
+                    (PyObject*)PyArray_DescrFromType(convert_atop_to_dtype[atype]),
+                    minElements);
+                PyList_Append(result, item);
+                Py_XDECREF(item);
+            }
+        }
+    }
+
+    g_Settings = oldSettings;
+    THREADER->NoThreading = oldNoThreading;
+
+    for (int i = 0; i < 3; i++) {
+        WORKSPACE_FREE(pBuffers[i]);
+    }
+    return result;
+}
+
+extern "C"
+PyObject * thread_calibrate(PyObject * self, PyObject * args) {
+    if (THREADER && g_avx2) {
+        return Calibrate();
+    }
+    RETURN_NONE;
+}
+
 extern "C"
 PyObject* newinit(PyObject* self, PyObject* args, PyObject* kwargs) {
     int dtypes[] = { NPY_BOOL, NPY_INT8, NPY_UINT8,  NPY_INT16, NPY_UINT16,  NPY_INT32, NPY_UINT32,  NPY_INT64, NPY_UINT64, NPY_FLOAT32, NPY_FLOAT64 };
     //int dtypes[] = {  NPY_INT32,  NPY_INT64};
 
+    static const char* kwlist[] = { "calibrate", NULL };
+    int calibrate = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|p:initialize", (char**)kwlist, &calibrate)) {
+        return NULL;
+    }
+
     // Init atop: array threading operations
     if (atop_init() && g_avx2) {
         memset(g_UFuncLUT, 0, sizeof(g_UFuncLUT));
@@ -946,9 +1248,10 @@ PyObject* newinit(PyObject* self, PyObject* args, PyObject* kwargs) {
 
                 signature[2] = -1;
                 ANY_TWO_FUNC pBinaryFunc = GetSimpleMathOpFast(atop, atype, atype, &signature[2]);
-                REDUCE_FUNC  pReduceFunc = GetReduceMathOpFast(atop, atype);
+                REDUCE_FUNC  pReduceFunc = GetReduceFunc(atop, atype);
 
                 if (signature[2] != -1) {
+                    int32_t outputItemSize = convert_atop_to_itemsize[signature[2]];
                     signature[2] = convert_atop_to_dtype[signature[2]];
 
                     int ret = PyUFunc_ReplaceLoopBySignature((PyUFuncObject*)ufunc, g_UFuncGenericLUT[atop][atype], signature, &oldFunc);
@@ -962,7 +1265,11 @@ PyObject* newinit(PyObject* self, PyObject* args, PyObject* kwargs) {
                     pstUFunc->pOldFunc = oldFunc;
                     pstUFunc->pBinaryFunc = pBinaryFunc;
                     pstUFunc->pReduceFunc = pReduceFunc;
-                    pstUFunc->MaxThreads = 4;
+                    pstUFunc->MaxThreads = 0;
+                    pstUFunc->CostClass = GetBinaryCost(atop);
+                    pstUFunc->MinElementsToThread = CMathWorker::WORK_ITEM_BIG;
+                    pstUFunc->OutputItemSize = outputItemSize;
+                    pstUFunc->OutputType = signature[2];
                 }
             }
         }
@@ -992,6 +1299,7 @@ PyObject* newinit(PyObject* self, PyObject* args, PyObject* kwargs) {
                 int atype = convert_dtype_to_atop[dtype];
 
                 ANY_TWO_FUNC pBinaryFunc = GetComparisonOpFast(atop, atype, atype, &signature[2]);
+                int32_t outputItemSize = convert_atop_to_itemsize[signature[2]];
                 signature[2] = convert_atop_to_dtype[signature[2]];
 
                 int ret = PyUFunc_ReplaceLoopBySignature((PyUFuncObject*)ufunc, g_UFuncCompareLUT[atop][atype], signature, &oldFunc);
@@ -1005,7 +1313,11 @@ PyObject* newinit(PyObject* self, PyObject* args, PyObject* kwargs) {
                 // Store the new function to call and the previous ufunc
                 pstUFunc->pOldFunc = oldFunc;
                 pstUFunc->pBinaryFunc = pBinaryFunc;
-                pstUFunc->MaxThreads = 4;
+                pstUFunc->MaxThreads = 0;
+                pstUFunc->CostClass = COST_MEMORY;
+                pstUFunc->MinElementsToThread = CMathWorker::WORK_ITEM_BIG;
+                pstUFunc->OutputItemSize = outputItemSize;
+                pstUFunc->OutputType = signature[2];
             }
         }
 
@@ -1038,6 +1350,7 @@ PyObject* newinit(PyObject* self, PyObject* args, PyObject* kwargs) {
                 UNARY_FUNC pUnaryFunc = GetUnaryOpFast(atop, atype, &signature[1]);
 
                 if (signature[1] != -1) {
+                    int32_t outputItemSize = convert_atop_to_itemsize[signature[1]];
                     signature[1] = convert_atop_to_dtype[signature[1]];
 
                     int ret = PyUFunc_ReplaceLoopBySignature((PyUFuncObject*)ufunc, g_UFuncUnaryLUT[atop][atype], signature, &oldFunc);
@@ -1049,7 +1362,11 @@ PyObject* newinit(PyObject* self, PyObject* args, PyObject* kwargs) {
                     // Store the new function to call and the previous ufunc
                     pstUFunc->pOldFunc = oldFunc;
                     pstUFunc->pUnaryFunc = pUnaryFunc;
-                    pstUFunc->MaxThreads = 4;
+                    pstUFunc->MaxThreads = 0;
+                    pstUFunc->CostClass = GetUnaryCost(atop);
+                    pstUFunc->MinElementsToThread = CMathWorker::WORK_ITEM_BIG;
+                    pstUFunc->OutputItemSize = outputItemSize;
+                    pstUFunc->OutputType = signature[1];
                 }
             }
         }
@@ -1094,6 +1411,7 @@ PyObject* newinit(PyObject* self, PyObject* args, PyObject* kwargs) {
                 //if (!pUnaryFunc) {
                 //    pUnaryFunc = GetTrigOpSlow(atop, atype, &signature[1]);
                 //}
+                int32_t outputItemSize = pUnaryFunc ? convert_atop_to_itemsize[signature[1]] : 0;
                 signature[1] = convert_atop_to_dtype[signature[1]];
 
                 // Even if pUnaryFunc is NULL, still hook it since we can thread it
@@ -1108,12 +1426,21 @@ PyObject* newinit(PyObject* self, PyObject* args, PyObject* kwargs) {
 
                 // NULL allowed here, it will use the default
                 pstUFunc->pUnaryFunc = pUnaryFunc;
-                pstUFunc->MaxThreads = 5;
+                pstUFunc->MaxThreads = 0;
+                pstUFunc->CostClass = COST_HEAVY;
+                pstUFunc->MinElementsToThread = CMathWorker::WORK_ITEM_BIG;
+                pstUFunc->OutputItemSize = outputItemSize;
+                pstUFunc->OutputType = signature[1];
             }
         }
 
         LedgerInit();
 
+        if (calibrate) {
+            PyObject* calibrated = Calibrate();
+            Py_XDECREF(calibrated);
+        }
+
         RETURN_NONE;
     }
     return PyErr_Format(PyExc_ImportError, "atop was either already loaded or failed to load");
@@ -1139,6 +1466,66 @@ PyObject* atop_isenabled(PyObject* self, PyObject* args) {
     RETURN_FALSE;
 }
 
+// See SUM_MODE
+static const char* gStrSumMode[SUM_LAST] = {
+    "pairwise",
+    "fast",
+};
+
+// Returns previous sum mode name
+extern "C"
+PyObject * atop_setsummode(PyObject * self, PyObject * args) {
+    const char* name = NULL;
+    if (!PyArg_ParseTuple(args, "s:atop_setsummode", &name)) {
+        return NULL;
+    }
+    for (int32_t i = 0; i < SUM_LAST; i++) {
+        if (strcmp(name, gStrSumMode[i]) == 0) {
+            int32_t previousVal = g_SumMode;
+            g_SumMode = i;
+
+            // Repoint the float sums already hooked, a reduce running now finishes with the old one
+            int sumTypes[] = { ATOP_FLOAT, ATOP_DOUBLE };
+            for (int32_t j = 0; j < 2; j++) {
+                stUFunc* pstUFunc = &g_UFuncLUT[BINARY_OPERATION::ADD][sumTypes[j]];
+                if (pstUFunc->pOldFunc) {
+                    pstUFunc->pReduceFunc = GetReduceFunc(BINARY_OPERATION::ADD, sumTypes[j]);
+                }
+            }
+            return PyUnicode_FromString(gStrSumMode[previousVal]);
+        }
+    }
+    return PyErr_Format(PyExc_ValueError, "unknown sum mode '%s'", name);
+}
+
+extern "C"
+PyObject * atop_getsummode(PyObject * self, PyObject * args) {
+    return PyUnicode_FromString(gStrSumMode[g_SumMode]);
+}
+
+// Returns previous value
+extern "C"
+PyObject * thread_setdeterministic(PyObject * self, PyObject * args) {
+    int on = 0;
+    if (!PyArg_ParseTuple(args, "p:thread_setdeterministic", &on)) {
+        return NULL;
+    }
+    int32_t previousVal = g_Deterministic;
+    g_Deterministic = on;
+    if (previousVal) {
+        RETURN_TRUE;
+    }
+    RETURN_FALSE;
+}
+
+extern "C"
+PyObject * thread_getdeterministic(PyObject * self, PyObject * args) {
+    if (g_Deterministic) {
+        RETURN_TRUE;
+    }
+    RETURN_FALSE;
+}
+
 extern "C"
 PyObject * thread_enable(PyObject * self, PyObject * args) {
     if (THREADER) THREADER->NoThreading= FALSE;
@@ -1185,6 +1572,1427 @@ PyObject * thread_getworkers(PyObject * self, PyObject * args) {
     RETURN_NONE;
 }
 
+// Starts or stops worker threads, returns previous number of worker threads
+extern "C"
+PyObject * thread_setpoolsize(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        int count = 0;
+        if (!PyArg_ParseTuple(args, "i:thread_setpoolsize", &count)) {
+            return NULL;
+        }
+        if (count < 0 || count > MAX_THREADS_ALLOWED) {
+            PyErr_Format(PyExc_ValueError, "pool size must be between 0 and %d", MAX_THREADS_ALLOWED);
+            return NULL;
+        }
+        int previousVal = THREADER->SetWorkerThreadCount(count);
+        return PyLong_FromLong((long)previousVal);
+    }
+    RETURN_NONE;
+}
+
+extern "C"
+PyObject * thread_getpoolsize(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        return PyLong_FromLong((long)THREADER->WorkerThreadCount);
+    }
+    RETURN_NONE;
+}
+
+// Returns previous spin in microseconds
+extern "C"
+PyObject * thread_setspin(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        double micros = 0;
+        int backoff = 1;
+        if (!PyArg_ParseTuple(args, "d|p:thread_setspin", &micros, &backoff)) {
+            return NULL;
+        }
+        int64_t previousVal = THREADER->SetSpin((int64_t)(micros * 1000.0), backoff);
+        return PyFloat_FromDouble((double)previousVal / 1000.0);
+    }
+    RETURN_NONE;
+}
+
+extern "C"
+PyObject * thread_getspin(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        stWorkerRing* pWorkerRing = THREADER->pWorkerRing;
+        return Py_BuildValue("(dO)", (double)pWorkerRing->SpinNanos / 1000.0, pWorkerRing->SpinBackoff ? Py_True : Py_False);
+    }
+    RETURN_NONE;
+}
+
+// Returns a dict with the counters summed over all worker threads
+extern "C"
+PyObject * thread_spinstats(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        int64_t spinWakes = 0;
+        int64_t sleepWaits = 0;
+        int64_t wakesSkipped = 0;
+        for (int32_t i = 0; i < THREADER->WorkerThreadCount; i++) {
+            spinWakes += THREADER->WorkerThreads[i].pStats->SpinWakes;
+            sleepWaits += THREADER->WorkerThreads[i].pStats->SleepWaits;
+        }
+        for (int32_t g = 0; g < THREADER->NumaNodeCount; g++) {
+            wakesSkipped += THREADER->pWorkerRings[g]->WakesSkipped;
+        }
+        return Py_BuildValue("{s:L,s:L,s:L}",
+            "spin_wakes", (long long)spinWakes,
+            "sleep_waits", (long long)sleepWaits,
+            "wakes_skipped", (long long)wakesSkipped);
+    }
+    RETURN_NONE;
+}
+
+// Returns previous main thread spin in microseconds
+extern "C"
+PyObject * thread_setwaitspin(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        double micros = 0;
+        if (!PyArg_ParseTuple(args, "d:thread_setwaitspin", &micros)) {
+            return NULL;
+        }
+        int64_t previousVal = THREADER->SetWaitSpin((int64_t)(micros * 1000.0));
+        return PyFloat_FromDouble((double)previousVal / 1000.0);
+    }
+    RETURN_NONE;
+}
+
+// Returns a dict with how the threads submitting jobs waited for them to complete
+extern "C"
+PyObject * thread_waitstats(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        return Py_BuildValue("{s:L,s:L,s:L,s:L,s:L}",
+            "spin_count", (long long)THREADER->WaitSpinCount,
+            "spin_ns", (long long)THREADER->WaitSpinNanosTotal,
+            "blocked_count", (long long)THREADER->WaitBlockedCount,
+            "blocked_ns", (long long)THREADER->WaitBlockedNanosTotal,
+            "slots_full", (long long)THREADER->ProducerSlotsFull);
+    }
+    RETURN_NONE;
+}
+
+// Returns previous total of the concurrency budget, 0 means no budget
+extern "C"
+PyObject * thread_setbudget(PyObject * self, PyObject * args) {
+    long long total = 0;
+    if (!PyArg_ParseTuple(args, "L:thread_setbudget", &total)) {
+        return NULL;
+    }
+    if (total < 0) {
+        return PyErr_Format(PyExc_ValueError, "budget must be at least 0, got %lld", total);
+    }
+    return PyLong_FromLongLong(BudgetSetTotal(total));
+}
+
+extern "C"
+PyObject * thread_getbudget(PyObject * self, PyObject * args) {
+    return PyLong_FromLongLong(g_Budget.Total);
+}
+
+// Returns a dict with the tokens of the concurrency budget
+extern "C"
+PyObject * thread_budgetstats(PyObject * self, PyObject * args) {
+    int64_t available = BudgetAvailable();
+    return Py_BuildValue("{s:L,s:L,s:L,s:L,s:L}",
+        "total", (long long)g_Budget.Total,
+        "in_use", (long long)g_Budget.InUse,
+        "reserved", (long long)g_Budget.Reserved,
+        "available", (long long)(g_Budget.Total > 0 ? available : -1),
+        "denied", (long long)g_Budget.Denied);
+}
+
+// Another pool takes cores from the budget, returns how many were granted
+extern "C"
+PyObject * thread_reserve(PyObject * self, PyObject * args) {
+    int count = 0;
+    if (!PyArg_ParseTuple(args, "i:thread_reserve", &count)) {
+        return NULL;
+    }
+    return PyLong_FromLong(BudgetReserve(count));
+}
+
+extern "C"
+PyObject * thread_unreserve(PyObject * self, PyObject * args) {
+    int count = 0;
+    if (!PyArg_ParseTuple(args, "i:thread_unreserve", &count)) {
+        return NULL;
+    }
+    if (count > g_Budget.Reserved) {
+        return PyErr_Format(PyExc_ValueError, "only %lld cores are reserved", (long long)g_Budget.Reserved);
+    }
+    BudgetUnreserve(count);
+    RETURN_NONE;
+}
+
+// Returns previous block size, 0 means picked per job
+extern "C"
+PyObject * thread_setblocksize(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        long long blockSize = 0;
+        if (!PyArg_ParseTuple(args, "L:thread_setblocksize", &blockSize)) {
+            return NULL;
+        }
+        int64_t previousVal = THREADER->SetBlockSize(blockSize);
+        return PyLong_FromLongLong(previousVal);
+    }
+    RETURN_NONE;
+}
+
+extern "C"
+PyObject * thread_getblocksize(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        return PyLong_FromLongLong(THREADER->BlockSizeOverride);
+    }
+    RETURN_NONE;
+}
+
+// Returns previous latency lane size in bytes, 0 means no latency lane
+extern "C"
+PyObject * thread_setlatencybytes(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        long long bytes = 0;
+        if (!PyArg_ParseTuple(args, "L:thread_setlatencybytes", &bytes)) {
+            return NULL;
+        }
+        int64_t previousVal = THREADER->SetLatencyBytes(bytes);
+        return PyLong_FromLongLong(previousVal);
+    }
+    RETURN_NONE;
+}
+
+extern "C"
+PyObject * thread_getlatencybytes(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        return PyLong_FromLongLong(THREADER->LatencyBytes);
+    }
+    RETURN_NONE;
+}
+
+//-----------------------------------
+// Returns the loops (one per atop type) for a ufunc name, NULL if not known
+// pCategory (optional) gets the OP_CATEGORY of the ufunc
+static stUFunc* FindUFuncLoops(const char* name, int32_t* pCategory = NULL) {
+    for (int32_t category = 0; category < OPCAT_LAST; category++) {
+        stOpCategory* pstOpCategory = &gOpCategory[category];
+
+        for (int32_t i = 0; i < pstOpCategory->NumOps; i++) {
+            if (strcmp(pstOpCategory->pUFuncToAtop[i].str_ufunc_name, name) != 0) continue;
+
+            int funcop = pstOpCategory->pUFuncToAtop[i].atop_op;
+            if (pCategory) *pCategory = category;
+            switch (category) {
+            case OPCAT_BINARY:
+                return g_UFuncLUT[funcop];
+            case OPCAT_COMPARE:
+                return g_CompFuncLUT[funcop];
+            case OPCAT_UNARY:
+                return g_UnaryFuncLUT[funcop];
+            case OPCAT_TRIG:
+                return g_TrigFuncLUT[funcop];
+            }
+        }
+    }
+    return NULL;
+}
+
+// Caps the worker threads for every dtype of a ufunc, 0 picks them per call
+// Returns previous val
+extern "C"
+PyObject * thread_setmaxthreads(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        const char* name = NULL;
+        int maxThreads = 0;
+        if (!PyArg_ParseTuple(args, "si:thread_setmaxthreads", &name, &maxThreads)) {
+            return NULL;
+        }
+        stUFunc* pLoops = FindUFuncLoops(name);
+        if (!pLoops) {
+            PyErr_Format(PyExc_ValueError, "thread_setmaxthreads: unknown ufunc '%s'", name);
+            return NULL;
+        }
+        if (maxThreads < 0) maxThreads = 0;
+
+        int previousVal = pLoops[0].MaxThreads;
+        for (int atype = 0; atype < ATOP_LAST; atype++) {
+            pLoops[atype].MaxThreads = maxThreads;
+        }
+        return PyLong_FromLong((long)previousVal);
+    }
+    RETURN_NONE;
+}
+
+extern "C"
+PyObject * thread_getmaxthreads(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        const char* name = NULL;
+        if (!PyArg_ParseTuple(args, "s:thread_getmaxthreads", &name)) {
+            return NULL;
+        }
+        stUFunc* pLoops = FindUFuncLoops(name);
+        if (!pLoops) {
+            PyErr_Format(PyExc_ValueError, "thread_getmaxthreads: unknown ufunc '%s'", name);
+            return NULL;
+        }
+        return PyLong_FromLong((long)pLoops[0].MaxThreads);
+    }
+    RETURN_NONE;
+}
+
+//-----------------------------------
+// A ufunc started on the worker threads by thread_submit
+// The capsule returned to python owns it
+// The worker completing the last block gives back the work item, so a job nobody
+// waits on does not keep its producer slot or the latency lane count
+struct stAsyncJob {
+    // Holds a newer job once this one is given back, see Serial
+    stMATH_WORKER_ITEM* pWorkItem;
+
+    // Set to 1 by the one thread that helps with the work in WorkJoin
+    int64_t             Joining;
+
+    // Returned by WorkStart, the work item may hold a newer job once this one is done
+    int64_t             Serial;
+
+    // g_ForkGeneration at submit, a child process of a fork has a newer one
+    int64_t             ForkGeneration;
+
+    // Number of elements, to run the job again in a forked child
+    int64_t             Length;
+
+    // out is the same array as an input, the job cannot be run again
+    BOOL                InPlace;
+
+    // Set to 1 once a thread waited on the job and dropped the arrays
+    volatile int64_t    Done;
+
+    UFUNC_CALLBACK      Callback;
+
+    // Keeps the arrays alive until the job is complete, pArrays[2] is NULL for a unary ufunc
+    PyObject*           pArrays[3];
+};
+
+static const char* ASYNC_JOB_NAME = "fast_numpy_loops.job";
+
+static void AsyncJobDrop(stAsyncJob* pJob) {
+    for (int i = 0; i < 3; i++) {
+        Py_CLEAR(pJob->pArrays[i]);
+    }
+    pJob->Done = 1;
+}
+
+// TRUE if the job was submitted before a fork and this is the child
+// The threads that ran it are gone and out may be partly written
+static BOOL AsyncJobForked(stAsyncJob* pJob) {
+    return pJob->ForkGeneration != g_ForkGeneration;
+}
+
+// Runs a job from before the fork again on the calling thread, over all elements
+// Returns FALSE with a python error set if out is an input, its first blocks may already be done
+static BOOL AsyncJobRerun(stAsyncJob* pJob) {
+    if (pJob->InPlace) {
+        PyErr_SetString(PyExc_RuntimeError, "thread_wait: job was in flight at a fork and writes in place, it cannot be run again in the child");
+        return FALSE;
+    }
+    const UFUNC_CALLBACK* pCallback = &pJob->Callback;
+    Py_BEGIN_ALLOW_THREADS
+    if (pJob->pArrays[2]) {
+        pCallback->pBinaryFunc(pCallback->pDataIn1, pCallback->pDataIn2, pCallback->pDataOut, pJob->Length, pCallback->itemSizeIn1, pCallback->itemSizeIn2, pCallback->itemSizeOut);
+    }
+    else {
+        pCallback->pUnaryFunc(pCallback->pDataIn1, pCallback->pDataOut, pJob->Length, pCallback->itemSizeIn1, pCallback->itemSizeOut);
+    }
+    Py_END_ALLOW_THREADS
+    AsyncJobDrop(pJob);
+    return TRUE;
+}
+
+// Called with the GIL held
+// Returns FALSE with a python error set when the job cannot be completed
+static BOOL AsyncJobWait(stAsyncJob* pJob) {
+    if (pJob->Done) {
+        return TRUE;
+    }
+
+    THREADER->CheckFork();
+    if (AsyncJobForked(pJob)) {
+        return AsyncJobRerun(pJob);
+    }
+
+    stMATH_WORKER_ITEM* pWorkItem = pJob->pWorkItem;
+    if (!pJob->Joining) {
+        // Only one thread helps with the work, it drops the arrays
+        pJob->Joining = 1;
+
+        Py_BEGIN_ALLOW_THREADS
+        THREADER->WorkJoin(pWorkItem, pJob->Serial);
+        Py_END_ALLOW_THREADS
+
+        AsyncJobDrop(pJob);
+    }
+    else {
+        // Another thread is in WorkJoin, sleep until the job is given back
+        Py_BEGIN_ALLOW_THREADS
+        THREADER->WaitReleased(pWorkItem, pJob->Serial);
+        Py_END_ALLOW_THREADS
+    }
+    return TRUE;
+}
+
+static void AsyncJobDestructor(PyObject* capsule) {
+    stAsyncJob* pJob = (stAsyncJob*)PyCapsule_GetPointer(capsule, ASYNC_JOB_NAME);
+    if (pJob) {
+        // The workers may still be writing to the output, in a forked child nobody is
+        if (!pJob->Done) {
+            THREADER->CheckFork();
+            if (AsyncJobForked(pJob)) {
+                AsyncJobDrop(pJob);
+            }
+            else {
+                AsyncJobWait(pJob);
+            }
+        }
+        WORKSPACE_FREE(pJob);
+    }
+}
+
+// Same as above for a ufunc or its name
+// Sets a python error and returns NULL if not known
+static stUFunc* FindUFuncLoops(PyObject* ufunc, int32_t* pCategory, const char* caller) {
+    PyObject* nameBytes = NULL;
+    if (PyUnicode_Check(ufunc)) {
+        nameBytes = PyUnicode_AsUTF8String(ufunc);
+    }
+    else {
+        PyObject* name = PyObject_GetAttrString(ufunc, "__name__");
+        nameBytes = name ? PyUnicode_AsUTF8String(name) : NULL;
+        Py_XDECREF(name);
+    }
+    if (!nameBytes) {
+        return NULL;
+    }
+    stUFunc* pLoops = FindUFuncLoops(PyBytes_AsString(nameBytes), pCategory);
+    if (!pLoops) {
+        PyErr_Format(PyExc_ValueError, "%s: unknown ufunc '%s'", caller, PyBytes_AsString(nameBytes));
+    }
+    Py_DECREF(nameBytes);
+    return pLoops;
+}
+
+// Returns the numpy array or NULL if obj is not a C contiguous, aligned array in native byte order
+// The atop loops read the elements directly, numpy would have copied a byteswapped array first
+static PyArrayObject* AsyncArray(PyObject* obj) {
+    if (!obj || !PyArray_Check(obj)) return NULL;
+    PyArrayObject* pArray = (PyArrayObject*)obj;
+    return PyArray_ISCARRAY_RO(pArray) ? pArray : NULL;
+}
+
+// Returns TRUE if out shares any byte with in, other than being the very same array (in place)
+// A block written by one thread may hold elements another thread has yet to read
+static BOOL AsyncOverlap(PyArrayObject* pOut, PyArrayObject* pIn) {
+    char* pOutput = PyArray_BYTES(pOut);
+    char* pInput = PyArray_BYTES(pIn);
+    if (pOutput == pInput && PyArray_ITEMSIZE(pOut) == PyArray_ITEMSIZE(pIn)) {
+        return FALSE;
+    }
+    return pOutput < pInput + PyArray_NBYTES(pIn) && pInput < pOutput + PyArray_NBYTES(pOut);
+}
+
+// Starts ufunc(in1[, in2], out=out) on the worker threads and returns a job handle
+// Returns None when the call is not supported (python then calls the ufunc)
+extern "C"
+PyObject * thread_submit(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        PyObject* ufunc = NULL;
+        PyObject* out = NULL;
+        PyObject* in1 = NULL;
+        PyObject* in2 = NULL;
+        if (!PyArg_ParseTuple(args, "OOO|O:thread_submit", &ufunc, &out, &in1, &in2)) {
+            return NULL;
+        }
+
+        int32_t category = -1;
+        stUFunc* pLoops = FindUFuncLoops(ufunc, &category, "thread_submit");
+        if (!pLoops) {
+            return NULL;
+        }
+
+        BOOL binary = category == OPCAT_BINARY || category == OPCAT_COMPARE;
+        if (binary != (in2 != NULL)) {
+            return PyErr_Format(PyExc_TypeError, "thread_submit: ufunc takes %d inputs", binary ? 2 : 1);
+        }
+
+        PyArrayObject* pOut = AsyncArray(out);
+        PyArrayObject* pIn1 = AsyncArray(in1);
+        PyArrayObject* pIn2 = binary ? AsyncArray(in2) : pIn1;
+
+        // Only same type, same length, contiguous arrays with an atop loop
+        if (!pOut || !pIn1 || !pIn2 || !g_Settings.AtopEnabled || !PyArray_ISWRITEABLE(pOut)) {
+            RETURN_NONE;
+        }
+
+        int dtype = PyArray_TYPE(pIn1);
+        npy_intp n = PyArray_SIZE(pIn1);
+        if (dtype < 0 || dtype > NPY_VOID || PyArray_TYPE(pIn2) != dtype) {
+            RETURN_NONE;
+        }
+        if (PyArray_SIZE(pIn2) != n || PyArray_SIZE(pOut) != n) {
+            RETURN_NONE;
+        }
+
+        int atype = convert_dtype_to_atop[dtype];
+        if (atype < 0 || atype >= ATOP_LAST) {
+            RETURN_NONE;
+        }
+
+        stUFunc* pstUFunc = &pLoops[atype];
+        if (!pstUFunc->pBinaryFunc || !pstUFunc->pOldFunc || PyArray_TYPE(pOut) != pstUFunc->OutputType) {
+            RETURN_NONE;
+        }
+
+        char* pInput1 = PyArray_BYTES(pIn1);
+        char* pInput2 = PyArray_BYTES(pIn2);
+        char* pOutput = PyArray_BYTES(pOut);
+
+        // numpy would copy an input that overlaps out, the threads cannot
+        if (AsyncOverlap(pOut, pIn1) || AsyncOverlap(pOut, pIn2)) {
+            RETURN_NONE;
+        }
+
+        // Before the work item, which cannot be given back once taken without starting it
+        stAsyncJob* pJob = (stAsyncJob*)WORKSPACE_ALLOC(sizeof(stAsyncJob));
+        if (!pJob) {
+            return PyErr_NoMemory();
+        }
+
+        stMATH_WORKER_ITEM* pWorkItem = THREADER->GetWorkItem(n, pInput1, PyArray_ITEMSIZE(pIn1), pstUFunc->MinElementsToThread);
+        if (!pWorkItem) {
+            WORKSPACE_FREE(pJob);
+            RETURN_NONE;
+        }
+
+        pJob->pWorkItem = pWorkItem;
+        pJob->Joining = 0;
+        pJob->ForkGeneration = g_ForkGeneration;
+        pJob->Length = n;
+        pJob->InPlace = pOutput == pInput1 || pOutput == pInput2;
+        pJob->Done = 0;
+
+        UFUNC_CALLBACK* pCallback = &pJob->Callback;
+        pCallback->pDataIn1 = pInput1;
+        pCallback->pDataIn2 = pInput2;
+        pCallback->pDataOut = pOutput;
+        pCallback->itemSizeIn1 = PyArray_ITEMSIZE(pIn1);
+        pCallback->itemSizeIn2 = PyArray_ITEMSIZE(pIn2);
+        pCallback->itemSizeOut = PyArray_ITEMSIZE(pOut);
+        pCallback->innerloop = NULL;
+
+        int64_t bytesPerElement = pCallback->itemSizeIn1 + pCallback->itemSizeOut;
+        if (binary) {
+            pCallback->pBinaryFunc = pstUFunc->pBinaryFunc;
+            pWorkItem->DoWorkCallback = BinaryThreadCallbackStrided;
+            bytesPerElement += pCallback->itemSizeIn2;
+        }
+        else {
+            pCallback->pUnaryFunc = pstUFunc->pUnaryFunc;
+            pWorkItem->DoWorkCallback = UnaryThreadCallbackStrided;
+        }
+        pWorkItem->WorkCallbackArg = pCallback;
+
+        pJob->pArrays[0] = out;
+        pJob->pArrays[1] = in1;
+        pJob->pArrays[2] = in2;
+        for (int i = 0; i < 3; i++) {
+            Py_XINCREF(pJob->pArrays[i]);
+        }
+
+        int64_t blockSize;
+        int32_t threads = PlanUFuncWork(pWorkItem, n, bytesPerElement, pstUFunc, &blockSize);
+        pJob->Serial = THREADER->WorkStart(pWorkItem, n, threads, blockSize, TRUE, TRUE);
+
+        return PyCapsule_New(pJob, ASYNC_JOB_NAME, AsyncJobDestructor);
+    }
+    RETURN_NONE;
+}
+
+// Blocks until a job from thread_submit is complete, the calling thread helps
+extern "C"
+PyObject * thread_wait(PyObject * self, PyObject * args) {
+    PyObject* capsule = NULL;
+    if (!PyArg_ParseTuple(args, "O:thread_wait", &capsule)) {
+        return NULL;
+    }
+    stAsyncJob* pJob = (stAsyncJob*)PyCapsule_GetPointer(capsule, ASYNC_JOB_NAME);
+    if (!pJob) {
+        return NULL;
+    }
+    if (!AsyncJobWait(pJob)) {
+        return NULL;
+    }
+    RETURN_NONE;
+}
+
+// Returns True when a job from thread_submit is complete, does not block
+extern "C"
+PyObject * thread_isdone(PyObject * self, PyObject * args) {
+    PyObject* capsule = NULL;
+    if (!PyArg_ParseTuple(args, "O:thread_isdone", &capsule)) {
+        return NULL;
+    }
+    stAsyncJob* pJob = (stAsyncJob*)PyCapsule_GetPointer(capsule, ASYNC_JOB_NAME);
+    if (!pJob) {
+        return NULL;
+    }
+    // A job from before a fork is done once thread_wait ran it again
+    if (pJob->Done || (!AsyncJobForked(pJob) && THREADER->IsWorkDone(pJob->pWorkItem, pJob->Serial))) {
+        RETURN_TRUE;
+    }
+    RETURN_FALSE;
+}
+
+//------------------------------------------------------------------------------
+// Reduce of every row of a C contiguous array, the rows are split over the threads
+struct stReduceRows {
+    REDUCE_FUNC pReduceFunc;
+
+    // numpy's loop when there is no atop reduce
+    PyUFuncGenericFunction pOldFunc;
+    void*       pOldData;
+
+    char*       pDataIn;
+    char*       pDataOut;
+    int64_t     cols;
+    int64_t     rowBytes;
+    int64_t     itemSize;
+    int32_t     useOut;
+};
+
+// Reduces rows [start, start + length)
+// Each row starts from its first element, or from the value in out when useOut is set
+static void ReduceRows(stReduceRows* pRows, int64_t start, int64_t length) {
+    char* pIn = pRows->pDataIn + start * pRows->rowBytes;
+    char* pOut = pRows->pDataOut + start * pRows->itemSize;
+    for (int64_t i = 0; i < length; i++) {
+        if (!pRows->pReduceFunc) {
+            // Same call numpy makes for the row
+            char* args[3];
+            npy_intp dimensions[1];
+            npy_intp steps[3] = { 0, pRows->itemSize, 0 };
+            args[0] = args[2] = pOut;
+            args[1] = pIn;
+            dimensions[0] = pRows->cols;
+            if (!pRows->useOut) {
+                memcpy(pOut, pIn, pRows->itemSize);
+                args[1] += pRows->itemSize;
+                dimensions[0]--;
+            }
+            pRows->pOldFunc(args, dimensions, steps, pRows->pOldData);
+        }
+        else if (pRows->useOut) {
+            pRows->pReduceFunc(pIn, pOut, pOut, pRows->cols, pRows->itemSize);
+        }
+        else {
+            ReduceBlock(pRows->pReduceFunc, pIn, pOut, pRows->cols, pRows->itemSize);
+        }
+        pIn += pRows->rowBytes;
+        pOut += pRows->itemSize;
+    }
+}
+
+//  Concurrent callback from multiple threads, a block is a range of rows
+static int64_t ReduceRowsThreadCallback(struct stMATH_WORKER_ITEM* pstWorkerItem, int core, int64_t workIndex) {
+    int64_t didSomeWork = 0;
+    stReduceRows* pRows = (stReduceRows*)pstWorkerItem->WorkCallbackArg;
+    int64_t lenX;
+    int64_t workBlock;
+
+    while ((lenX = pstWorkerItem->GetNextWorkBlock(&workBlock, core)) > 0) {
+        ReduceRows(pRows, pstWorkerItem->BlockSize * workBlock, lenX);
+        didSomeWork++;
+        pstWorkerItem->CompleteWorkBlock(core);
+    }
+    return didSomeWork;
+}
+
+// Returns numpy's loop of a binary ufunc for dtype (the original loop if it was replaced), NULL if none
+static PyUFuncGenericFunction FindNumpyLoop(PyObject* ufunc, stUFunc* pstUFunc, int dtype, void** pData) {
+    if (!PyObject_TypeCheck(ufunc, &PyUFunc_Type)) return NULL;
+    PyUFuncObject* pUFunc = (PyUFuncObject*)ufunc;
+    if (pUFunc->nin != 2 || pUFunc->nout != 1) return NULL;
+
+    for (int i = 0; i < pUFunc->ntypes; i++) {
+        const char* types = &pUFunc->types[i * 3];
+        if (types[0] == dtype && types[1] == dtype && types[2] == dtype) {
+            *pData = pUFunc->data[i];
+            return pstUFunc->pOldFunc ? pstUFunc->pOldFunc : pUFunc->functions[i];
+        }
+    }
+    return NULL;
+}
+
+// Arguments of thread_reducerows and thread_reducecols
+struct stReduceArgs {
+    PyObject*       ufunc;
+    PyObject*       out;
+    int             useOut;
+    PyArrayObject*  pIn;
+    PyArrayObject*  pOut;
+    stUFunc*        pstUFunc;
+    int             dtype;
+    int             atype;
+};
+
+// Parses (ufunc, out, a[, useout]), a and out must be C contiguous, aligned arrays in native byte order
+// of the same type that do not overlap
+// Returns -1 with a python error set, 0 when the call is not supported, 1 when pReduce is filled in
+static int ParseReduceArgs(PyObject* args, const char* format, const char* caller, stReduceArgs* pReduce) {
+    PyObject* in = NULL;
+    pReduce->useOut = 0;
+    if (!PyArg_ParseTuple(args, format, &pReduce->ufunc, &pReduce->out, &in, &pReduce->useOut)) {
+        return -1;
+    }
+
+    int32_t category = -1;
+    stUFunc* pLoops = FindUFuncLoops(pReduce->ufunc, &category, caller);
+    if (!pLoops) {
+        return -1;
+    }
+    if (category != OPCAT_BINARY) {
+        PyErr_Format(PyExc_TypeError, "%s: ufunc takes 2 inputs", caller);
+        return -1;
+    }
+
+    pReduce->pOut = AsyncArray(pReduce->out);
+    pReduce->pIn = AsyncArray(in);
+    if (!pReduce->pOut || !pReduce->pIn || !PyArray_ISWRITEABLE(pReduce->pOut) || PyArray_NDIM(pReduce->pIn) < 1) {
+        return 0;
+    }
+
+    int dtype = PyArray_TYPE(pReduce->pIn);
+    if (dtype < 0 || dtype > NPY_VOID || PyArray_TYPE(pReduce->pOut) != dtype) {
+        return 0;
+    }
+
+    int atype = convert_dtype_to_atop[dtype];
+    if (atype < 0 || atype >= ATOP_LAST) {
+        return 0;
+    }
+
+    char* pInput = PyArray_BYTES(pReduce->pIn);
+    char* pOutput = PyArray_BYTES(pReduce->pOut);
+    if (pOutput < pInput + PyArray_NBYTES(pReduce->pIn) && pInput < pOutput + PyArray_NBYTES(pReduce->pOut)) {
+        return 0;
+    }
+
+    pReduce->pstUFunc = &pLoops[atype];
+    pReduce->dtype = dtype;
+    pReduce->atype = atype;
+    return 1;
+}
+
+// ufunc.reduce(a, axis=-1, out=out) with the rows reduced on the worker threads
+// With useOut each row is reduced into the value already in out (identity or initial=)
+// numpy calls the reduce loop once per row, too short to ever thread
+// Returns out, or None when the call is not supported (python then calls ufunc.reduce)
+extern "C"
+PyObject * thread_reducerows(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        stReduceArgs stReduce;
+        int ok = ParseReduceArgs(args, "OOO|p:thread_reducerows", "thread_reducerows", &stReduce);
+        if (ok < 0) {
+            return NULL;
+        }
+        if (ok == 0) {
+            RETURN_NONE;
+        }
+
+        // The atop reduce, or numpy's loop when there is none (float min and max) or atop is off
+        stUFunc* pstUFunc = stReduce.pstUFunc;
+        REDUCE_FUNC pReduceFunc = g_Settings.AtopEnabled ? pstUFunc->pReduceFunc : NULL;
+        void* pOldData = NULL;
+        PyUFuncGenericFunction pOldFunc = pReduceFunc ? NULL : FindNumpyLoop(stReduce.ufunc, pstUFunc, stReduce.dtype, &pOldData);
+
+        PyArrayObject* pIn = stReduce.pIn;
+        int64_t cols = PyArray_DIM(pIn, PyArray_NDIM(pIn) - 1);
+        npy_intp n = PyArray_SIZE(pIn);
+        if ((!pReduceFunc && !pOldFunc) || cols <= 0) {
+            RETURN_NONE;
+        }
+
+        int64_t rows = n / cols;
+        int64_t itemsize = PyArray_ITEMSIZE(pIn);
+        if (PyArray_SIZE(stReduce.pOut) != rows) {
+            RETURN_NONE;
+        }
+
+        char* pInput = PyArray_BYTES(pIn);
+        char* pOutput = PyArray_BYTES(stReduce.pOut);
+
+        stReduceRows stRows;
+        stRows.pReduceFunc = pReduceFunc;
+        stRows.pOldFunc = pOldFunc;
+        stRows.pOldData = pOldData;
+        stRows.pDataIn = pInput;
+        stRows.pDataOut = pOutput;
+        stRows.cols = cols;
+        stRows.rowBytes = cols * itemsize;
+        stRows.itemSize = itemsize;
+        stRows.useOut = stReduce.useOut;
+
+        // A loop that was not replaced has not been calibrated, it is memory bound (COST_MEMORY is 0)
+        int64_t minElements = pstUFunc->pOldFunc ? pstUFunc->MinElementsToThread : CMathWorker::WORK_ITEM_BIG;
+
+        Py_BEGIN_ALLOW_THREADS
+        // Threads are picked from all the elements, a block is whole rows
+        stMATH_WORKER_ITEM* pWorkItem = rows > 1 ? THREADER->GetWorkItem(n, pInput, itemsize, minElements) : NULL;
+        if (pWorkItem) {
+            int64_t blockSize;
+            int32_t threads = PlanUFuncWork(pWorkItem, n, itemsize, pstUFunc, &blockSize);
+            int64_t blockRows = blockSize / cols;
+            if (blockRows < 1) blockRows = 1;
+
+            pWorkItem->WorkCallbackArg = &stRows;
+            pWorkItem->DoWorkCallback = ReduceRowsThreadCallback;
+            THREADER->WorkMain(pWorkItem, rows, threads, blockRows);
+        }
+        else {
+            ReduceRows(&stRows, 0, rows);
+        }
+        Py_END_ALLOW_THREADS
+
+        Py_INCREF(stReduce.out);
+        return stReduce.out;
+    }
+    RETURN_NONE;
+}
+
+//------------------------------------------------------------------------------
+// Reduce of the first axis of a C contiguous array (a.sum(axis=0)), numpy adds one row at a time into out
+// Wide arrays are split into column tiles, each walks every row in numpy's order
+// Tall narrow arrays are split into row panels, each reduced into its own partial row, then merged in order
+static const int64_t COLUMN_TILE_BYTES = 16384;
+static const int64_t COLUMN_PANEL_MIN_ROWS = 16;
+
+struct stReduceCols {
+    // out = op(out, row) on a row segment, atop or numpy's loop
+    ANY_TWO_FUNC pBinaryFunc;
+    PyUFuncGenericFunction pOldFunc;
+    void*       pOldData;
+
+    char*       pDataIn;
+    char*       pDataOut;
+    char*       pPartials;  // a row for each panel
+    int64_t     firstRow;   // 1 when out was started from the first row
+    int64_t     rows;
+    int64_t     cols;
+    int64_t     rowBytes;
+    int64_t     itemSize;
+    int64_t     tileElems;
+    int64_t     panelRows;  // 0 to split the columns into tiles
+};
+
+static inline void AccumulateRow(stReduceCols* pCols, char* pAcc, char* pRow, int64_t len) {
+    if (pCols->pBinaryFunc) {
+        pCols->pBinaryFunc(pAcc, pRow, pAcc, len, pCols->itemSize, pCols->itemSize, pCols->itemSize);
+    }
+    else {
+        char* args[3] = { pAcc, pRow, pAcc };
+        npy_intp dimensions[1] = { len };
+        npy_intp steps[3] = { pCols->itemSize, pCols->itemSize, pCols->itemSize };
+        pCols->pOldFunc(args, dimensions, steps, pCols->pOldData);
+    }
+}
+
+// Reduces rows [rowStart, rowStart + rowLen) into pAcc, one column tile after another so pAcc stays in cache
+static void ReduceColsPanel(stReduceCols* pCols, char* pAcc, int64_t rowStart, int64_t rowLen, int64_t colStart, int64_t colLen) {
+    // Narrow rows are too short for the vector loop, groups of rows are reduced as one tile wide row then folded
+    int64_t group = pCols->tileElems / pCols->cols;
+    if (colLen == pCols->cols && group >= 2 && rowLen >= 2 * group) {
+        alignas(64) char tile[COLUMN_TILE_BYTES];
+        int64_t groupBytes = group * pCols->rowBytes;
+        int64_t groups = rowLen / group;
+
+        char* pRow = pCols->pDataIn + rowStart * pCols->rowBytes;
+        memcpy(tile, pRow, groupBytes);
+        for (int64_t i = 1; i < groups; i++) {
+            pRow += groupBytes;
+            AccumulateRow(pCols, tile, pRow, group * pCols->cols);
+        }
+        for (int64_t i = 0; i < group; i++) {
+            AccumulateRow(pCols, pAcc, tile + i * pCols->rowBytes, pCols->cols);
+        }
+        rowStart += groups * group;
+        rowLen -= groups * group;
+    }
+
+    for (int64_t col = colStart; col < colStart + colLen; col += pCols->tileElems) {
+        int64_t len = colStart + colLen - col;
+        if (len > pCols->tileElems) len = pCols->tileElems;
+
+        char* pTile = pAcc + (col - colStart) * pCols->itemSize;
+        char* pRow = pCols->pDataIn + rowStart * pCols->rowBytes + col * pCols->itemSize;
+        for (int64_t row = 0; row < rowLen; row++) {
+            AccumulateRow(pCols, pTile, pRow, len);
+            pRow += pCols->rowBytes;
+        }
+    }
+}
+
+// A unit is a column tile, or a row panel when panelRows is set
+static void ReduceColsUnit(stReduceCols* pCols, int64_t unit) {
+    if (pCols->panelRows) {
+        int64_t rowStart = pCols->firstRow + unit * pCols->panelRows;
+        int64_t rowLen = pCols->rows - rowStart;
+        if (rowLen > pCols->panelRows) rowLen = pCols->panelRows;
+
+        // The panel starts from its own first row
+        char* pPartial = pCols->pPartials + unit * pCols->rowBytes;
+        memcpy(pPartial, pCols->pDataIn + rowStart * pCols->rowBytes, pCols->rowBytes);
+        ReduceColsPanel(pCols, pPartial, rowStart + 1, rowLen - 1, 0, pCols->cols);
+    }
+    else {
+        int64_t colStart = unit * pCols->tileElems;
+        int64_t colLen = pCols->cols - colStart;
+        if (colLen > pCols->tileElems) colLen = pCols->tileElems;
+        ReduceColsPanel(pCols, pCols->pDataOut + colStart * pCols->itemSize, pCols->firstRow, pCols->rows - pCols->firstRow, colStart, colLen);
+    }
+}
+
+//  Concurrent callback from multiple threads, a block is one unit
+static int64_t ReduceColsThreadCallback(struct stMATH_WORKER_ITEM* pstWorkerItem, int core, int64_t workIndex) {
+    int64_t didSomeWork = 0;
+    stReduceCols* pCols = (stReduceCols*)pstWorkerItem->WorkCallbackArg;
+    int64_t lenX;
+    int64_t workBlock;
+
+    while ((lenX = pstWorkerItem->GetNextWorkBlock(&workBlock, core)) > 0) {
+        ReduceColsUnit(pCols, workBlock);
+        didSomeWork++;
+        pstWorkerItem->CompleteWorkBlock(core);
+    }
+    return didSomeWork;
+}
+
+// ufunc.reduce(a, axis=0, out=out) with the rows or columns split over the worker threads
+// With useOut the rows are reduced into the values already in out (identity or initial=)
+// Returns out, or None when the call is not supported (python then calls ufunc.reduce)
+extern "C"
+PyObject * thread_reducecols(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        stReduceArgs stReduce;
+        int ok = ParseReduceArgs(args, "OOO|p:thread_reducecols", "thread_reducecols", &stReduce);
+        if (ok < 0) {
+            return NULL;
+        }
+        if (ok == 0) {
+            RETURN_NONE;
+        }
+
+        // The atop loop when it keeps the type, or numpy's loop when there is none (float min and max) or atop is off
+        stUFunc* pstUFunc = stReduce.pstUFunc;
+        ANY_TWO_FUNC pBinaryFunc = NULL;
+        if (g_Settings.AtopEnabled && pstUFunc->OutputType == stReduce.dtype) {
+            pBinaryFunc = pstUFunc->pBinaryFunc;
+        }
+        void* pOldData = NULL;
+        PyUFuncGenericFunction pOldFunc = pBinaryFunc ? NULL : FindNumpyLoop(stReduce.ufunc, pstUFunc, stReduce.dtype, &pOldData);
+
+        PyArrayObject* pIn = stReduce.pIn;
+        int64_t rows = PyArray_DIM(pIn, 0);
+        npy_intp n = PyArray_SIZE(pIn);
+        if ((!pBinaryFunc && !pOldFunc) || rows <= 0 || n == 0) {
+            RETURN_NONE;
+        }
+
+        int64_t cols = n / rows;
+        int64_t itemsize = PyArray_ITEMSIZE(pIn);
+        if (PyArray_SIZE(stReduce.pOut) != cols) {
+            RETURN_NONE;
+        }
+
+        stReduceCols stCols;
+        stCols.pBinaryFunc = pBinaryFunc;
+        stCols.pOldFunc = pOldFunc;
+        stCols.pOldData = pOldData;
+        stCols.pDataIn = PyArray_BYTES(pIn);
+        stCols.pDataOut = PyArray_BYTES(stReduce.pOut);
+        stCols.pPartials = NULL;
+        stCols.firstRow = stReduce.useOut ? 0 : 1;
+        stCols.rows = rows;
+        stCols.cols = cols;
+        stCols.rowBytes = cols * itemsize;
+        stCols.itemSize = itemsize;
+        stCols.tileElems = COLUMN_TILE_BYTES / itemsize;
+        stCols.panelRows = 0;
+
+        int64_t minElements = pstUFunc->pOldFunc ? pstUFunc->MinElementsToThread : CMathWorker::WORK_ITEM_BIG;
+        bool deterministic = g_Deterministic && (stReduce.atype == ATOP_FLOAT || stReduce.atype == ATOP_DOUBLE);
+        int64_t dataRows = rows - stCols.firstRow;
+
+        Py_BEGIN_ALLOW_THREADS
+        if (!stReduce.useOut) {
+            memcpy(stCols.pDataOut, stCols.pDataIn, stCols.rowBytes);
+        }
+
+        stMATH_WORKER_ITEM* pWorkItem = dataRows > 1 ? THREADER->GetWorkItem(n, stCols.pDataIn, itemsize, minElements) : NULL;
+        int32_t threads = 0;
+        int64_t blockSize = 0;
+        if (pWorkItem) {
+            threads = PlanUFuncWork(pWorkItem, n, itemsize, pstUFunc, &blockSize);
+        }
+
+        if (deterministic) {
+            // Floats split the same way whatever the threads, panels only when there are enough rows
+            if (cols * COLUMN_PANEL_MIN_ROWS <= DETERMINISTIC_BLOCK) stCols.panelRows = DETERMINISTIC_BLOCK / cols;
+        }
+        else if (pWorkItem && cols < (threads + 1) * stCols.tileElems) {
+            // Too few column tiles to go around
+            stCols.panelRows = blockSize / cols;
+            if (stCols.panelRows < COLUMN_PANEL_MIN_ROWS) stCols.panelRows = COLUMN_PANEL_MIN_ROWS;
+        }
+        if (stCols.panelRows >= dataRows) stCols.panelRows = 0;
+
+        int64_t units = 0;
+        if (stCols.panelRows) {
+            units = (dataRows + stCols.panelRows - 1) / stCols.panelRows;
+            stCols.pPartials = (char*)WORKSPACE_ALLOC(units * stCols.rowBytes);
+            if (!stCols.pPartials) stCols.panelRows = 0;
+        }
+        if (!stCols.panelRows) {
+            units = (cols + stCols.tileElems - 1) / stCols.tileElems;
+        }
+
+        if (pWorkItem) {
+            pWorkItem->WorkCallbackArg = &stCols;
+            pWorkItem->DoWorkCallback = ReduceColsThreadCallback;
+            THREADER->WorkMain(pWorkItem, units, threads, 1);
+        }
+        else {
+            for (int64_t unit = 0; unit < units; unit++) {
+                ReduceColsUnit(&stCols, unit);
+            }
+        }
+
+        // Merge the panels in order
+        if (stCols.pPartials) {
+            for (int64_t unit = 0; unit < units; unit++) {
+                AccumulateRow(&stCols, stCols.pDataOut, stCols.pPartials + unit * stCols.rowBytes, cols);
+            }
+            WORKSPACE_FREE(stCols.pPartials);
+        }
+        Py_END_ALLOW_THREADS
+
+        Py_INCREF(stReduce.out);
+        return stReduce.out;
+    }
+    RETURN_NONE;
+}
+
+// See WORK_SCHEDULE
+static const char* gStrSchedule[SCHEDULE_LAST] = {
+    "ring",
+    "steal",
+    "static",
+};
+
+// Returns previous schedule name
+extern "C"
+PyObject * thread_setschedule(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        const char* name = NULL;
+        if (!PyArg_ParseTuple(args, "s:thread_setschedule", &name)) {
+            return NULL;
+        }
+        for (int32_t i = 0; i < SCHEDULE_LAST; i++) {
+            if (strcmp(name, gStrSchedule[i]) == 0) {
+                int32_t previousVal = THREADER->SetSchedule(i);
+                return PyUnicode_FromString(gStrSchedule[previousVal]);
+            }
+        }
+        return PyErr_Format(PyExc_ValueError, "unknown schedule '%s'", name);
+    }
+    RETURN_NONE;
+}
+
+extern "C"
+PyObject * thread_getschedule(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        return PyUnicode_FromString(gStrSchedule[THREADER->Schedule]);
+    }
+    RETURN_NONE;
+}
+
+// See WAKE_MODE
+static const char* gStrWakeMode[WAKE_LAST] = {
+    "auto",
+    "flat",
+    "tree",
+    "targeted",
+};
+
+// Returns previous wake mode name
+extern "C"
+PyObject * thread_setwakemode(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        const char* name = NULL;
+        if (!PyArg_ParseTuple(args, "s:thread_setwakemode", &name)) {
+            return NULL;
+        }
+        for (int32_t i = 0; i < WAKE_LAST; i++) {
+            if (strcmp(name, gStrWakeMode[i]) == 0) {
+                int32_t previousVal = THREADER->SetWakeMode(i);
+                return PyUnicode_FromString(gStrWakeMode[previousVal]);
+            }
+        }
+        return PyErr_Format(PyExc_ValueError, "unknown wake mode '%s'", name);
+    }
+    RETURN_NONE;
+}
+
+extern "C"
+PyObject * thread_getwakemode(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        return PyUnicode_FromString(gStrWakeMode[THREADER->WakeMode]);
+    }
+    RETURN_NONE;
+}
+
+// See NUMA_POLICY
+static const char* gStrNumaPolicy[NUMA_LAST] = {
+    "local",
+    "interleave",
+};
+
+// Returns previous policy name
+extern "C"
+PyObject * thread_setnumapolicy(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        const char* name = NULL;
+        if (!PyArg_ParseTuple(args, "s:thread_setnumapolicy", &name)) {
+            return NULL;
+        }
+        for (int32_t i = 0; i < NUMA_LAST; i++) {
+            if (strcmp(name, gStrNumaPolicy[i]) == 0) {
+                int32_t previousVal = THREADER->SetNumaPolicy(i);
+                return PyUnicode_FromString(gStrNumaPolicy[previousVal]);
+            }
+        }
+        return PyErr_Format(PyExc_ValueError, "unknown numa policy '%s'", name);
+    }
+    RETURN_NONE;
+}
+
+extern "C"
+PyObject * thread_getnumapolicy(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        return PyUnicode_FromString(gStrNumaPolicy[THREADER->NumaPolicy]);
+    }
+    RETURN_NONE;
+}
+
+// See AFFINITY_POLICY
+static const char* gStrAffinity[AFFINITY_LAST] = {
+    "none",
+    "compact",
+    "scatter",
+    "physical",
+    "list",
+};
+
+// Takes a policy name or a sequence of cpus, returns previous policy name
+extern "C"
+PyObject * thread_setaffinity(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        int32_t previousVal = THREADER->AffinityPolicy;
+        const char* name = NULL;
+        PyObject* policy = NULL;
+
+        if (PyArg_ParseTuple(args, "s:thread_setaffinity", &name)) {
+            for (int32_t i = 0; i < AFFINITY_LAST; i++) {
+                if (i != AFFINITY_LIST && strcmp(name, gStrAffinity[i]) == 0) {
+                    if (!THREADER->SetAffinity(i, NULL, 0, TRUE)) {
+                        return PyErr_Format(PyExc_ValueError, "affinity '%s' is not supported on this machine", name);
+                    }
+                    return PyUnicode_FromString(gStrAffinity[previousVal]);
+                }
+            }
+            return PyErr_Format(PyExc_ValueError, "unknown affinity '%s'", name);
+        }
+
+        // Not a name, try a sequence of cpus
+        PyErr_Clear();
+        if (!PyArg_ParseTuple(args, "O:thread_setaffinity", &policy)) {
+            return NULL;
+        }
+
+        if (!PySequence_Check(policy)) {
+            return PyErr_Format(PyExc_TypeError, "affinity must be a name or a sequence of cpus");
+        }
+
+        int16_t cpus[CMathWorker::MAX_WORKER_HANDLES + 1];
+        Py_ssize_t count = PySequence_Size(policy);
+        if (count < 0) return NULL;
+        if (count == 0 || count > CMathWorker::MAX_WORKER_HANDLES + 1) {
+            return PyErr_Format(PyExc_ValueError, "expected 1 to %d cpus", CMathWorker::MAX_WORKER_HANDLES + 1);
+        }
+        for (Py_ssize_t i = 0; i < count; i++) {
+            PyObject* item = PySequence_GetItem(policy, i);
+            if (!item) return NULL;
+            long cpu = PyLong_AsLong(item);
+            Py_DECREF(item);
+            if (cpu == -1 && PyErr_Occurred()) return NULL;
+            if (cpu < 0 || cpu >= MAX_TOPOLOGY_CPUS) {
+                return PyErr_Format(PyExc_ValueError, "cpu %ld out of range", cpu);
+            }
+            cpus[i] = (int16_t)cpu;
+        }
+        if (!THREADER->SetAffinity(AFFINITY_LIST, cpus, (int32_t)count, TRUE)) {
+            return PyErr_Format(PyExc_ValueError, "could not pin threads to the cpus");
+        }
+        return PyUnicode_FromString(gStrAffinity[previousVal]);
+    }
+    RETURN_NONE;
+}
+
+// Returns the policy name and a list of the cpu for each thread, main thread first
+extern "C"
+PyObject * thread_getaffinity(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        PyObject* cpus = PyList_New(THREADER->WorkerThreadCount + 1);
+        for (int32_t i = 0; i <= THREADER->WorkerThreadCount; i++) {
+            PyList_SetItem(cpus, i, PyLong_FromLong(THREADER->AffinityPinned[i]));
+        }
+        return Py_BuildValue("(sN)", gStrAffinity[THREADER->AffinityPolicy], cpus);
+    }
+    RETURN_NONE;
+}
+
+// Returns a record array of count rows with an int64 for each field
+static PyArrayObject* NewInt64Records(const char** fields, int32_t fieldCount, npy_intp count) {
+    PyObject* spec = PyList_New(0);
+    for (int32_t f = 0; f < fieldCount; f++) {
+        PyObject* field = Py_BuildValue("(ss)", fields[f], "<i8");
+        PyList_Append(spec, field);
+        Py_XDECREF(field);
+    }
+    PyArray_Descr* descr = NULL;
+    int ok = PyArray_DescrConverter(spec, &descr);
+    Py_DECREF(spec);
+    if (!ok) return NULL;
+
+    return (PyArrayObject*)PyArray_SimpleNewFromDescr(1, &count, descr);
+}
+
+// Returns a record array with a row of counters per worker thread
+extern "C"
+PyObject * thread_info(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        // In a forked child show the counters of its own threads
+        THREADER->CheckFork();
+        static const char* fields[] = {
+            "core", "node", "cpu", "blocks", "jobs", "idle_ns", "wake_ns", "wakes", "spin_wakes", "sleep_waits",
+            "wake_group", "leader" };
+
+        npy_intp count = THREADER->WorkerThreadCount;
+        PyArrayObject* result = NewInt64Records(fields, sizeof(fields) / sizeof(fields[0]), count);
+        if (!result) return NULL;
+
+        int64_t* pRow = (int64_t*)PyArray_BYTES(result);
+        for (int32_t i = 0; i < count; i++) {
+            stWorkerThread* pWorkerThread = &THREADER->WorkerThreads[i];
+            stWorkerStats* pStats = pWorkerThread->pStats;
+            *pRow++ = i;
+            *pRow++ = THREADER->NumaNodeIds[pWorkerThread->Group];
+            *pRow++ = THREADER->AffinityPinned[i + 1];
+            *pRow++ = pStats->BlocksCompleted;
+            *pRow++ = pStats->JobsJoined;
+            *pRow++ = pStats->IdleNanos;
+            *pRow++ = pStats->WakeNanos;
+            *pRow++ = pStats->WakeCount;
+            *pRow++ = pStats->SpinWakes;
+            *pRow++ = pStats->SleepWaits;
+            *pRow++ = pWorkerThread->WakeGroup;
+            *pRow++ = pWorkerThread->WakeLeader;
+        }
+        return (PyObject*)result;
+    }
+    RETURN_NONE;
+}
+
+//-----------------------------------
+// Shared by the main thread and the workers during thread_wakebench
+struct stWakeBench {
+    // How long each block keeps the thread busy
+    int64_t             BlockNanos;
+
+    // When the first worker thread (not the main thread) started a block, 0 until then
+    volatile int64_t    FirstBlockNanos;
+
+    // Set for each worker thread that did a block
+    volatile int8_t     Joined[CMathWorker::MAX_WORKER_HANDLES];
+};
+
+//------------------------------------------------------------------------------
+//  Concurrent callback from multiple threads, blocks do nothing but spin for BlockNanos
+static int64_t WakeBenchCallback(struct stMATH_WORKER_ITEM* pstWorkerItem, int core, int64_t workIndex) {
+    int64_t didSomeWork = 0;
+    stWakeBench* pBench = (stWakeBench*)pstWorkerItem->WorkCallbackArg;
+    int64_t workBlock;
+
+    while (pstWorkerItem->GetNextWorkBlock(&workBlock, core) > 0) {
+        int64_t now = GetMonotonicNanos();
+        if (core >= 0) {
+            if (pBench->FirstBlockNanos == 0) InterlockedCompareExchange64(&pBench->FirstBlockNanos, now, 0);
+            if (!pBench->Joined[core]) pBench->Joined[core] = 1;
+        }
+        if (pBench->BlockNanos > 0) {
+            int64_t end = now + pBench->BlockNanos;
+            while (GetMonotonicNanos() < end) YieldProcessor();
+        }
+        didSomeWork++;
+        pstWorkerItem->CompleteWorkBlock(core);
+    }
+    return didSomeWork;
+}
+
+// Times jobs with empty blocks to measure the wake path of the worker threads
+// Returns an int64 array with a row per job:
+//   publish ns (WorkStart, includes the futex wake), submit to first worker block ns (-1 if none),
+//   submit to completion ns, worker threads that did a block
+extern "C"
+PyObject * thread_wakebench(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        long long jobs = 0;
+        int wake = 0;
+        long long blocks = 64;
+        double blockMicros = 0;
+        double gapMicros = 100;
+        if (!PyArg_ParseTuple(args, "L|iLdd:thread_wakebench", &jobs, &wake, &blocks, &blockMicros, &gapMicros)) {
+            return NULL;
+        }
+        if (jobs < 0 || blocks < 1) {
+            return PyErr_Format(PyExc_ValueError, "jobs must be at least 0 and blocks at least 1");
+        }
+
+        npy_intp dims[2] = { (npy_intp)jobs, 4 };
+        PyArrayObject* result = (PyArrayObject*)PyArray_SimpleNew(2, dims, NPY_INT64);
+        if (!result) return NULL;
+        int64_t* pRow = (int64_t*)PyArray_BYTES(result);
+
+        const int64_t gapNanos = (int64_t)(gapMicros * 1000.0);
+        // How long the main thread keeps off the blocks so a worker can get the first one
+        const int64_t holdNanos = 10000000;
+
+        stWakeBench bench;
+        bench.BlockNanos = (int64_t)(blockMicros * 1000.0);
+
+        Py_BEGIN_ALLOW_THREADS
+        for (long long j = 0; j < jobs; j++, pRow += 4) {
+            // Let the workers go back to sleep (or spin) as between ufunc calls
+            int64_t resume = GetMonotonicNanos() + gapNanos;
+            while (GetMonotonicNanos() < resume) YieldProcessor();
+
+            pRow[0] = pRow[1] = pRow[2] = -1;
+            pRow[3] = 0;
+
+            stMATH_WORKER_ITEM* pWorkItem = THREADER->GetWorkItemCount(blocks);
+            if (!pWorkItem) continue;
+
+            bench.FirstBlockNanos = 0;
+            memset((void*)bench.Joined, 0, sizeof(bench.Joined));
+            pWorkItem->DoWorkCallback = WakeBenchCallback;
+            pWorkItem->WorkCallbackArg = &bench;
+
+            int64_t start = GetMonotonicNanos();
+            THREADER->WorkStart(pWorkItem, blocks, wake, 1);
+            int64_t published = GetMonotonicNanos();
+
+            while (THREADER->WorkerThreadCount > 0 && bench.FirstBlockNanos == 0 && GetMonotonicNanos() - published < holdNanos) YieldProcessor();
+
+            THREADER->WorkWait(pWorkItem);
+            int64_t done = GetMonotonicNanos();
+
+            int64_t workers = 0;
+            for (int32_t i = 0; i < CMathWorker::MAX_WORKER_HANDLES; i++) workers += bench.Joined[i];
+
+            pRow[0] = published - start;
+            pRow[1] = bench.FirstBlockNanos ? bench.FirstBlockNanos - start : -1;
+            pRow[2] = done - start;
+            pRow[3] = workers;
+        }
+        Py_END_ALLOW_THREADS
+
+        return (PyObject*)result;
+    }
+    RETURN_NONE;
+}
+
+// Returns a list with a dict per numa node group
+extern "C"
+PyObject * thread_numainfo(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        PyObject* result = PyList_New(0);
+        for (int32_t g = 0; g < THREADER->NumaNodeCount; g++) {
+            int32_t cpus = 0;
+            for (int32_t i = 0; i < THREADER->Topology.NodeCount; i++) {
+                if (THREADER->Topology.NodeId[i] == THREADER->NumaNodeIds[g]) cpus = THREADER->Topology.CpuCount[i];
+            }
+            PyObject* item = Py_BuildValue("{s:i,s:i,s:i}",
+                "node", THREADER->NumaNodeIds[g],
+                "cpus", cpus,
+                "workers", THREADER->NumaThreadCount[g]);
+            PyList_Append(result, item);
+            Py_XDECREF(item);
+        }
+        return result;
+    }
+    RETURN_NONE;
+}
+
+
+// Returns a dict with the cpus and cgroup limits the default pool size comes from
+// and a record array with a row per cpu we may run on
+extern "C"
+PyObject * topology(PyObject * self, PyObject * args) {
+    if (THREADER) {
+        static const char* fields[] = { "cpu", "package", "core", "smt", "node", "cache" };
+        const stCpuTopology* pCpus = &THREADER->CpuTopology;
+        const stCgroupLimits* pLimits = &THREADER->CgroupLimits;
+
+        PyArrayObject* cpuTable = NewInt64Records(fields, sizeof(fields) / sizeof(fields[0]), pCpus->CpuCount);
+        if (!cpuTable) return NULL;
+
+        int64_t* pRow = (int64_t*)PyArray_BYTES(cpuTable);
+        for (int32_t i = 0; i < pCpus->CpuCount; i++) {
+            *pRow++ = pCpus->Cpu[i];
+            *pRow++ = pCpus->Package[i];
+            *pRow++ = pCpus->Core[i];
+            *pRow++ = pCpus->Smt[i];
+            *pRow++ = THREADER->Topology.NodeId[pCpus->Node[i]];
+            *pRow++ = pCpus->Cache[i];
+        }
+
+        PyObject* quota;
+        if (pLimits->QuotaMicros > 0 && pLimits->PeriodMicros > 0) {
+            quota = PyFloat_FromDouble((double)pLimits->QuotaMicros / (double)pLimits->PeriodMicros);
+        }
+        else {
+            Py_INCREF(Py_None);
+            quota = Py_None;
+        }
+
+        return Py_BuildValue("{s:i,s:i,s:N,s:i,s:i,s:i,s:L,s:N}",
+            "cpus", GetProcCount(),
+            "cgroup", pLimits->Version,
+            "quota_cpus", quota,
+            "cpuset_cpus", pLimits->CpusetCount,
+            "usable_cpus", GetUsableCpuCount(pLimits, GetProcCount()),
+            "numa_nodes", THREADER->Topology.NodeCount,
+            "l2_cache", (long long)THREADER->L2CacheSize,
+            "cpu_table", (PyObject*)cpuTable);
+    }
+    RETURN_NONE;
+}
 
 extern "C"
 PyObject * cpustring(PyObject * self, PyObject * args) {
@@ -42,7 +42,7 @@ struct stOpCategory {
 // defined in fast_numpy_loops
 extern stOpCategory gOpCategory[OPCAT_LAST];
 
-extern void LedgerRecord(int32_t op_category, int64_t start_time, int64_t end_time, char** args, const npy_intp* dimensions, const npy_intp* steps, void* innerloop, int funcop, int atype);
+extern void LedgerRecord(int32_t op_category, int64_t start_time, int64_t end_time, char** args, const npy_intp* dimensions, const npy_intp* steps, void* innerloop, int funcop, int atype, int32_t threads);
 extern void LedgerInit();
 
 #define RETURN_NONE Py_INCREF(Py_None); return Py_None;
@@ -152,7 +152,9 @@ struct stLEDGER_ITEM {
     int32_t     ArrayGroup;
     int32_t     ArrayOp;
     int32_t     AType;
-    int32_t     Reserved1;
+
+    // worker threads plus the main thread, 1 when not threaded
+    int32_t     Threads;
 
     const char* StrCatName;
     const char* StrOpName;
@@ -218,7 +220,7 @@ void LedgerInit() {
 // When the ufunc is hooked, if the ledger is turned on it can be recorded.
 // The recording will go into the ring buffer for later retrieval.
 // The ring buffer only holds so much and can overflow
-void LedgerRecord(int32_t op_category, int64_t start_time, int64_t end_time, char** args, const npy_intp* dimensions, const npy_intp* steps, void* innerloop, int funcop, int atype) {
+void LedgerRecord(int32_t op_category, int64_t start_time, int64_t end_time, char** args, const npy_intp* dimensions, const npy_intp* steps, void* innerloop, int funcop, int atype, int32_t threads) {
     int64_t deltaTime = end_time - start_time;
 
     stOpCategory* pstOpCategory = &gOpCategory[op_category];
@@ -229,6 +231,7 @@ void LedgerRecord(int32_t op_category, int64_t start_time, int64_t end_time, cha
     pEntry->ArrayGroup = op_category;
     pEntry->ArrayOp = funcop;
     pEntry->AType = atype;
+    pEntry->Threads = threads;
 
     const char* strCatName = pstOpCategory->StrName;
 
@@ -243,7 +246,7 @@ void LedgerRecord(int32_t op_category, int64_t start_time, int64_t end_time, cha
     pEntry->ArrayLength2 = (int64_t)dimensions[1];
 
     // temporary for debugging print out results
-    printf ("%lld \tlen: %lld   %s,  %s,  %s\n", (long long)deltaTime, (long long)dimensions[0], pEntry->StrOpName, gStrAtopTypes[atype], strCatName);
+    printf ("%lld \tlen: %lld   %s,  %s,  %s  threads: %d\n", (long long)deltaTime, (long long)dimensions[0], pEntry->StrOpName, gStrAtopTypes[atype], strCatName, threads);
        
 }
 
@@ -1,5 +1,6 @@
 #include "Python.h"
 #include "FAST_NUMPY_LOOPS.h"
+#include "../atop/budget.h"
 
 /*
  * Some C++ compilers do not like mixin non-designated-initializers
@@ -13,11 +14,50 @@ extern "C" PyObject* newinit(PyObject* self, PyObject* args, PyObject* kwargs);
 extern "C" PyObject* atop_enable(PyObject * self, PyObject * args);
 extern "C" PyObject* atop_disable(PyObject * self, PyObject * args);
 extern "C" PyObject* atop_isenabled(PyObject * self, PyObject * args);
+extern "C" PyObject* atop_setsummode(PyObject * self, PyObject * args);
+extern "C" PyObject* atop_getsummode(PyObject * self, PyObject * args);
 extern "C" PyObject* thread_enable(PyObject * self, PyObject * args);
 extern "C" PyObject* thread_disable(PyObject * self, PyObject * args);
 extern "C" PyObject* thread_isenabled(PyObject * self, PyObject * args);
 extern "C" PyObject* thread_getworkers(PyObject * self, PyObject * args);
 extern "C" PyObject* thread_setworkers(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_getpoolsize(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_setpoolsize(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_getspin(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_setspin(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_spinstats(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_setwaitspin(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_waitstats(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_getblocksize(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_setblocksize(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_getlatencybytes(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_setlatencybytes(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_getbudget(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_setbudget(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_budgetstats(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_reserve(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_unreserve(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_getmaxthreads(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_setmaxthreads(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_submit(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_wait(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_isdone(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_reducerows(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_reducecols(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_calibrate(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_getschedule(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_setschedule(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_getwakemode(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_setwakemode(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_getdeterministic(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_setdeterministic(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_getnumapolicy(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_setnumapolicy(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_numainfo(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_info(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_wakebench(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_getaffinity(PyObject * self, PyObject * args);
+extern "C" PyObject* thread_setaffinity(PyObject * self, PyObject * args);
 extern "C" PyObject* ledger_enable(PyObject * self, PyObject * args);
 extern "C" PyObject* ledger_disable(PyObject * self, PyObject * args);
 extern "C" PyObject* ledger_isenabled(PyObject * self, PyObject * args);
@@ -30,6 +70,7 @@ extern "C" PyObject* recycler_info(PyObject * self, PyObject * args);
 extern "C" PyObject* timer_gettsc(PyObject * self, PyObject * args);
 extern "C" PyObject* timer_getutc(PyObject * self, PyObject * args);
 extern "C" PyObject* cpustring(PyObject * self, PyObject * args);
+extern "C" PyObject* topology(PyObject * self, PyObject * args);
 
 static char m_doc[] = "Provide methods to override NumPy ufuncs";
 
@@ -42,14 +83,54 @@ static PyMethodDef module_functions[] = {
     {"atop_enable",      (PyCFunction)atop_enable, METH_VARARGS, ATOP_ENABLE_DOC},
     {"atop_disable",     (PyCFunction)atop_disable, METH_VARARGS, ATOP_DISABLE_DOC},
     {"atop_isenabled",   (PyCFunction)atop_isenabled, METH_VARARGS, ATOP_ISENABLED_DOC},
+    {"atop_setsummode",  (PyCFunction)atop_setsummode, METH_VARARGS, ATOP_SETSUMMODE_DOC},
+    {"atop_getsummode",  (PyCFunction)atop_getsummode, METH_VARARGS, ATOP_GETSUMMODE_DOC},
     {"thread_enable",    (PyCFunction)thread_enable, METH_VARARGS, THREAD_ENABLE_DOC},
     {"thread_disable",   (PyCFunction)thread_disable, METH_VARARGS, THREAD_DISABLE_DOC},
     {"thread_isenabled", (PyCFunction)thread_isenabled, METH_VARARGS, THREAD_ISENABLED_DOC},
     {"thread_getworkers",(PyCFunction)thread_getworkers, METH_VARARGS, THREAD_GETWORKERS_DOC},
     {"thread_setworkers",(PyCFunction)thread_setworkers, METH_VARARGS, THREAD_SETWORKERS_DOC},
+    {"thread_getpoolsize",(PyCFunction)thread_getpoolsize, METH_VARARGS, THREAD_GETPOOLSIZE_DOC},
+    {"thread_setpoolsize",(PyCFunction)thread_setpoolsize, METH_VARARGS, THREAD_SETPOOLSIZE_DOC},
+    {"thread_getspin",   (PyCFunction)thread_getspin, METH_VARARGS, THREAD_GETSPIN_DOC},
+    {"thread_setspin",   (PyCFunction)thread_setspin, METH_VARARGS, THREAD_SETSPIN_DOC},
+    {"thread_spinstats", (PyCFunction)thread_spinstats, METH_VARARGS, THREAD_SPINSTATS_DOC},
+    {"thread_setwaitspin",(PyCFunction)thread_setwaitspin, METH_VARARGS, THREAD_SETWAITSPIN_DOC},
+    {"thread_waitstats", (PyCFunction)thread_waitstats, METH_VARARGS, THREAD_WAITSTATS_DOC},
+    {"thread_getblocksize",(PyCFunction)thread_getblocksize, METH_VARARGS, THREAD_GETBLOCKSIZE_DOC},
+    {"thread_setblocksize",(PyCFunction)thread_setblocksize, METH_VARARGS, THREAD_SETBLOCKSIZE_DOC},
+    {"thread_getlatencybytes",(PyCFunction)thread_getlatencybytes, METH_VARARGS, THREAD_GETLATENCYBYTES_DOC},
+    {"thread_setlatencybytes",(PyCFunction)thread_setlatencybytes, METH_VARARGS, THREAD_SETLATENCYBYTES_DOC},
+    {"thread_getbudget", (PyCFunction)thread_getbudget, METH_VARARGS, THREAD_GETBUDGET_DOC},
+    {"thread_setbudget", (PyCFunction)thread_setbudget, METH_VARARGS, THREAD_SETBUDGET_DOC},
+    {"thread_budgetstats",(PyCFunction)thread_budgetstats, METH_VARARGS, THREAD_BUDGETSTATS_DOC},
+    {"thread_reserve",   (PyCFunction)thread_reserve, METH_VARARGS, THREAD_RESERVE_DOC},
+    {"thread_unreserve", (PyCFunction)thread_unreserve, METH_VARARGS, THREAD_UNRESERVE_DOC},
+    {"thread_getmaxthreads",(PyCFunction)thread_getmaxthreads, METH_VARARGS, THREAD_GETMAXTHREADS_DOC},
+    {"thread_setmaxthreads",(PyCFunction)thread_setmaxthreads, METH_VARARGS, THREAD_SETMAXTHREADS_DOC},
+    {"thread_submit",    (PyCFunction)thread_submit, METH_VARARGS, THREAD_SUBMIT_DOC},
+    {"thread_wait",      (PyCFunction)thread_wait, METH_VARARGS, THREAD_WAIT_DOC},
+    {"thread_isdone",    (PyCFunction)thread_isdone, METH_VARARGS, THREAD_ISDONE_DOC},
+    {"thread_reducerows",(PyCFunction)thread_reducerows, METH_VARARGS, THREAD_REDUCEROWS_DOC},
+    {"thread_reducecols",(PyCFunction)thread_reducecols, METH_VARARGS, THREAD_REDUCECOLS_DOC},
+    {"thread_calibrate", (PyCFunction)thread_calibrate, METH_VARARGS, THREAD_CALIBRATE_DOC},
+    {"thread_getschedule",(PyCFunction)thread_getschedule, METH_VARARGS, THREAD_GETSCHEDULE_DOC},
+    {"thread_setschedule",(PyCFunction)thread_setschedule, METH_VARARGS, THREAD_SETSCHEDULE_DOC},
+    {"thread_getwakemode",(PyCFunction)thread_getwakemode, METH_VARARGS, THREAD_GETWAKEMODE_DOC},
+    {"thread_setwakemode",(PyCFunction)thread_setwakemode, METH_VARARGS, THREAD_SETWAKEMODE_DOC},
+    {"thread_getdeterministic",(PyCFunction)thread_getdeterministic, METH_VARARGS, THREAD_GETDETERMINISTIC_DOC},
+    {"thread_setdeterministic",(PyCFunction)thread_setdeterministic, METH_VARARGS, THREAD_SETDETERMINISTIC_DOC},
+    {"thread_getnumapolicy",(PyCFunction)thread_getnumapolicy, METH_VARARGS, THREAD_GETNUMAPOLICY_DOC},
+    {"thread_setnumapolicy",(PyCFunction)thread_setnumapolicy, METH_VARARGS, THREAD_SETNUMAPOLICY_DOC},
+    {"thread_numainfo",  (PyCFunction)thread_numainfo, METH_VARARGS, THREAD_NUMAINFO_DOC},
+    {"thread_info",      (PyCFunction)thread_info, METH_VARARGS, THREAD_INFO_DOC},
+    {"thread_wakebench", (PyCFunction)thread_wakebench, METH_VARARGS, THREAD_WAKEBENCH_DOC},
+    {"thread_getaffinity",(PyCFunction)thread_getaffinity, METH_VARARGS, THREAD_GETAFFINITY_DOC},
+    {"thread_setaffinity",(PyCFunction)thread_setaffinity, METH_VARARGS, THREAD_SETAFFINITY_DOC},
     {"timer_gettsc",     (PyCFunction)timer_gettsc, METH_VARARGS, TIMER_GETTSC_DOC},
     {"timer_getutc",     (PyCFunction)timer_getutc, METH_VARARGS, TIMER_GETUTC_DOC},
     {"cpustring",        (PyCFunction)cpustring, METH_VARARGS, CPUSTRING_DOC},
+    {"topology",         (PyCFunction)topology, METH_VARARGS, TOPOLOGY_DOC},
     {"oldinit",          (PyCFunction)oldinit, METH_VARARGS | METH_KEYWORDS, OLDINIT_DOC},
     {"ledger_enable",    (PyCFunction)ledger_enable,  METH_VARARGS, LEDGER_ENABLE_DOC},
     {"ledger_disable",   (PyCFunction)ledger_disable,  METH_VARARGS, LEDGER_DISABLE_DOC},
@@ -83,5 +164,13 @@ extern "C" PyMODINIT_FUNC PyInit__fast_numpy_loops(void) {
     if (module == NULL)
         return NULL;
 
+    // C API of the concurrency budget for other extension modules, see budget.h
+    PyObject* budgetApi = PyCapsule_New(&g_BudgetApi, BUDGET_API_CAPSULE, NULL);
+    if (budgetApi == NULL || PyModule_AddObject(module, "_budget_api", budgetApi) < 0) {
+        Py_XDECREF(budgetApi);
+        Py_DECREF(module);
+        return NULL;
+    }
+
     return module;
 }
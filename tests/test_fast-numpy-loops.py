@@ -1,3 +1,7 @@
+import os
+import signal
+
+import pytest
 import numpy as np
 import fast_numpy_loops as fn
 
@@ -29,3 +33,520 @@ def test_result(rng):
 
 def test_numpy():
     np.test()
+
+def test_calibrate(initialize_fast_numpy_loops, rng):
+    result = fn.thread_calibrate()
+    for name, dtype, min_elements in result:
+        assert min_elements > 0
+    # ufuncs still work whichever side of the threshold they land on
+    a = rng.random(1_000_003)
+    assert np.allclose(np.sqrt(a) ** 2, a)
+
+def test_maxthreads(initialize_fast_numpy_loops, rng):
+    old = fn.thread_setmaxthreads('exp', 1)
+    assert fn.thread_getmaxthreads('exp') == 1
+    a = rng.random(1_000_003)
+    assert np.allclose(np.log(np.exp(a)), a)
+    assert fn.thread_setmaxthreads('exp', old) == 1
+    with pytest.raises(ValueError):
+        fn.thread_setmaxthreads('not_a_ufunc', 1)
+
+def test_concurrent(initialize_fast_numpy_loops):
+    # ufuncs release the GIL, so several threads submit jobs at the same time
+    import threading
+    fn.thread_enable()
+    errors = []
+
+    def work(seed):
+        a = np.arange(seed, seed + 1_000_003, dtype=np.float64)
+        for _ in range(20):
+            if not np.array_equal(np.add(a, a), a * 2.0):
+                errors.append(seed)
+            if np.add.reduce(a.astype(np.int64)) != (2 * seed + 1_000_002) * 1_000_003 // 2:
+                errors.append(seed)
+
+    threads = [threading.Thread(target=work, args=(k,)) for k in range(8)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    assert errors == []
+
+def test_submit(initialize_fast_numpy_loops, rng):
+    fn.thread_enable()
+    a = rng.random(1_000_003)
+    b = rng.random(1_000_003)
+    c = np.empty_like(a)
+    future = fn.submit(np.multiply, a, b, out=c)
+    assert future.wait() is c
+    assert future.done()
+    assert np.array_equal(c, a * b)
+
+    s = np.empty_like(a)
+    assert np.array_equal(fn.submit(np.sqrt, a, out=s).wait(), np.sqrt(a))
+
+    # not supported in the background (mixed dtypes), runs right away
+    future = fn.submit(np.add, a, b.astype(np.float32), out=c)
+    assert future.done()
+    assert np.array_equal(c, a + b.astype(np.float32))
+    assert np.array_equal(fn.submit(np.add, a, b).wait(), a + b)
+
+    # byteswapped arrays are not read by the atop loops, numpy runs the call
+    s = a.astype('>f8')
+    assert fn.thread_submit(np.add, c, s, b) is None
+    assert fn.thread_submit(np.sqrt, s.copy(), s) is None
+    assert np.array_equal(fn.submit(np.add, s, b, out=c).wait(), a + b)
+
+    # out overlapping an input, numpy copies the input first
+    s = a.copy()
+    ones = np.ones(len(a) - 1000)
+    assert fn.thread_submit(np.add, s[1000:], s[:-1000], ones) is None
+    expected = np.add(a[:-1000], ones)
+    assert np.array_equal(fn.submit(np.add, s[:-1000], ones, out=s[1000:]).wait(), expected)
+    # in place is fine
+    s = a.copy()
+    assert np.array_equal(fn.submit(np.add, s, b, out=s).wait(), a + b)
+
+    # several threads waiting on the same job, one helps and the others sleep
+    import threading
+    job = fn.thread_submit(np.add, c, a, b)
+    if job is not None:
+        threads = [threading.Thread(target=fn.thread_wait, args=(job,)) for _ in range(4)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        assert fn.thread_isdone(job)
+        assert np.array_equal(c, a + b)
+
+def test_submit_not_waited(initialize_fast_numpy_loops, rng):
+    # a job nobody waits on gives back its producer slot once complete, more jobs than the 64 slots
+    import time
+    fn.thread_enable()
+    a = rng.random(1_000_003)
+    jobs = []
+    for _ in range(70):
+        out = np.empty_like(a)
+        job = fn.thread_submit(np.sqrt, out, a)
+        if job is None:
+            assert not jobs
+            pytest.skip('thread_calibrate stopped sqrt from threading')
+        deadline = time.monotonic() + 30
+        while not fn.thread_isdone(job):
+            assert time.monotonic() < deadline
+            time.sleep(0.0001)
+        assert np.array_equal(out, np.sqrt(a))
+        jobs.append(job)
+    for job in jobs:
+        fn.thread_wait(job)
+
+def test_poolsize(initialize_fast_numpy_loops, rng):
+    fn.thread_enable()
+    old = fn.thread_getpoolsize()
+    a = rng.random(1_000_003)
+    try:
+        for n in (0, 1, 3, 0, old):
+            fn.thread_setpoolsize(n)
+            assert fn.thread_getpoolsize() == n
+            assert np.array_equal(np.add(a, a), a * 2.0)
+    finally:
+        fn.thread_setpoolsize(old)
+    with pytest.raises(ValueError):
+        fn.thread_setpoolsize(-1)
+
+def test_info(initialize_fast_numpy_loops):
+    fn.thread_enable()
+    a = np.ones(4_000_003)
+    np.add(a, a)
+    info = fn.thread_info()
+    assert len(info) == fn.thread_getpoolsize()
+    assert list(info['core']) == list(range(len(info)))
+    assert (info['blocks'] >= 0).all() and (info['wakes'] <= info['jobs']).all()
+
+def test_topology(initialize_fast_numpy_loops):
+    info = fn.topology()
+    assert 1 <= info['usable_cpus'] <= info['cpus']
+    if info['quota_cpus'] is not None:
+        assert info['usable_cpus'] <= np.ceil(info['quota_cpus'])
+    assert {'cpu', 'core', 'cache'} <= set(info['cpu_table'].dtype.names)
+
+@pytest.mark.skipif(not hasattr(os, 'sched_getaffinity'), reason='needs linux affinity')
+def test_affinity(initialize_fast_numpy_loops, rng):
+    import threading
+    fn.thread_enable()
+    caller = os.sched_getaffinity(0)
+    cpus = sorted(caller)
+    old_pool = fn.thread_getpoolsize()
+    old = fn.thread_setaffinity('none')
+    a = rng.random(1_000_003)
+    try:
+        for name in ['compact', 'scatter', 'physical', 'none']:
+            previous = fn.thread_getaffinity()[0]
+            assert fn.thread_setaffinity(name) == previous
+            policy, pinned = fn.thread_getaffinity()
+            assert policy == name and len(pinned) == fn.thread_getpoolsize() + 1
+            if name == 'none':
+                assert pinned == [-1] * len(pinned)
+            else:
+                assert set(pinned) <= caller
+            assert np.array_equal(np.add(a, a), a * 2.0)
+        # the calling thread gets its own cpus back
+        assert os.sched_getaffinity(0) == caller
+
+        assert fn.thread_setaffinity([cpus[-1], cpus[0]]) == 'none'
+        policy, pinned = fn.thread_getaffinity()
+        assert policy == 'list' and pinned[0] == cpus[-1] and set(pinned[1:]) == {cpus[0]}
+        assert os.sched_getaffinity(0) == {cpus[-1]}
+        assert fn.thread_setaffinity('none') == 'list'
+        assert os.sched_getaffinity(0) == caller
+
+        for bad in ['not_a_policy', 'list', [-1], [1 << 20], []]:
+            with pytest.raises(ValueError):
+                fn.thread_setaffinity(bad)
+        assert fn.thread_getaffinity()[0] == 'none'
+
+        # resizing the pool pins the new workers but not the thread that resized it
+        t = threading.Thread(target=fn.thread_setaffinity, args=('compact',))
+        t.start()
+        t.join()
+        fn.thread_setpoolsize(3)
+        policy, pinned = fn.thread_getaffinity()
+        assert policy == 'compact' and len(pinned) == 4 and min(pinned) >= 0
+        assert os.sched_getaffinity(0) == caller
+    finally:
+        fn.thread_setaffinity('none')
+        fn.thread_setpoolsize(old_pool)
+        fn.thread_setaffinity(old)
+
+def test_wakemode(initialize_fast_numpy_loops, rng):
+    fn.thread_enable()
+    old = fn.thread_setwakemode('tree')
+    old_pool = fn.thread_getpoolsize()
+    a = rng.random(1_000_003)
+    try:
+        assert fn.thread_getwakemode() == 'tree'
+        fn.thread_setpoolsize(6)
+        info = fn.thread_info()
+        assert info['leader'][0] == 1
+        for _ in range(20):
+            assert np.array_equal(np.add(a, a), a * 2.0)
+    finally:
+        fn.thread_setpoolsize(old_pool)
+        fn.thread_setwakemode(old)
+    with pytest.raises(ValueError):
+        fn.thread_setwakemode('ring')
+
+@pytest.mark.parametrize('mode', ['flat', 'targeted'])
+def test_wake_count_enforced(initialize_fast_numpy_loops, mode):
+    # no more workers join a job than asked for, even when others are awake
+    fn.thread_enable()
+    old = fn.thread_setwakemode(mode)
+    old_pool = fn.thread_getpoolsize()
+    try:
+        fn.thread_setpoolsize(6)
+        rows = fn.thread_wakebench(30, 2, 32, 20, 0)
+        assert (rows[:, 3] <= 2).all()
+    finally:
+        fn.thread_setpoolsize(old_pool)
+        fn.thread_setwakemode(old)
+
+def test_budget(initialize_fast_numpy_loops):
+    fn.thread_enable()
+    old = fn.thread_setbudget(3)
+    old_pool = fn.thread_getpoolsize()
+    try:
+        fn.thread_setpoolsize(4)
+        with fn.reserve_cores(5) as granted:
+            assert granted == 3
+            # every core is held by the other pool, the calling thread works alone
+            rows = fn.thread_wakebench(10, 4, 16)
+            assert (rows[:, 3] == 0).all()
+            assert fn.thread_budgetstats()['available'] == 0
+        assert type(fn._fast_numpy_loops._budget_api).__name__ == 'PyCapsule'
+        assert fn.thread_budgetstats()['in_use'] == 0
+        a = np.arange(1_000_003.0)
+        assert np.array_equal(np.add(a, a), a * 2.0)
+    finally:
+        fn.thread_setpoolsize(old_pool)
+        fn.thread_setbudget(old)
+
+@pytest.mark.skipif(not hasattr(os, 'fork'), reason='needs fork')
+def test_fork(initialize_fast_numpy_loops):
+    # the child starts its own worker threads instead of hanging or running alone
+    fn.thread_enable()
+    a = np.arange(1_000_003.0)
+    # jobs likely still running at the fork, waiting in the child runs them again
+    big = np.arange(8_000_000.0)
+    outs = [np.empty_like(big) for _ in range(2)]
+    jobs = [fn.thread_submit(np.sqrt, out, big) for out in outs]
+    inplace = big.copy()
+    jobs.append(fn.thread_submit(np.sqrt, inplace, inplace))
+    pid = os.fork()
+    if pid == 0:
+        status = 1
+        try:
+            signal.alarm(60)
+            ok = True
+            # waited on before anything else rebuilt the worker threads
+            if jobs[0] is not None:
+                fn.thread_wait(jobs[0])
+                ok = ok and np.array_equal(outs[0], np.sqrt(big))
+            rows = fn.thread_wakebench(20, 0, 64, 20)
+            ok = ok and np.array_equal(np.add(a, a), a * 2.0)
+            if jobs[1] is not None:
+                fn.thread_wait(jobs[1])
+                ok = ok and fn.thread_isdone(jobs[1]) and np.array_equal(outs[1], np.sqrt(big))
+            if jobs[2] is not None:
+                # written in place, its first blocks may already be done
+                try:
+                    fn.thread_wait(jobs[2])
+                    ok = False
+                except RuntimeError:
+                    pass
+            status = 0 if ok and (fn.thread_getpoolsize() == 0 or rows[:, 3].max() > 0) else 2
+        finally:
+            os._exit(status)
+    for job in jobs:
+        if job is not None:
+            fn.thread_wait(job)
+    _, status = os.waitpid(pid, 0)
+    assert os.WIFEXITED(status) and os.WEXITSTATUS(status) == 0
+    if jobs[1] is not None:
+        assert np.array_equal(outs[1], np.sqrt(big))
+
+def test_wakebench(initialize_fast_numpy_loops):
+    fn.thread_enable()
+    rows = fn.thread_wakebench(20, 0, 16)
+    assert rows.shape == (20, 4)
+    assert (rows[:, 2] >= rows[:, 0]).all()
+    assert (rows[:, 3] <= fn.thread_getpoolsize()).all()
+
+def test_spin(initialize_fast_numpy_loops):
+    fn.thread_enable()
+    old, old_backoff = fn.thread_getspin()
+    try:
+        assert fn.thread_setspin(200.0, False) == old
+        assert fn.thread_getspin() == (200.0, False)
+        assert fn.thread_setspin(0.0) == 200.0
+        assert fn.thread_getspin() == (0.0, True)
+        before = fn.thread_spinstats()
+        # thread_calibrate may have stopped the ufuncs from threading, wakebench always wakes the workers
+        rows = fn.thread_wakebench(10, 0, 16, 20)
+        after = fn.thread_spinstats()
+        assert all(after[k] >= before[k] for k in before)
+        if rows[:, 3].max() > 0:
+            # a worker that joined a job goes back to sleep or finds more work
+            assert sum(after.values()) > sum(before.values())
+    finally:
+        fn.thread_setspin(old, old_backoff)
+
+def test_waitspin(initialize_fast_numpy_loops):
+    fn.thread_enable()
+    old = fn.thread_setwaitspin(0.0)
+    try:
+        assert fn.thread_setwaitspin(100.0) == 0.0
+        assert fn.thread_setwaitspin(0.0) == 100.0
+        before = fn.thread_waitstats()
+        # every job waits once, spinning or blocked
+        fn.thread_wakebench(10, 0, 16, 20)
+        after = fn.thread_waitstats()
+        assert all(after[k] >= before[k] for k in before)
+        waits = after['spin_count'] + after['blocked_count'] - before['spin_count'] - before['blocked_count']
+        assert waits >= 10
+    finally:
+        fn.thread_setwaitspin(old)
+
+def test_latency_lane(initialize_fast_numpy_loops):
+    # small compares from one thread while another runs large logs
+    import threading
+    fn.thread_enable()
+    old = fn.thread_setlatencybytes(1 << 20)
+    big = np.linspace(1.0, 2.0, 4_000_003)
+    stop = []
+
+    def bulk():
+        out = np.empty_like(big)
+        while not stop:
+            np.log(big, out=out)
+
+    t = threading.Thread(target=bulk)
+    t.start()
+    try:
+        a = np.arange(50_000.0)
+        for _ in range(50):
+            assert np.count_nonzero(np.less(a, 25_000.0)) == 25_000
+    finally:
+        stop.append(1)
+        t.join()
+        assert fn.thread_setlatencybytes(old) == 1 << 20
+    assert np.array_equal(np.log(big), np.log(big.copy()))
+
+@pytest.mark.parametrize('schedule', ['ring', 'steal', 'static'])
+def test_schedule(initialize_fast_numpy_loops, rng, schedule):
+    fn.thread_enable()
+    old = fn.thread_setschedule(schedule)
+    try:
+        assert fn.thread_getschedule() == schedule
+        a = rng.random(1_000_003)
+        assert np.array_equal(np.add(a, a), a * 2.0)
+        assert np.allclose(np.add.reduce(a), a.sum())
+    finally:
+        fn.thread_setschedule(old)
+
+def test_steal_schedule(initialize_fast_numpy_loops, rng):
+    fn.thread_enable()
+    old = fn.thread_setschedule('steal')
+    old_workers = fn.thread_setworkers(3)
+    fn.thread_setblocksize(0x400)
+    try:
+        # 3 workers and the main thread: 4 threads, 14 and 245 blocks do not split evenly
+        for n in [0x400 * 13 + 5, 0x400 * 245]:
+            a = rng.random(n)
+            i = rng.integers(-1000, 1000, size=n)
+            assert np.array_equal(np.add(a, a), a * 2.0)
+            assert np.array_equal(np.sqrt(a), np.sqrt(a.tolist()))
+            assert np.add.reduce(i) == int(i.astype(object).sum())
+            assert np.maximum.reduce(a) == a.max()
+            assert np.allclose(np.add.reduce(a), a.sum())
+    finally:
+        fn.thread_setblocksize(0)
+        fn.thread_setworkers(old_workers)
+        fn.thread_setschedule(old)
+
+@pytest.mark.parametrize('dtype', [np.int8, np.uint8, np.int16, np.uint16, np.int32, np.uint32, np.int64, np.uint64])
+@pytest.mark.parametrize('ufunc', [np.add, np.multiply, np.minimum, np.maximum])
+def test_int_reduce(initialize_fast_numpy_loops, rng, dtype, ufunc):
+    info = np.iinfo(dtype)
+    a = rng.integers(info.min, info.max, size=1_000_003, dtype=dtype)
+    if ufunc is np.multiply:
+        # odd factors so the product does not wrap to zero
+        a |= 1
+    # threaded, unthreaded with a tail, strided (dtype= so small ints do not upcast to int_)
+    arrays = [a, a[:1003], a[::3]]
+    fn.atop_enable()
+    fn.thread_enable()
+    results = [ufunc.reduce(x, dtype=dtype) for x in arrays] + [ufunc(a, a[::-1])]
+    fn.atop_disable()
+    fn.thread_disable()
+    try:
+        expected = [ufunc.reduce(x, dtype=dtype) for x in arrays] + [ufunc(a, a[::-1])]
+    finally:
+        fn.atop_enable()
+        fn.thread_enable()
+    for r, e in zip(results, expected):
+        assert r.dtype == e.dtype
+        assert np.array_equal(r, e)
+
+@pytest.mark.parametrize('dtype', [np.float32, np.float64])
+def test_summode(initialize_fast_numpy_loops, rng, dtype):
+    a = rng.random(1_000_003).astype(dtype)
+    old = fn.atop_setsummode('pairwise')
+    try:
+        assert fn.atop_getsummode() == 'pairwise'
+        # unthreaded the pairwise sum adds in the same order as numpy
+        fn.thread_disable()
+        fast = [np.add.reduce(a), np.add.reduce(a[::3]), np.add.reduce(a[:1003])]
+        fn.atop_disable()
+        expected = [np.add.reduce(a), np.add.reduce(a[::3]), np.add.reduce(a[:1003])]
+        fn.atop_enable()
+        assert fast == expected
+        fn.thread_enable()
+        assert np.isclose(np.add.reduce(a), expected[0], rtol=10 * np.finfo(dtype).eps)
+        assert fn.atop_setsummode('fast') == 'pairwise'
+        assert np.isclose(np.add.reduce(a), expected[0], rtol=1e-3)
+        # initial is counted once however many blocks the sum is split into
+        assert np.add.reduce(np.ones(1_000_003, dtype=dtype), initial=5) == 1_000_008
+        with pytest.raises(ValueError):
+            fn.atop_setsummode('kahan')
+    finally:
+        fn.atop_enable()
+        fn.thread_enable()
+        fn.atop_setsummode(old)
+
+def test_deterministic(initialize_fast_numpy_loops, rng):
+    a = rng.standard_normal(1_000_003).astype(np.float32)
+    old = fn.thread_setdeterministic(True)
+    old_workers = fn.thread_getworkers()
+    try:
+        assert fn.thread_getdeterministic() == True
+        results = set()
+        for threads in [False, True]:
+            (fn.thread_enable if threads else fn.thread_disable)()
+            for workers in [1, 3]:
+                fn.thread_setworkers(workers)
+                for blocksize in [0, 0x400]:
+                    fn.thread_setblocksize(blocksize)
+                    results.add((np.add.reduce(a).tobytes(), np.multiply.reduce(1 + a / 1e6).tobytes()))
+        assert len(results) == 1
+        assert np.isclose(np.add.reduce(a), a.astype(np.float64).sum(), rtol=1e-5)
+    finally:
+        fn.thread_setblocksize(0)
+        fn.thread_setworkers(old_workers)
+        fn.thread_enable()
+        fn.thread_setdeterministic(old)
+
+@pytest.mark.parametrize('dtype', [np.int8, np.uint16, np.int64, np.float32, np.float64])
+def test_reduce_rows(initialize_fast_numpy_loops, rng, dtype):
+    a = (rng.random((100_003, 17)) * 100).astype(dtype)
+    for ufunc in [np.add, np.minimum, np.maximum]:
+        expected = ufunc.reduce(a, axis=-1)
+        r = fn.reduce(ufunc, a)
+        assert r.dtype == expected.dtype
+        assert np.array_equal(r, expected)
+        # same dtype in and out so small ints reach the row reduce
+        assert np.array_equal(fn.reduce(ufunc, a, dtype=dtype), ufunc.reduce(a, axis=-1, dtype=dtype))
+        assert np.array_equal(fn.reduce(ufunc, a, initial=7), ufunc.reduce(a, axis=-1, initial=7))
+    out = np.zeros(a.shape[0], dtype=dtype)
+    assert fn.thread_reducerows(np.add, out, a, True) is out
+    assert np.array_equal(out, np.add.reduce(a, axis=-1, dtype=dtype))
+    # not contiguous, falls back to numpy
+    assert fn.thread_reducerows('add', out, a[:, ::2]) is None
+    assert np.array_equal(fn.reduce(np.maximum, a[:, ::2]), a[:, ::2].max(axis=-1))
+    assert np.array_equal(fn.reduce(np.add, a, axis=1), np.add.reduce(a, axis=1))
+    if a.dtype.kind == 'f':
+        # float min and max run numpy's loop on each row, nan included
+        a[5, 3] = np.nan
+        assert np.array_equal(fn.reduce(np.minimum, a), a.min(axis=-1), equal_nan=True)
+        assert np.isnan(fn.reduce(np.maximum, a)[5])
+
+@pytest.mark.parametrize('dtype', [np.float32, np.float64])
+def test_reduce_long_rows(initialize_fast_numpy_loops, rng, dtype):
+    # numpy can chunk or thread a long row, the sum only matches to the last bits
+    a = rng.random((10, 100_003)).astype(dtype)
+    expected = np.add.reduce(a, axis=-1)
+    assert np.allclose(fn.reduce(np.add, a), expected, rtol=10 * np.finfo(dtype).eps)
+    out = np.zeros(a.shape[0], dtype=dtype)
+    assert fn.thread_reducerows(np.add, out, a, True) is out
+    assert np.allclose(out, expected, rtol=10 * np.finfo(dtype).eps)
+    assert np.array_equal(fn.reduce(np.maximum, a), a.max(axis=-1))
+
+@pytest.mark.parametrize('shape', [(100_003, 7), (2_000, 5_000)])
+@pytest.mark.parametrize('dtype', [np.int8, np.int64, np.float32, np.float64])
+def test_reduce_cols(initialize_fast_numpy_loops, rng, shape, dtype):
+    a = (rng.random(shape) * 100).astype(dtype)
+    for ufunc in [np.add, np.minimum, np.maximum]:
+        expected = ufunc.reduce(a, axis=0, dtype=dtype)
+        r = fn.reduce(ufunc, a, axis=0, dtype=dtype)
+        assert r.dtype == expected.dtype
+        if ufunc is np.add and a.dtype.kind == 'f':
+            # the rows are added in groups, not one after another
+            assert np.allclose(r, expected, rtol=1e-5)
+        else:
+            assert np.array_equal(r, expected)
+    assert np.array_equal(fn.reduce(np.maximum, a, axis=0, initial=50), a.max(axis=0, initial=50))
+    out = np.empty(shape[1], dtype=dtype)
+    assert fn.thread_reducecols(np.minimum, out, a) is out
+    assert np.array_equal(out, a.min(axis=0))
+    if a.dtype.kind == 'f':
+        a[shape[0] // 2, 3] = np.nan
+        assert np.isnan(fn.reduce(np.minimum, a, axis=0)[3])
+
+@pytest.mark.parametrize('axis', [-1, 0])
+def test_reduce_byteswapped(initialize_fast_numpy_loops, rng, axis):
+    # the row and column reduces read the elements directly, numpy handles other byte orders
+    a = (rng.random((200, 300)) * 100).astype('>f8')
+    assert np.allclose(fn.reduce(np.add, a, axis=axis), np.add.reduce(a, axis=axis))
+    assert np.array_equal(fn.reduce(np.maximum, a, axis=axis), a.max(axis=axis))
+    assert fn.thread_reducerows(np.add, np.zeros(200, dtype='>f8'), a) is None
+    assert fn.thread_reducecols(np.add, np.zeros(300, dtype='>f8'), a) is None
+    assert fn.thread_reducerows(np.add, np.zeros(200, dtype='>f8'), a.astype(np.float64)) is None